@@ -17,15 +17,6 @@ SingleCharData SingleCharData::apply(SingleCharData other) {
     return rv;
 };
 
-bool SingleCharData::get_count_exact() const {
-    return count_exact;
-}
-uint8_t SingleCharData::get_count_min() const {
-    return count_min;
-}
-uint8_t SingleCharData::get_disallowed_pos() const {
-    return disallowed_pos;
-}
 typedef unsigned char v32c __attribute__ ((vector_size (32)));
 
 CMask::CMask() : v{0,0,0,0} {}
@@ -197,7 +188,10 @@ const simd_vector sv_mask_exact_and_disallowed = { v_mask_exact_and_disallowed }
 #endif
 
 bool CMask::check(const Word& w) const {
-    const CMask& other = w.cmask;
+    return check_word_cmask(w.cmask);
+}
+
+bool CMask::check_word_cmask(const CMask& other) const {
 
     #if USE_AVX    
     // Vectorized to do one chunk of 256-bit -> 1ns but x64 only. Conveniently
@@ -386,6 +380,32 @@ bool CMask::has_at_least_one_green() const {
     // it might be possible to eliminate 25 things via yellows without getting any greens... but I doubt it?
 }
 
+void CMask::letter_bits(uint32_t disallowed_by_pos[5], uint32_t count_min_bits[2], uint32_t& count_exact) const {
+    #if USE_AVX
+    const uint32_t all_letters = (1 << 26) - 1;
+    // movemask takes the top bit of each byte, so shift the bit we want up there
+    simd_vector sv;
+    sv.v = v;
+    disallowed_by_pos[0] = _mm256_movemask_epi8(_mm256_slli_epi16(sv.y, 7)) & all_letters;
+    disallowed_by_pos[1] = _mm256_movemask_epi8(_mm256_slli_epi16(sv.y, 6)) & all_letters;
+    disallowed_by_pos[2] = _mm256_movemask_epi8(_mm256_slli_epi16(sv.y, 5)) & all_letters;
+    disallowed_by_pos[3] = _mm256_movemask_epi8(_mm256_slli_epi16(sv.y, 4)) & all_letters;
+    disallowed_by_pos[4] = _mm256_movemask_epi8(_mm256_slli_epi16(sv.y, 3)) & all_letters;
+    count_min_bits[0] = _mm256_movemask_epi8(_mm256_slli_epi16(sv.y, 2)) & all_letters;
+    count_min_bits[1] = _mm256_movemask_epi8(_mm256_slli_epi16(sv.y, 1)) & all_letters;
+    count_exact = _mm256_movemask_epi8(sv.y) & all_letters;
+    #else
+    for (int p = 0; p < 5; p++) disallowed_by_pos[p] = 0;
+    count_min_bits[0] = count_min_bits[1] = count_exact = 0;
+    for (int zc = 0; zc < 26; zc++) {
+        for (int p = 0; p < 5; p++) disallowed_by_pos[p] |= ((c[zc].disallowed_pos >> p) & 1) << zc;
+        count_min_bits[0] |= (c[zc].count_min & 1) << zc;
+        count_min_bits[1] |= (c[zc].count_min >> 1) << zc;
+        count_exact |= c[zc].count_exact << zc;
+    }
+    #endif
+}
+
 int CMask::count_yellow_or_green(const bool* is_letter_valid) const {
     int yellows = 0;
     for (int zc = 0; zc < 26; zc++) {
@@ -418,10 +438,6 @@ size_t CMask::hash() const {
     return (w0 ^ w1 ^ w2 ^ w3);
 }
 
-SingleCharData CMask::get_single_char(char letter) const {
-    return c[letter -'A'];
-}
-
 const unsigned int CMask::num_hex_chars = 52;
 
 std::string CMask::to_hex() const {
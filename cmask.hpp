@@ -43,9 +43,10 @@ class SingleCharData {
 public:
     SingleCharData apply(SingleCharData other);
 
-    bool get_count_exact() const;
-    uint8_t get_count_min() const;
-    uint8_t get_disallowed_pos() const;
+    // inline, Word_set::filter reads these for every letter
+    bool get_count_exact() const { return count_exact; }
+    uint8_t get_count_min() const { return count_min; }
+    uint8_t get_disallowed_pos() const { return disallowed_pos; }
 private:
     union {
         uint8_t all;
@@ -91,6 +92,9 @@ public:
     // logic operations
     CMask& apply(const CMask& m); // intended to be fast
     bool check(const Word& w) const; // [check] is the most speed-critical function
+    // the same, but given the word's precomputed cmask (Dictionary::WordIndex::cmask()) so we
+    // don't have to touch the Word
+    bool check_word_cmask(const CMask& word_cmask) const;
     bool operator<(const CMask& m) const;
     bool operator==(const CMask& m) const;
     bool has_at_most_one_letter_undetermined() const;
@@ -98,11 +102,16 @@ public:
     int count_yellow_or_green(const bool* is_letter_valid = nullptr) const; //is_letter_valid should be an array 0..25
     size_t hash() const;
 
+    // The same constraints with one bit per letter (bit 0 = 'A'): disallowed_by_pos[p] has the letters
+    // that can't be at p, count_min_bits[i] has bit i of each letter's count_min, and count_exact
+    // the letters whose count_min is exact. What Word_set::filter works from.
+    void letter_bits(uint32_t disallowed_by_pos[5], uint32_t count_min_bits[2], uint32_t& count_exact) const;
+
     // very slow, but raises a message that's useful for the user.
     void check_detail_reasons_exn(const Word& w) const;
     
     // IO/other operations
-    SingleCharData get_single_char(char letter) const; //letter must be in 'A'..'Z'
+    SingleCharData get_single_char(char letter) const { return c[letter - 'A']; } //letter must be in 'A'..'Z'
     std::string to_hex() const;
     static CMask of_hex(const std::string& s);
     friend std::ostream& operator<<(std::ostream& os, const CMask& m);
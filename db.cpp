@@ -2,8 +2,20 @@
 #include <algorithm>
 #include <sstream>
 #include <cstdio>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <shared_mutex>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "db.hpp"
+#include "dictionary.hpp"
+#include "metrics.hpp"
 
 using std::string;
 using std::vector;
@@ -14,6 +26,7 @@ using std::pair;
 using boost::posix_time::ptime;
 using boost::posix_time::microsec_clock;
 using Solver::SolveResult;
+using Solver::Bound;
 typedef Word::Compact CompactWord;
 
 namespace Db {
@@ -21,18 +34,72 @@ namespace Db {
     // Db_intf
     static SolveResult dummy_result;
     void Db_intf::save(const CMask& m, CompactWord g, Objective o, const SolveResult& r) { save(Job(m, g, o), r); }
-    bool Db_intf::query(const CMask& m, CompactWord g, Objective o, SolveResult& r) const { return query(Job(m, g, o), r); }
-    bool Db_intf::query(const CMask& m, CompactWord g, Objective o) const { return query(Job(m, g, o), dummy_result); }
-    bool Db_intf::query(const Job& j) const { return query(j, dummy_result); }
+    bool Db_intf::query(const CMask& m, CompactWord g, Objective o, SolveResult& r) const {
+        uint64_t sample = Metrics::sample_start();
+        bool hit = query(Job(m, g, o), r);
+        count_query(o, hit, sample);
+        return hit;
+    }
+    bool Db_intf::query(const CMask& m, CompactWord g, Objective o) const { return query(m, g, o, dummy_result); }
+    bool Db_intf::query(const Job& j) const {
+        uint64_t sample = Metrics::sample_start();
+        bool hit = query(j, dummy_result);
+        count_query(j.get_objective(), hit, sample);
+        return hit;
+    }
+
+    static const int num_objectives = static_cast<int>(Objective::pwin5) + 1;
+
+    // looked up once, so counting is just the adds
+    struct Query_metrics {
+        Query_metrics() {
+            Metrics::Registry& r = Metrics::registry();
+            for (int o = 0; o < num_objectives; o++) {
+                std::ostringstream labels;
+                labels << "objective=\"" << static_cast<Objective>(o) << "\"";
+                queries[o] = &r.counter("wordle_db_queries_total", "Db lookups by the solver.", labels.str());
+                hits[o] = &r.counter("wordle_db_hits_total", "Db lookups that found something.", labels.str());
+            }
+            latency = &r.histogram("wordle_db_query_seconds", "Latency of a sample of the db lookups.");
+        }
+        Metrics::Counter* queries[num_objectives];
+        Metrics::Counter* hits[num_objectives];
+        Metrics::Histogram* latency;
+    };
+
+    void count_query(Objective o, bool hit, uint64_t sample_start) {
+        static const Query_metrics metrics;
+        metrics.latency->record_since(sample_start);
+        int i = static_cast<int>(o);
+        if (i < 0 || i >= num_objectives) return;
+        metrics.queries[i]->add();
+        if (hit) metrics.hits[i]->add();
+    }
 
     // internal to this file
-    std::ostream& operator<<(std::ostream& os, const pair<Job, SolveResult>& kv) {
+    std::ostream& operator<<(std::ostream& os, const Record& kv) {
         os << kv.first <<  " -> " << kv.second;
         return os;
     }
 
-    // not set externally, only used for the test.
     bool silence = false;
+    const size_t index_stride = 4096;
+
+    bool record_less(const Record& lhs, const Record& rhs) {
+        return lhs.first < rhs.first;
+    }
+
+    // Adds [r] to [data] unless it already has that Job, but an exact result replaces a bound.
+    // Returns whether it did anything.
+    static bool insert_record(map<Job, SolveResult>& data, const Record& r) {
+        auto inserted = data.insert(r);
+        if (inserted.second) return true;
+        if (inserted.first->second.get_bound() != Bound::exact && r.second.get_bound() == Bound::exact) {
+            inserted.first->second = r.second;
+            return true;
+        }
+        return false;
+    }
 
     //////////////////
     // Read_write_db
@@ -46,11 +113,11 @@ namespace Db {
     }
     void Read_write_db::load_from_file(const string& filename) {
         ptime start = microsec_clock::local_time();
-        pair<Job, SolveResult> next_record;
+        Record next_record;
         std::ifstream ifs(filename, std::ios::binary);
         uint64_t count = 0;
         while(ifs.read(reinterpret_cast<char*>(&next_record), sizeof(next_record))) {
-            data.insert(next_record);
+            insert_record(data, next_record);
             count++;
         }
         if (!silence) {
@@ -69,10 +136,9 @@ namespace Db {
         if (!silence) cerr << "Writing to db: " << filename << endl;
     }
     void Read_write_db::save(const Job& j, const SolveResult& r) {
-        pair<Job, SolveResult> next_record = { j, r };
-        if (data.count(next_record.first)) return;
-    
-        data.insert(next_record);
+        Record next_record = { j, r };
+        if (!insert_record(data, next_record)) return;
+
         if (output_file.is_open() && output_file.good()) {
             if (debug_output) {
                 cerr << "saving " << next_record << endl;
@@ -96,91 +162,478 @@ namespace Db {
         }
     }
 
+    size_t Read_write_db::query_all(const CMask& m, vector<Record>& out) const {
+        size_t count = 0;
+        for (auto it = data.lower_bound(Job::first_for_mask(m)); it != data.end() && it->first.get_mask() == m; ++it) {
+            out.push_back(*it);
+            count++;
+        }
+        return count;
+    }
+
+    //////////////////
+    Locked_db::Locked_db(Db_intf& inner_) : inner(inner_) {}
+
+    void Locked_db::save(const Job& j, const SolveResult& result) {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        inner.save(j, result);
+    }
+
+    bool Locked_db::query(const Job& j, SolveResult& result) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return inner.query(j, result);
+    }
+
+    size_t Locked_db::query_all(const CMask& m, vector<Record>& out) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return inner.query_all(m, out);
+    }
+
+    bool Locked_db::query_all_is_complete() const {
+        return inner.query_all_is_complete();
+    }
+
     //////////////////
     // ignores save commands, but is slightly faster
     // you can load from many files
     Read_only_db::Read_only_db() {};
     Read_only_db::Read_only_db(const string& filename) : Read_only_db(vector<string>{filename}) {}
     Read_only_db::Read_only_db(const vector<string>& filenames) {
-        for (const string& file : filenames) {
-            load_from_file_no_sort(file);
-        }
         if (filenames.empty()) return;
-    
-        if (!silence) cerr << "Is it sorted? ...";
         ptime start = microsec_clock::local_time();
-        bool is_sorted =
-            std::is_sorted
-            (data.begin(),
-             data.end(),
-             [] (const pair<Job,SolveResult>& lhs,
-                 const pair<Job,SolveResult>& rhs)
-             { return lhs.first < rhs.first; });
-        if (is_sorted) {
-            if (!silence) cerr << "yes, took " << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
-        } else {
-            if (!silence) cerr << "no, took "  << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
-            sort();
+
+        // Each file is mapped and checked on one of a few threads, then they are all merged straight
+        // into our layout, so the only copy of the db in our memory is the final one. Almost always
+        // every file is already sorted, the rare one that isn't is read and sorted on its own.
+        size_t n = filenames.size();
+        vector<std::unique_ptr<Mapped_file>> files(n);
+        vector<vector<Record>> sorted_copies(n);
+        std::atomic<size_t> next_file(0);
+        unsigned int num_threads = std::min<size_t>(n, std::max(1u, std::thread::hardware_concurrency()));
+        unsigned int sort_threads = std::max(1u, std::thread::hardware_concurrency() / num_threads);
+        vector<std::thread> threads;
+        for (unsigned int t = 0; t < num_threads; t++) {
+            threads.emplace_back([&] () {
+                for (size_t i = next_file++; i < n; i = next_file++) {
+                    try {
+                        files[i].reset(new Mapped_file(filenames[i]));
+                    } catch (const std::runtime_error& e) {
+                        cerr << e.what() << endl;
+                        continue;
+                    }
+                    if (!std::is_sorted(files[i]->begin(), files[i]->end(), record_less)) {
+                        sorted_copies[i].assign(files[i]->begin(), files[i]->end());
+                        files[i].reset();
+                        sort_records(sorted_copies[i], sort_threads);
+                    }
+                }
+            });
+        }
+        for (std::thread& t : threads) t.join();
+
+        size_t total = 0;
+        vector<pair<const Record*, const Record*>> sources;
+        for (size_t i = 0; i < n; i++) {
+            if (files[i]) {
+                sources.push_back({files[i]->begin(), files[i]->end()});
+            } else {
+                sources.push_back({sorted_copies[i].data(), sorted_copies[i].data() + sorted_copies[i].size()});
+            }
+            size_t size = sources.back().second - sources.back().first;
+            total += size;
+            if (!silence && (files[i] || !sorted_copies[i].empty())) {
+                cerr << "Read " << size << " from db: " << filenames[i] << (files[i] ? "" : " (had to sort it)") << endl;
+            }
+        }
+
+        entries.reserve(total);
+        merge_sorted(sources, [this] (const Record& r) { append(r); });
+        finish_layout();
+        if (!silence) {
+            cerr << "Loaded " << entries.size() << " records for " << masks.size() << " masks (" << (total - entries.size()) << " duplicates dropped) from "
+                 << filenames.size() << " files, took " << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
         }
     }
-    void Read_only_db::sort() {
-        ptime start = microsec_clock::local_time();
-        if (!silence) cerr << "Sorting...";
-        std::sort
-            (data.begin(),
-             data.end(),
-             [] (const pair<Job,SolveResult>& lhs,
-                 const pair<Job,SolveResult>& rhs)
-             { return lhs.first < rhs.first; });
-        if (!silence) cerr << " done, took " << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
-    }
-    void Read_only_db::load_from_file_no_sort(const string& filename) {
-        ptime start = microsec_clock::local_time();
+    void Read_only_db::append(const Record& r) {
+        const Job& j = r.first;
+        if (masks.empty() || !(masks.back() == j.mask)) {
+            masks.push_back(j.mask);
+            mask_offsets.push_back(entries.size());
+        }
+        entries.push_back({j.guess_and_objective, r.second});
+    }
+    void Read_only_db::finish_layout() {
+        mask_offsets.push_back(entries.size());
+        masks.shrink_to_fit();
+        mask_offsets.shrink_to_fit();
+    }
+    bool Read_only_db::read_file(const string& filename, vector<Record>& out) {
         std::ifstream ifs(filename, std::ios::binary | std::ifstream::ate);
         if (!(ifs.is_open() && ifs.good())) {
             cerr << "Error opening db: " << filename << endl;
-            return;
+            return false;
         }
         size_t file_size = ifs.tellg();
-        size_t num_records = (file_size / sizeof(pair<Job,SolveResult>));
-        if (!silence) cerr << "Reading " << num_records << " from db: " << filename << "... ";
+        size_t num_records = (file_size / sizeof(Record));
         ifs.seekg(0);
-        size_t prev_size = data.size();
-        data.resize(prev_size + num_records);
+        size_t prev_size = out.size();
+        out.resize(prev_size + num_records);
 
-        if (!ifs.read(reinterpret_cast<char*>(&data[prev_size]), sizeof(pair<Job,SolveResult>) * num_records)) {
-            cerr << " failed!";
-            data.resize(prev_size);
-            return;
+        if (!ifs.read(reinterpret_cast<char*>(&out[prev_size]), sizeof(Record) * num_records)) {
+            cerr << "Error reading db: " << filename << endl;
+            out.resize(prev_size);
+            return false;
         }
-        if (!silence) cerr << " done, took " << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
+        return true;
     }
     void Read_only_db::load_from_file(const string& filename) {
-        load_from_file_no_sort(filename);
-        sort();
+        ptime start = microsec_clock::local_time();
+        vector<Record> added;
+        if (!read_file(filename, added)) return;
+        sort_records(added, std::thread::hardware_concurrency());
+
+        // merged with what we already have into a new layout, ours first so it wins on duplicates
+        vector<CMask> old_masks;
+        vector<uint64_t> old_offsets;
+        vector<Entry> old_entries;
+        old_masks.swap(masks);
+        old_offsets.swap(mask_offsets);
+        old_entries.swap(entries);
+        entries.reserve(old_entries.size() + added.size());
+        auto next_added = added.begin();
+        for (size_t i = 0; i < old_masks.size(); i++) {
+            for (uint64_t e = old_offsets[i]; e < old_offsets[i + 1]; e++) {
+                Job j(old_masks[i], Job::no_guess, Objective::adversarial);
+                j.guess_and_objective = old_entries[e].guess_and_objective;
+                for (; next_added != added.end() && next_added->first < j; ++next_added) append(*next_added);
+                if (next_added != added.end() && !(j < next_added->first)) ++next_added;
+                append({j, old_entries[e].result});
+            }
+        }
+        for (; next_added != added.end(); ++next_added) append(*next_added);
+        finish_layout();
+        if (!silence) cerr << "Read and sorted db: " << filename << ", took " << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
     }
     void Read_only_db::save(const Job& j, const SolveResult& result) {
         return;
     }
+    ptrdiff_t Read_only_db::find_mask(const CMask& m) const {
+        vector<CMask>::const_iterator it = std::lower_bound(masks.begin(), masks.end(), m);
+        if (it == masks.end() || m < *it) return -1;
+        return it - masks.begin();
+    }
     bool Read_only_db::query(const Job& j, SolveResult& result) const {
-        vector<pair<Job,SolveResult>>::const_iterator it =
+        ptrdiff_t i = find_mask(j.mask);
+        if (i < 0) return false;
+        const Entry* lo = entries.data() + mask_offsets[i];
+        const Entry* hi = entries.data() + mask_offsets[i + 1];
+        const Entry* it =
             std::lower_bound
-            (data.begin(),
-             data.end(),
-             j,
-             [] (const pair<Job,SolveResult>& lhs, const Job& rhs) { return lhs.first < rhs; }
+            (lo,
+             hi,
+             j.guess_and_objective,
+             [] (const Entry& lhs, int32_t rhs) { return lhs.guess_and_objective < rhs; }
              );
+        if (it == hi || it->guess_and_objective != j.guess_and_objective) return false;
+        result = it->result;
+        return true;
+    }
+    size_t Read_only_db::query_all(const CMask& m, vector<Record>& out) const {
+        ptrdiff_t i = find_mask(m);
+        if (i < 0) return 0;
+        for (uint64_t e = mask_offsets[i]; e < mask_offsets[i + 1]; e++) {
+            Job j(m, Job::no_guess, Objective::adversarial);
+            j.guess_and_objective = entries[e].guess_and_objective;
+            out.push_back({j, entries[e].result});
+        }
+        return mask_offsets[i + 1] - mask_offsets[i];
+    }
+
+    //////////////////
+    // Mapped_file
+
+    Mapped_file::Mapped_file(const string& filename_) : filename(filename_), records(nullptr), num_records(0) {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Error opening db: " + filename);
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Error stat'ing db: " + filename);
+        }
+        num_records = st.st_size / sizeof(Record);
+        if (num_records > 0) {
+            void* p = mmap(nullptr, num_records * sizeof(Record), PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Error mmap'ing db: " + filename);
+            }
+            records = reinterpret_cast<const Record*>(p);
+        }
+        close(fd);
+        load_index();
+    }
 
-        if (it == data.end()) return false;
-        // lower_bound guarantees thatn (it >= j). So either j < it or j == it
-        if (j < it->first) return false;
+    void Mapped_file::load_index() {
+        std::ifstream ifs(filename + ".idx", std::ios::binary);
+        uint64_t header[2];
+        if (!ifs.read(reinterpret_cast<char*>(header), sizeof(header))) return;
+        if (header[0] != num_records || header[1] != index_stride) return;
+
+        index.resize((num_records + index_stride - 1) / index_stride);
+        if (!ifs.read(reinterpret_cast<char*>(index.data()), index.size() * sizeof(Job))) {
+            index.clear();
+            return;
+        }
+        // cheap check that this index really belongs to this file
+        if (!index.empty()) {
+            const Job& first = records[0].first;
+            const Job& last = records[(index.size() - 1) * index_stride].first;
+            if (index.front() < first || first < index.front() || index.back() < last || last < index.back()) {
+                cerr << "Ignoring index that doesn't match db: " << filename << endl;
+                index.clear();
+            }
+        }
+    }
+
+    Mapped_file::~Mapped_file() {
+        if (records) munmap(const_cast<Record*>(records), num_records * sizeof(Record));
+    }
+
+    void Mapped_file::narrow(const Job& j, const Record*& lo, const Record*& hi) const {
+        lo = begin();
+        hi = end();
+        if (index.empty()) return;
+        // j can only be in the stride starting at the last index entry <= j
+        vector<Job>::const_iterator next = std::upper_bound(index.begin(), index.end(), j);
+        if (next == index.begin()) {
+            hi = lo;
+            return;
+        }
+        lo = begin() + ((next - index.begin()) - 1) * index_stride;
+        hi = std::min(end(), lo + index_stride);
+    }
+
+    bool Mapped_file::query(const Job& j, SolveResult& result) const {
+        const Record* lo;
+        const Record* hi;
+        narrow(j, lo, hi);
+        const Record* it =
+            std::lower_bound
+            (lo,
+             hi,
+             j,
+             [] (const Record& lhs, const Job& rhs) { return lhs.first < rhs; }
+             );
+        if (it == hi || j < it->first) return false;
         result = it->second;
         return true;
     }
 
+    size_t Mapped_file::query_all(const CMask& m, vector<Record>& out) const {
+        Job first = Job::first_for_mask(m);
+        const Record* lo;
+        const Record* hi;
+        narrow(first, lo, hi);
+        // the mask's records can run on past this stride, so only use it to find the start
+        const Record* it = std::lower_bound(lo, hi, first, [] (const Record& lhs, const Job& rhs) { return lhs.first < rhs; });
+        size_t count = 0;
+        for (; it != end() && it->first.get_mask() == m; ++it) {
+            out.push_back(*it);
+            count++;
+        }
+        return count;
+    }
+
+    //////////////////
+    // merging sorted files
+
+    void merge_sorted(const vector<pair<const Record*, const Record*>>& sources,
+                      const std::function<void(const Record&)>& out) {
+        // (position, source index). Ties on Job go to the lower source index so it is the one we keep.
+        typedef pair<const Record*, size_t> Cursor;
+        auto greater = [] (const Cursor& lhs, const Cursor& rhs) {
+            if (lhs.first->first < rhs.first->first) return false;
+            if (rhs.first->first < lhs.first->first) return true;
+            return lhs.second > rhs.second;
+        };
+        std::priority_queue<Cursor, vector<Cursor>, decltype(greater)> heap(greater);
+        for (size_t i = 0; i < sources.size(); i++) {
+            if (sources[i].first != sources[i].second) heap.push({sources[i].first, i});
+        }
+
+        const Record* last = nullptr;
+        while (!heap.empty()) {
+            Cursor c = heap.top();
+            heap.pop();
+            if (!last || last->first < c.first->first) {
+                out(*c.first);
+                last = c.first;
+            }
+            if (++c.first != sources[c.second].second) heap.push(c);
+        }
+    }
+
+    void sort_records(vector<Record>& records, unsigned int num_threads) {
+        size_t num_chunks = std::max<size_t>(1, std::min<size_t>(num_threads, records.size() / 100000));
+        if (num_chunks == 1) {
+            std::stable_sort(records.begin(), records.end(), record_less);
+            records.erase(std::unique(records.begin(), records.end(), [] (const Record& lhs, const Record& rhs) { return !(lhs.first < rhs.first); }), records.end());
+            return;
+        }
+
+        // sort num_chunks pieces on their own threads, then merge them back together
+        size_t chunk_size = (records.size() + num_chunks - 1) / num_chunks;
+        vector<pair<const Record*, const Record*>> chunks;
+        vector<std::thread> threads;
+        for (size_t begin = 0; begin < records.size(); begin += chunk_size) {
+            size_t end = std::min(records.size(), begin + chunk_size);
+            Record* chunk_begin = records.data() + begin;
+            Record* chunk_end = records.data() + end;
+            chunks.push_back({chunk_begin, chunk_end});
+            threads.emplace_back([chunk_begin, chunk_end] () { std::stable_sort(chunk_begin, chunk_end, record_less); });
+        }
+        for (std::thread& t : threads) t.join();
+
+        vector<Record> merged;
+        merged.reserve(records.size());
+        merge_sorted(chunks, [&merged] (const Record& r) { merged.push_back(r); });
+        records.swap(merged);
+    }
+
+    void write_sorted_file(const string& filename, const vector<pair<const Record*, const Record*>>& sources) {
+        string tmp_filename = filename + ".tmp";
+        string index_filename = filename + ".idx";
+        string tmp_index_filename = index_filename + ".tmp";
+        vector<Job> index;
+        uint64_t count = 0;
+        {
+            std::ofstream ofs(tmp_filename, std::ios::binary | std::ios::trunc);
+            ofs.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+            merge_sorted(sources, [&ofs, &index, &count] (const Record& r) {
+                if (count % index_stride == 0) index.push_back(r.first);
+                ofs.write(reinterpret_cast<const char*>(&r), sizeof(r));
+                count++;
+            });
+        }
+        {
+            std::ofstream ofs(tmp_index_filename, std::ios::binary | std::ios::trunc);
+            ofs.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+            uint64_t header[2] = { count, index_stride };
+            ofs.write(reinterpret_cast<const char*>(header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(Job));
+        }
+        // so nobody pairs the old index with the new file in between the renames
+        remove(index_filename.c_str());
+        if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+            throw std::runtime_error("Error renaming " + tmp_filename + " to " + filename);
+        }
+        if (rename(tmp_index_filename.c_str(), index_filename.c_str()) != 0) {
+            throw std::runtime_error("Error renaming " + tmp_index_filename + " to " + index_filename);
+        }
+    }
+
+    void external_sort(const vector<string>& input_filenames,
+                       const string& output_filename,
+                       size_t memory_bytes,
+                       unsigned int num_threads,
+                       const string& tmp_dir) {
+        ptime start = microsec_clock::local_time();
+        num_threads = std::max(1u, num_threads);
+        // stable_sort wants a scratch buffer as big as what it's sorting
+        size_t chunk_records = std::max<size_t>(1, memory_bytes / (2 * num_threads * sizeof(Record)));
+        string run_prefix = tmp_dir + "/external_sort." + std::to_string(getpid()) + ".";
+
+        // Chunks are numbered in the order they're read, so merging runs in that order keeps the
+        // earlier input winning on duplicates no matter which thread sorted what.
+        std::mutex reader_mutex;
+        size_t next_input = 0;
+        std::ifstream ifs;
+        vector<string> run_filenames;
+        uint64_t num_read = 0;
+        auto read_chunk = [&] (vector<Record>& chunk, string& run_filename) {
+            std::lock_guard<std::mutex> lock(reader_mutex);
+            chunk.resize(chunk_records);
+            size_t n = 0;
+            while (n < chunk_records) {
+                if (!ifs.is_open()) {
+                    if (next_input == input_filenames.size()) break;
+                    ifs.clear();
+                    ifs.open(input_filenames[next_input], std::ios::binary);
+                    if (!ifs.is_open()) throw std::runtime_error("Error opening db: " + input_filenames[next_input]);
+                    next_input++;
+                }
+                ifs.read(reinterpret_cast<char*>(&chunk[n]), (chunk_records - n) * sizeof(Record));
+                // a trailing partial record gets overwritten by the next file, same as Read_only_db ignoring it
+                n += ifs.gcount() / sizeof(Record);
+                if (!ifs) ifs.close();
+            }
+            chunk.resize(n);
+            if (n == 0) return false;
+            run_filename = run_prefix + std::to_string(run_filenames.size()) + ".bin";
+            run_filenames.push_back(run_filename);
+            num_read += n;
+            return true;
+        };
+
+        vector<std::exception_ptr> errors(num_threads);
+        vector<std::thread> threads;
+        for (unsigned int i = 0; i < num_threads; i++) {
+            threads.emplace_back([&, i] () {
+                try {
+                    vector<Record> chunk;
+                    string run_filename;
+                    while (read_chunk(chunk, run_filename)) {
+                        sort_records(chunk, 1);
+                        write_sorted_file(run_filename, {{chunk.data(), chunk.data() + chunk.size()}});
+                    }
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            });
+        }
+        for (std::thread& t : threads) t.join();
+
+        auto remove_runs = [&run_filenames] () {
+            for (const string& f : run_filenames) {
+                remove(f.c_str());
+                remove((f + ".idx").c_str());
+            }
+        };
+        for (const std::exception_ptr& e : errors) {
+            if (e) {
+                remove_runs();
+                std::rethrow_exception(e);
+            }
+        }
+        if (!silence) {
+            cerr << "Sorted " << num_read << " records from " << input_filenames.size() << " files into "
+                 << run_filenames.size() << " runs, took " << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
+        }
+
+        // the runs are mmap'ed and only ever read front to back, so this is bounded by the page cache
+        // rather than by us
+        vector<std::unique_ptr<Mapped_file>> runs;
+        vector<pair<const Record*, const Record*>> sources;
+        for (const string& f : run_filenames) {
+            runs.emplace_back(new Mapped_file(f));
+            sources.push_back({runs.back()->begin(), runs.back()->end()});
+        }
+        write_sorted_file(output_filename, sources);
+        runs.clear();
+        remove_runs();
+
+        if (!silence) {
+            Mapped_file result(output_filename);
+            cerr << "Wrote " << result.size() << " records (" << (num_read - result.size()) << " duplicates dropped) to "
+                 << output_filename << ", took " << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s total" << endl;
+        }
+    }
+
     void test() {
         silence = true;
-        string tmpfile = "/tmp/tmp.db.bin";
+        // per process, so wordles running side by side don't trip over each other's files
+        string pid = std::to_string(getpid());
+        string tmpfile = "/tmp/tmp.db." + pid + ".bin";
         remove(tmpfile.c_str());
 
         std::stringstream output1;
@@ -222,6 +675,8 @@ namespace Db {
         rw.save(k2, s);
         output1 << k1 << " " << rw.query(k1, s) << " " << s << endl;
         output1 << k2 << " " << rw.query(k2, s) << " " << s << endl;
+        vector<Record> all;
+        output1 << rw.query_all(m2, all) << " " << rw.query_all(m3, all) << " " << all.size() << endl;
         rw.output_file.close();
 
         expected1 << 36 << endl;
@@ -231,6 +686,7 @@ namespace Db {
         expected1 << m2 << " o2 XYZNW 0" << endl;
         expected1 << m1 << " o0 YYYYY 1 5,GUESS,WORST,234234,1.11222e+08" << endl;
         expected1 << m2 << " o2 XYZNW 1 7,ZZAZZ,CCDCC,333,3.3" << endl;
+        expected1 << "1 0 1" << endl;
     
         std::string output1_str = output1.str();
         std::string expected1_str = expected1.str();
@@ -248,12 +704,119 @@ namespace Db {
         expected2 << m2 << " o2 XYZNW 1 7,ZZAZZ,CCDCC,333,3.3" << endl;
         expected2 << m3 << " o0 ABCDE 0 7,ZZAZZ,CCDCC,333,3.3" << endl;
 
+        // multiple files get merged, and the first file wins on duplicates
+        string tmpfile2 = "/tmp/tmp.db.2." + pid + ".bin";
+        remove(tmpfile2.c_str());
+        {
+            Read_write_db rw2(false);
+            rw2.set_output_file(tmpfile2);
+            s.best_score = 9;
+            rw2.save(k3, s);
+            rw2.save(k1, s);
+        }
+        Read_only_db ro2({tmpfile, tmpfile2});
+        output2 << k1 << " " << ro2.query(k1, s) << " " << s << endl;
+        output2 << k2 << " " << ro2.query(k2, s) << " " << s << endl;
+        output2 << k3 << " " << ro2.query(k3, s) << " " << s << endl;
+
+        expected2 << m1 << " o0 YYYYY 1 5,GUESS,WORST,234234,1.11222e+08" << endl;
+        expected2 << m2 << " o2 XYZNW 1 7,ZZAZZ,CCDCC,333,3.3" << endl;
+        expected2 << m3 << " o0 ABCDE 1 9,ZZAZZ,CCDCC,333,3.3" << endl;
+
+        // and the same one file at a time, what's loaded first still wins
+        Read_only_db ro4(tmpfile);
+        ro4.load_from_file(tmpfile2);
+        output2 << ro4.query(k1, s) << " " << s << endl;
+        output2 << ro4.query(k3, s) << " " << s << endl;
+        expected2 << "1 5,GUESS,WORST,234234,1.11222e+08" << endl;
+        expected2 << "1 9,ZZAZZ,CCDCC,333,3.3" << endl;
+
+        // an exact result replaces a bound, but not the other way around
+        {
+            Read_write_db rw3(false);
+            s.best_score = 4;
+            s.set_bound(Bound::lower);
+            rw3.save(k3, s);
+            output2 << rw3.query(k3, s) << " " << s << endl;
+            s.best_score = 6;
+            s.set_bound(Bound::exact);
+            rw3.save(k3, s);
+            s.best_score = 8;
+            s.set_bound(Bound::upper);
+            rw3.save(k3, s);
+            output2 << rw3.query(k3, s) << " " << s << endl;
+        }
+        expected2 << "1 >=4,ZZAZZ,CCDCC,333,3.3" << endl;
+        expected2 << "1 6,ZZAZZ,CCDCC,333,3.3" << endl;
+
         remove(tmpfile.c_str());
+        remove(tmpfile2.c_str());
         std::string output2_str = output2.str();
         std::string expected2_str = expected2.str();
         if (output2_str != expected2_str) {
             throw std::runtime_error("Db::test() 2 failed, got\n" + output2_str + ", but expected\n" + expected2_str);
-        }   
+        }
+
+        // external_sort with a tiny memory budget so we get lots of runs, and enough records that the
+        // output has a few index entries
+        {
+            const vector<Dictionary::WordIndex>& answers = Dictionary::get_all_answers();
+            vector<string> inputs = { "/tmp/tmp.db.3." + pid + ".bin", "/tmp/tmp.db.4." + pid + ".bin" };
+            string sorted_file = "/tmp/tmp.db.sorted." + pid + ".bin";
+            map<Job, float> expected;
+            for (size_t f = 0; f < inputs.size(); f++) {
+                remove(inputs[f].c_str());
+                Read_write_db rw(false);
+                rw.set_output_file(inputs[f]);
+                for (size_t i = 0; i < 6000; i++) {
+                    // overlaps between the two files so there are duplicates to drop
+                    Job j(CMask(*answers[(i * 7 + f * 1000) % answers.size()], *answers[0]), *answers[i % 97], Objective::adversarial);
+                    s.best_score = f * 10000 + i;
+                    rw.save(j, s);
+                    expected.insert({j, s.best_score});
+                }
+            }
+            external_sort(inputs, sorted_file, 2 * 2 * 1000 * sizeof(Record), 2, "/tmp");
+
+            Mapped_file mapped(sorted_file);
+            Read_only_db ro3(sorted_file);
+            size_t num_ok = 0;
+            for (const auto& j_and_score : expected) {
+                SolveResult r1, r2;
+                if (mapped.query(j_and_score.first, r1) && r1.best_score == j_and_score.second &&
+                    ro3.query(j_and_score.first, r2) && r2.best_score == j_and_score.second) {
+                    num_ok++;
+                }
+            }
+            // query_all agrees with the per-Job answers, for every mask
+            map<CMask, size_t> count_by_mask;
+            for (const auto& j_and_score : expected) count_by_mask[j_and_score.first.get_mask()]++;
+            size_t num_masks_ok = 0;
+            for (const auto& m_and_count : count_by_mask) {
+                vector<Record> all_rw, all_ro, all_mapped;
+                size_t n_ro = ro3.query_all(m_and_count.first, all_ro);
+                size_t n_mapped = mapped.query_all(m_and_count.first, all_mapped);
+                bool same = (n_ro == m_and_count.second && n_mapped == m_and_count.second && all_ro.size() == all_mapped.size());
+                for (size_t i = 0; same && i < all_ro.size(); i++) {
+                    same = !(all_ro[i].first < all_mapped[i].first) && !(all_mapped[i].first < all_ro[i].first)
+                        && all_ro[i].second.best_score == expected.at(all_ro[i].first);
+                }
+                if (same) num_masks_ok++;
+            }
+            if (num_masks_ok != count_by_mask.size()) {
+                throw std::runtime_error("Db::test() 3 failed, query_all was wrong for " + std::to_string(count_by_mask.size() - num_masks_ok) + " masks");
+            }
+
+            bool sorted = std::is_sorted(mapped.begin(), mapped.end(), record_less);
+            bool has_index = std::ifstream(sorted_file + ".idx").good();
+            for (const string& f : inputs) remove(f.c_str());
+            remove(sorted_file.c_str());
+            remove((sorted_file + ".idx").c_str());
+            if (!sorted || !has_index || mapped.size() != expected.size() || num_ok != expected.size()) {
+                throw std::runtime_error("Db::test() 3 failed, external_sort gave " + std::to_string(mapped.size()) + " records, "
+                                         + std::to_string(num_ok) + " correct, expected " + std::to_string(expected.size()));
+            }
+        }
         silence = false;
     }
 
@@ -3,17 +3,29 @@
 #include <vector>
 #include <set>
 #include <fstream>
+#include <functional>
+#include <shared_mutex>
 #include "word.hpp"
 #include "solveresult.hpp"
 #include "job.hpp"
 
 namespace Db {
+    // A single db entry, this is also exactly the on-disk layout of every db file (no header, just
+    // an array of these).
+    typedef std::pair<Job, Solver::SolveResult> Record;
+
     class Db_intf {    
     public:
         virtual ~Db_intf() {};
         virtual void save(const Job& j, const Solver::SolveResult& result) = 0;
         // returns true if we found the answer cached in the db. If we return false [result] was not touched.
         virtual bool query(const Job& j, Solver::SolveResult& result) const = 0;    
+        // appends every cached result for state [m] (any guess, any objective) to [out] in Job order,
+        // returns how many it found. One lookup rather than one per guess.
+        virtual size_t query_all(const CMask& m, std::vector<Record>& out) const = 0;
+        // false if query_all can miss per-guess results that query would find, so callers have to
+        // fall back to query for those
+        virtual bool query_all_is_complete() const { return true; }
 
         // other overloads
         void save(const CMask& mask, Word::Compact guess, Objective obj, const Solver::SolveResult& result);
@@ -34,8 +46,11 @@ namespace Db {
         Read_write_db(bool debug_output);
         Read_write_db(const std::vector<std::string>& read_filenames, const std::string& write_filename, bool debug_output);
 
+        using Db_intf::save;
+        using Db_intf::query;
         virtual void save(const Job& j, const Solver::SolveResult& result);
         virtual bool query(const Job& j, Solver::SolveResult& result) const;    
+        virtual size_t query_all(const CMask& m, std::vector<Record>& out) const;
     private:
         std::map<Job, Solver::SolveResult> data;
         std::ofstream output_file;
@@ -44,7 +59,26 @@ namespace Db {
         friend void test();    
     };
 
-    // ignores save commands, but is slightly faster to load/use because of flat-array storage
+    // Lets several threads share a db that isn't thread safe itself (e.g. Read_write_db): queries
+    // run together, a save runs alone. [inner] has to outlive this.
+    class Locked_db : public Db_intf {
+    public:
+        Locked_db(Db_intf& inner);
+
+        using Db_intf::save;
+        using Db_intf::query;
+        virtual void save(const Job& j, const Solver::SolveResult& result);
+        virtual bool query(const Job& j, Solver::SolveResult& result) const;
+        virtual size_t query_all(const CMask& m, std::vector<Record>& out) const;
+        virtual bool query_all_is_complete() const;
+    private:
+        Db_intf& inner;
+        mutable std::shared_mutex mutex;
+    };
+
+    // ignores save commands, but is slightly faster to load/use because of flat-array storage. Files are
+    // mapped and merged straight into that storage, so loading needs little more memory than the
+    // result. Duplicate Jobs across files are dropped (the earlier file wins).
     class Read_only_db : public Db_intf {
     public:
         // you can load from many files
@@ -54,14 +88,101 @@ namespace Db {
     
         void load_from_file(const std::string& filename);
 
+        using Db_intf::save;
+        using Db_intf::query;
         virtual void save(const Job& j, const Solver::SolveResult& result);
         virtual bool query(const Job& j, Solver::SolveResult& result) const;    
+        virtual size_t query_all(const CMask& m, std::vector<Record>& out) const;
+    private:
+        // appends to [out], returns false and leaves [out] alone on error
+        static bool read_file(const std::string& filename, std::vector<Record>& out);
+        // Adds [r] to the end of the layout below, records have to come in Job order with no
+        // duplicates. finish_layout() once they're all in.
+        void append(const Record& r);
+        void finish_layout();
+        // index into [masks] or -1
+        ptrdiff_t find_mask(const CMask& m) const;
+
+        // Two-level layout: every mask once, each pointing at its slice of [entries]. All the
+        // guesses for one mask are contiguous anyway since Jobs sort by mask first, so this
+        // drops 32 bytes of mask from every record and lets query_all be one search.
+        struct Entry {
+            int32_t guess_and_objective;
+            Solver::SolveResult result;
+        };
+        std::vector<CMask> masks;
+        std::vector<uint64_t> mask_offsets; // masks.size() + 1 of them, entries for masks[i] are [mask_offsets[i], mask_offsets[i+1])
+        std::vector<Entry> entries;
+    };
+
+    // A sorted db file mmap'ed rather than read, so it costs nothing to open and the OS decides what
+    // stays in RAM. The file must already be sorted (e.g. written by [write_sorted_file]).
+    //
+    // If there's a <filename>.idx next to it (also written by [write_sorted_file]) we binary search
+    // that first, it holds every [index_stride]'th Job so a lookup into a cold file only touches
+    // pages inside one stride.
+    class Mapped_file {
+    public:
+        Mapped_file(const std::string& filename);
+        ~Mapped_file();
+        Mapped_file(const Mapped_file&) = delete;
+        Mapped_file& operator=(const Mapped_file&) = delete;
+
+        bool query(const Job& j, Solver::SolveResult& result) const;
+        size_t query_all(const CMask& m, std::vector<Record>& out) const;
+
+        const Record* begin() const { return records; }
+        const Record* end() const { return records + num_records; }
+        size_t size() const { return num_records; }
+        const std::string& get_filename() const { return filename; }
     private:
-        void load_from_file_no_sort(const std::string& filename);
-        void sort();
+        void load_index();
+        // narrows [lo, hi) down to the one stride that could hold [j], using the index if we have one
+        void narrow(const Job& j, const Record*& lo, const Record*& hi) const;
 
-        std::vector<std::pair<Job, Solver::SolveResult>> data;
+        std::string filename;
+        const Record* records;
+        size_t num_records;
+        std::vector<Job> index;
     };
 
+    extern const size_t index_stride;
+
+    // Merges already sorted [sources] and calls [out] once per distinct Job in sorted order. If the same
+    // Job is in multiple sources the one from the earliest source wins.
+    void merge_sorted
+    (const std::vector<std::pair<const Record*, const Record*>>& sources,
+     const std::function<void(const Record&)>& out);
+
+    // Sorts and drops all but the first record for each Job, using up to [num_threads] threads.
+    void sort_records(std::vector<Record>& records, unsigned int num_threads);
+
+    // Writes via a temp file + rename so readers never see a partial file. Also writes <filename>.idx,
+    // see Mapped_file.
+    void write_sorted_file
+    (const std::string& filename,
+     const std::vector<std::pair<const Record*, const Record*>>& sources);
+
+    // Builds one sorted file (+ .idx) out of any number of unsorted files, e.g. the append-only files
+    // written by Read_write_db, without ever holding more than about [memory_bytes] of records in RAM.
+    // [num_threads] chunks are sorted at once and spilled into runs under [tmp_dir], then all the runs
+    // are merged. Like Read_only_db, duplicate Jobs are dropped and the earlier input wins.
+    void external_sort
+    (const std::vector<std::string>& input_filenames,
+     const std::string& output_filename,
+     size_t memory_bytes,
+     unsigned int num_threads,
+     const std::string& tmp_dir);
+
+    bool record_less(const Record& lhs, const Record& rhs);
+
+    // Counts one lookup in the process-wide metrics (see metrics.hpp). Db_intf's query overloads
+    // count themselves, callers of query_all or the virtual query count with this. [sample_start]
+    // is Metrics::sample_start() from just before the lookup.
+    void count_query(Objective o, bool hit, uint64_t sample_start);
+
+    // quiets the progress output to cerr, only set by the tests.
+    extern bool silence;
+
     void test();
 }
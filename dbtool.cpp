@@ -0,0 +1,150 @@
+/* Offline tools for building db files.
+
+   dbtool build -o out.bin [-m memory_mb] [-j threads] in1.bin in2.bin ...
+     Sorts and dedups any number of Read_write_db append files (or any other db files) into one
+     Read_only_db file plus its .idx, using bounded memory so the result can be bigger than RAM.
+
+   dbtool fingerprint -o out.fp sorted1.bin sorted2.bin ...
+     Turns sorted db files (e.g. the output of build) into one Fingerprint_db file for serving.
+     Fails if any two Jobs have the same fingerprint.
+
+   dbtool tablebase -o out.tb [-n max_answers] [-d depth] [-j threads] mask1 mask2 ...
+     Solves every state with up to max_answers answers reachable within depth guesses of the
+     given masks (hex, as printed by wordle) into an endgame tablebase file, see tablebase.hpp.
+*/
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <iostream>
+#include <boost/program_options.hpp>
+#include <memory>
+#include "db.hpp"
+#include "fingerprint_db.hpp"
+#include "tablebase.hpp"
+
+using std::string;
+using std::vector;
+using std::cerr;
+using std::endl;
+
+namespace po = boost::program_options;
+
+int build(const vector<string>& args) {
+    string output;
+    vector<string> inputs;
+    size_t memory_mb;
+    unsigned int num_threads;
+    string tmp_dir;
+
+    po::options_description desc("dbtool build: external sort of unsorted db files into one sorted db file");
+    desc.add_options()
+        ("output,o",  po::value<string>(&output)->required(),                                        "sorted output db")
+        ("input,i",   po::value<vector<string>>(&inputs),                                            "unsorted input db (or positional)")
+        ("memory,m",  po::value<size_t>(&memory_mb)->default_value(4096),                            "memory budget in MB")
+        ("threads,j", po::value<unsigned int>(&num_threads)->default_value(std::thread::hardware_concurrency()), "threads sorting runs")
+        ("tmp-dir",   po::value<string>(&tmp_dir)->default_value("/tmp"),                             "where to spill sorted runs")
+        ("help,h",                                                                                   "produce help message");
+    po::positional_options_description positional;
+    positional.add("input", -1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(args).options(desc).positional(positional).run(), vm);
+    if (vm.count("help") || !vm.count("input")) {
+        cerr << desc << endl;
+        return 1;
+    }
+    po::notify(vm);
+
+    Db::external_sort(inputs, output, memory_mb << 20, num_threads, tmp_dir);
+    return 0;
+}
+
+int fingerprint(const vector<string>& args) {
+    string output;
+    vector<string> inputs;
+
+    po::options_description desc("dbtool fingerprint: sorted db files into one fingerprint db for serving");
+    desc.add_options()
+        ("output,o", po::value<string>(&output)->required(),  "fingerprint db to write")
+        ("input,i",  po::value<vector<string>>(&inputs),      "sorted input db (or positional), earlier ones win on duplicates")
+        ("help,h",                                            "produce help message");
+    po::positional_options_description positional;
+    positional.add("input", -1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(args).options(desc).positional(positional).run(), vm);
+    if (vm.count("help") || !vm.count("input")) {
+        cerr << desc << endl;
+        return 1;
+    }
+    po::notify(vm);
+
+    vector<std::unique_ptr<Db::Mapped_file>> files;
+    vector<std::pair<const Db::Record*, const Db::Record*>> sources;
+    for (const string& input : inputs) {
+        files.emplace_back(new Db::Mapped_file(input));
+        if (!std::is_sorted(files.back()->begin(), files.back()->end(), Db::record_less)) {
+            cerr << input << " isn't sorted, run dbtool build on it first" << endl;
+            return 1;
+        }
+        sources.push_back({files.back()->begin(), files.back()->end()});
+    }
+    Db::write_fingerprint_file(output, sources);
+    return 0;
+}
+
+int tablebase(const vector<string>& args) {
+    string output;
+    vector<string> masks;
+    size_t max_answers;
+    size_t depth;
+    unsigned int num_threads;
+
+    po::options_description desc("dbtool tablebase: solve the small states reachable from some masks into an endgame tablebase");
+    desc.add_options()
+        ("output,o",      po::value<string>(&output)->required(),                                        "tablebase to write")
+        ("mask,i",        po::value<vector<string>>(&masks),                                             "hex mask to start from (or positional)")
+        ("max-answers,n", po::value<size_t>(&max_answers)->default_value(8),                             "biggest states to keep")
+        ("depth,d",       po::value<size_t>(&depth)->default_value(2),                                   "guesses to look ahead from each mask")
+        ("threads,j",     po::value<unsigned int>(&num_threads)->default_value(std::thread::hardware_concurrency()), "threads solving states")
+        ("help,h",                                                                                       "produce help message");
+    po::positional_options_description positional;
+    positional.add("mask", -1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(args).options(desc).positional(positional).run(), vm);
+    if (vm.count("help") || !vm.count("mask")) {
+        cerr << desc << endl;
+        return 1;
+    }
+    po::notify(vm);
+
+    vector<CMask> roots;
+    for (const string& mask : masks) {
+        if (mask.length() != CMask::num_hex_chars) {
+            cerr << mask << " isn't a hex mask" << endl;
+            return 1;
+        }
+        roots.push_back(CMask::of_hex(mask));
+    }
+    Solver::build_tablebase(output, roots, max_answers, depth, num_threads);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        cerr << "usage: dbtool build|fingerprint|tablebase ..." << endl;
+        return 1;
+    }
+    string command = argv[1];
+    vector<string> args(argv + 2, argv + argc);
+    try {
+        if (command == "build") return build(args);
+        if (command == "fingerprint") return fingerprint(args);
+        if (command == "tablebase") return tablebase(args);
+    } catch (const std::exception& e) {
+        cerr << "dbtool " << command << ": " << e.what() << endl;
+        return 1;
+    }
+    cerr << "unknown command: " << command << endl;
+    return 1;
+}
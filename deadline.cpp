@@ -0,0 +1,71 @@
+#include <sstream>
+#include "deadline.hpp"
+
+using std::endl;
+
+namespace Solver {
+    Deadline::Deadline(boost::posix_time::ptime timeout, const Cancel_token* cancel_) :
+        has_timeout(timeout != boost::posix_time::pos_infin),
+        cancel(cancel_),
+        countdown(1)
+    {
+        if (has_timeout) {
+            // one wall clock read to turn it into a steady_clock time, which can't jump
+            int64_t us = (timeout - boost::posix_time::microsec_clock::local_time()).total_microseconds();
+            deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+        }
+    }
+
+    void Deadline::check() {
+        countdown = check_interval;
+        if (cancel && cancel->is_cancelled()) throw Cancelled();
+        if (has_timeout && std::chrono::steady_clock::now() > deadline) throw Timeout();
+    }
+
+    void Deadline::test() {
+        std::stringstream output;
+        std::stringstream expected;
+        auto polls_until_thrown = [] (Deadline& d) {
+            for (int i = 1; i <= 1000; i++) {
+                try {
+                    d.poll();
+                } catch (const Timeout& e) {
+                    return std::to_string(i) + " " + e.what();
+                }
+            }
+            return std::string("none");
+        };
+
+        Deadline none(boost::posix_time::pos_infin, nullptr);
+        output << "none: " << none.is_set() << " " << polls_until_thrown(none) << endl;
+        expected << "none: 0 none" << endl;
+
+        // the first poll looks straight away
+        Deadline passed(boost::posix_time::microsec_clock::local_time() - boost::posix_time::seconds(1), nullptr);
+        output << "passed: " << passed.is_set() << " " << polls_until_thrown(passed) << endl;
+        expected << "passed: 1 1 timeout" << endl;
+
+        Deadline later(boost::posix_time::microsec_clock::local_time() + boost::posix_time::hours(1), nullptr);
+        output << "later: " << polls_until_thrown(later) << endl;
+        expected << "later: none" << endl;
+
+        // a cancel is noticed at the next check, not the next poll
+        Cancel_token token;
+        Deadline cancelled(boost::posix_time::pos_infin, &token);
+        cancelled.poll();
+        token.cancel();
+        output << "cancelled: " << cancelled.is_set() << " " << polls_until_thrown(cancelled) << endl;
+        expected << "cancelled: 1 " << check_interval << " cancelled" << endl;
+        try {
+            Deadline(boost::posix_time::pos_infin, &token).poll();
+        } catch (const Cancelled&) {
+            output << "caught as Cancelled" << endl;
+        } catch (const Timeout&) {
+        }
+        expected << "caught as Cancelled" << endl;
+
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Deadline::test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
+}
@@ -0,0 +1,68 @@
+/* How a solve finds out it should stop: its timeout passed, or someone cancelled it.
+
+   Reading the wall clock at every state used to be most of what a timeout cost, so a solve now
+   polls a Deadline instead. The Deadline counts states down and only looks at the (monotonic)
+   clock and the Cancel_token once every check_interval of them, so in between a state pays one
+   decrement. A solve's states are a few microseconds each, so it still stops within a fraction of
+   a millisecond of the deadline or the cancel.
+
+   A Cancel_token is shared: the solve polls it and any thread can cancel() it (e.g. the server,
+   when a client hangs up). A Deadline belongs to one solve on one thread.
+*/
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+namespace Solver {
+    // What the solvers throw once their timeout has passed or they've been cancelled
+    class Timeout : public std::runtime_error {
+    public:
+        Timeout(const char* what = "timeout") : std::runtime_error(what) {}
+    };
+
+    // The Timeout for a solve that was cancelled rather than ran out of time
+    class Cancelled : public Timeout {
+    public:
+        Cancelled() : Timeout("cancelled") {}
+    };
+
+    class Cancel_token {
+    public:
+        Cancel_token() : cancelled(false) {}
+        // safe from any thread, the solves polling this stop at their next check
+        void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+        bool is_cancelled() const { return cancelled.load(std::memory_order_relaxed); }
+    private:
+        std::atomic<bool> cancelled;
+    };
+
+    class Deadline {
+    public:
+        static const int check_interval = 64;
+
+        // [timeout] is local time like the rest of the solver's, pos_infin for none. [cancel] can
+        // be nullptr, and has to outlive the solve otherwise.
+        Deadline(boost::posix_time::ptime timeout, const Cancel_token* cancel);
+
+        // whether there's anything to poll for
+        bool is_set() const { return has_timeout || cancel; }
+
+        // Throws Timeout if we've passed the deadline or Cancelled if we've been cancelled, but only
+        // actually looks every check_interval calls. The first call always looks.
+        void poll() {
+            if (--countdown <= 0) check();
+        }
+
+        static void test();
+    private:
+        void check();
+
+        bool has_timeout;
+        std::chrono::steady_clock::time_point deadline;
+        const Cancel_token* cancel;
+        int countdown;
+    };
+}
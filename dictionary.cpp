@@ -18,6 +18,7 @@ void Dictionary::init_from_file(const string& answers_file, const string& guesse
     all_words.push_back(Word("ZZZZZ")); // fake_word
     num_answers = load_from_file(answers_file);
     num_guesses = load_from_file(guesses_file);
+    make_arrays();
     word_index_map = make_word_index_map(all_words);
     all_answers = make_range(1, num_answers + 1);
     all_guesses = make_range(num_answers + 1, num_answers + num_guesses + 1);
@@ -88,6 +89,20 @@ map<Word, Dictionary::WordIndex>
     return rv;
 }   
 
+void Dictionary::make_arrays() {
+    if (all_words.size() > 65536) {
+        throw std::runtime_error("Too many words in the dictionary for a 16-bit WordIndex");
+    }
+    all_cmasks.clear();
+    all_compacts.clear();
+    all_cmasks.reserve(all_words.size());
+    all_compacts.reserve(all_words.size());
+    for (const Word& w : all_words) {
+        all_cmasks.push_back(w.cmask);
+        all_compacts.push_back(w.compact);
+    }
+}
+
 vector<Dictionary::WordIndex> Dictionary::make_range(size_t start, size_t end) {
     vector<WordIndex> rv;
     rv.reserve(end - start);
@@ -105,6 +120,8 @@ vector<Dictionary::WordIndex> Dictionary::make_range(size_t start, size_t end) {
 // this was when we didn't init statically.
 
 vector<Word> Dictionary::all_words;
+vector<CMask> Dictionary::all_cmasks;
+vector<Word::Compact> Dictionary::all_compacts;
 std::map<Word, Dictionary::WordIndex> Dictionary::word_index_map;
 int Dictionary::num_answers = 0;
 int Dictionary::num_guesses = 0; 
@@ -136,6 +153,7 @@ void Dictionary::load_all_words(const char* w1[], const char* w2[]) {
 
 int Dictionary::init() {
     load_all_words(raw_answers, raw_guesses);
+    make_arrays();
     word_index_map = make_word_index_map(all_words);
     all_answers = make_range(1, num_answers + 1);
     all_guesses = make_range(num_answers + 1, num_answers + num_guesses + 1);
@@ -1,11 +1,18 @@
 /* This now a messy pile of junk. But the idea is that each word should have a 
-   canonical "pointer" so we can compare small (ie 32-bit) words "pointers" and
+   canonical "pointer" so we can compare small (ie 16-bit) words "pointers" and
    put them in arrays, etc. So we statically initialize the dictionaries here
    (in an unfortunately fragile way that depends on link order).
+
+   A Word is a whole 64-byte cache line, but the solver only ever reads one field of it at a
+   time, so the hot fields are also kept as structure-of-arrays: all_cmasks[i] and all_compacts[i]
+   are the fields of all_words[i]. Go through WordIndex::cmask() and compact() rather than *w in
+   loops over lots of words.
 */
 
 #pragma once
 #include <map>
+#include <vector>
+#include <cstdint>
 #include "word.hpp"
 
 
@@ -23,6 +30,8 @@ public:
     class WordIndex {
     public:
         const Word& operator*() const { return all_words[index]; }
+        const CMask& cmask() const { return all_cmasks[index]; }
+        Word::Compact compact() const { return all_compacts[index]; }
         WordIndex(); //returns fake_word
 
         WordIndex& operator++();
@@ -30,9 +39,10 @@ public:
         bool operator!=(WordIndex other) const;
         bool operator<(WordIndex other) const;
     private:
-        int index;
+        uint16_t index; // so the dictionary can't have more than 65536 words
         WordIndex(int i) : index(i) {};
         friend class Dictionary;
+        friend class Word_set;
     };
         
     static const Word& of_word_index(WordIndex i);
@@ -50,9 +60,13 @@ private:
     static std::map<Word, Dictionary::WordIndex> make_word_index_map(const std::vector<Word>& all_words);
     static std::vector<WordIndex> make_range(size_t start, size_t end);
     static void load_all_words(const char* w1[], const char* w2[]);
+    // fills all_cmasks etc. from all_words
+    static void make_arrays();
     static int init();    
     
     static std::vector<Word> all_words;
+    static std::vector<CMask> all_cmasks;
+    static std::vector<Word::Compact> all_compacts;
     static std::map<Word, WordIndex> word_index_map;
     static std::vector<WordIndex> all_answers;
     static std::vector<WordIndex> all_guesses;
@@ -0,0 +1,433 @@
+#include <sstream>
+#include <algorithm>
+#include "endgame.hpp"
+#include "solver.hpp"
+#include "tablebase.hpp"
+
+using std::vector;
+typedef Dictionary::WordIndex WordIndex;
+
+namespace Solver {
+    // what a fresh SolveResult starts with, worse than any real score
+    static const float no_score = 99999;
+
+    static const Tablebase* tablebase = nullptr;
+
+    void Endgame::set_tablebase(const Tablebase* tablebase_) {
+        tablebase = tablebase_;
+    }
+
+    const Tablebase* Endgame::get_tablebase() {
+        return tablebase;
+    }
+
+    Endgame& Endgame::get() {
+        static thread_local Endgame endgame;
+        return endgame;
+    }
+
+    void Endgame::reset(const vector<WordIndex>& answers_, const vector<WordIndex>& guesses_) {
+        answers.assign(answers_.begin(), answers_.end());
+        guesses.assign(guesses_.begin(), guesses_.end());
+        guess_words = (guesses.size() + 63) / 64;
+        answer_letters.assign(answers.data(), answers.size());
+        guess_letters.assign(guesses.data(), guesses.size());
+        if (tablebase) {
+            answer_codes.resize(answers.size());
+            for (size_t i = 0; i < answers.size(); i++) answer_codes[i] = Tablebase::answer_code(answers[i]);
+            guess_codes.resize(guesses.size());
+            for (size_t g = 0; g < guesses.size(); g++) guess_codes[g] = Tablebase::guess_code(guesses[g]);
+        }
+
+        // only ever grow, prepare_guess fills in what we use
+        guess_prepared.assign(guesses.size(), 0);
+        if (buckets.size() < guesses.size() * max_answers) buckets.resize(guesses.size() * max_answers);
+        if (num_buckets.size() < guesses.size()) num_buckets.resize(guesses.size());
+        size_t row = guesses.size() + Feedback::block_size;
+        if (guess_patterns.size() < guesses.size() * row) guess_patterns.resize(guesses.size() * row);
+
+        if (memo.empty()) memo.resize(size_t(1) << memo_bits);
+        if (++generation == 0) {
+            for (Memo_entry& e : memo) e.generation = 0;
+            generation = 1;
+        }
+    }
+
+    uint64_t* Endgame::guess_set_at(size_t depth) {
+        // moving the inner vectors doesn't move their data, so the parents' sets stay put
+        while (guess_sets.size() <= depth) guess_sets.emplace_back();
+        if (guess_sets[depth].size() < guess_words) guess_sets[depth].resize(guess_words);
+        return guess_sets[depth].data();
+    }
+
+    // The set bit of [bits] whose word is the [rank]th of them in WordIndex order, the order the
+    // tablebase's ranks are in. Our words can be in any order (solve_p_sets hands us answers in
+    // its own), so sort the few we have.
+    static int bit_of_rank(const uint64_t* bits, size_t num_words, const vector<Dictionary::WordIndex>& words, int rank) {
+        vector<int> set_bits;
+        for (size_t w = 0; w < num_words; w++) {
+            for (uint64_t b = bits[w]; b; b &= b - 1) set_bits.push_back(w * 64 + __builtin_ctzll(b));
+        }
+        if (rank < 0 || size_t(rank) >= set_bits.size()) return -1;
+        std::nth_element(set_bits.begin(), set_bits.begin() + rank, set_bits.end(),
+                         [&words] (int lhs, int rhs) { return words[lhs] < words[rhs]; });
+        return set_bits[rank];
+    }
+
+    bool Endgame::lookup(uint64_t answer_bits, const uint64_t* guess_bits, float& out_score, int* out_best_guess, int* out_worst_answer) const {
+        uint64_t answers_key = 0;
+        for (uint64_t bits = answer_bits; bits; bits &= bits - 1) answers_key ^= answer_codes[__builtin_ctzll(bits)];
+        uint64_t guesses_key = 0;
+        for (size_t w = 0; w < guess_words; w++) {
+            for (uint64_t bits = guess_bits[w]; bits; bits &= bits - 1) guesses_key ^= guess_codes[w * 64 + __builtin_ctzll(bits)];
+        }
+        const Tablebase::Entry* e = tablebase->find(answers_key, guesses_key);
+        if (!e) return false;
+        // the entry's words are ranks, i.e. which of our set bits
+        out_score = e->best_score;
+        if (out_best_guess) *out_best_guess = bit_of_rank(guess_bits, guess_words, guesses, e->best_guess);
+        if (out_worst_answer) *out_worst_answer = bit_of_rank(&answer_bits, 1, answers, e->worst_answer);
+        return true;
+    }
+
+    void Endgame::prepare_guess(size_t g) {
+        if (guess_prepared[g]) return;
+        guess_prepared[g] = 1;
+
+        // the root's answers in each bucket
+        Feedback::patterns(answer_letters, guesses[g], pattern_buffer);
+        Bucket* b = &buckets[g * max_answers];
+        uint8_t bucket_of[Feedback::num_patterns];
+        std::fill(bucket_of, bucket_of + Feedback::num_patterns, 0xFF);
+        int n = 0;
+        for (size_t i = 0; i < answers.size(); i++) {
+            Feedback::Pattern p = pattern_buffer[i];
+            if (bucket_of[p] == 0xFF) {
+                bucket_of[p] = n;
+                b[n++] = {0, p};
+            }
+            b[bucket_of[p]].answers |= uint64_t(1) << i;
+        }
+        num_buckets[g] = n;
+
+        // and every root guess's pattern against g, for filtering the guesses
+        Feedback::Pattern* row = &guess_patterns[g * (guesses.size() + Feedback::block_size)];
+        for (size_t first = 0; first < guesses.size(); first += Feedback::block_size) {
+            Feedback::patterns_block(guess_letters, guesses[g], first, row + first);
+        }
+    }
+
+    void Endgame::solve_p(const vector<WordIndex>& answers,
+                          const vector<WordIndex>& guesses,
+                          const CMask& m,
+                          float score_cutoff,
+                          Deadline* deadline,
+                          SolveResult& rv) {
+        if (answers.size() > max_answers || answers.empty()) {
+            throw std::runtime_error("Endgame::solve_p needs 1 to 64 answers");
+        }
+        if (deadline) deadline->poll();
+        Endgame& e = get();
+        e.reset(answers, guesses);
+
+        uint64_t all_answers = answers.size() == 64 ? ~uint64_t(0) : (uint64_t(1) << answers.size()) - 1;
+        uint64_t* all_guesses = e.guess_set_at(0);
+        for (size_t w = 0; w < e.guess_words; w++) {
+            all_guesses[w] = (w + 1) * 64 <= guesses.size() ? ~uint64_t(0) : (uint64_t(1) << (guesses.size() % 64)) - 1;
+        }
+
+        double perf_calls = 0;
+        int best_guess = -1;
+        int worst_answer = -1;
+        float score = e.solve_state(all_answers, all_guesses, m, std::min(score_cutoff, rv.best_score), 0, perf_calls, &best_guess, &worst_answer);
+        rv.perf_calls = perf_calls;
+        if (score < rv.best_score) {
+            rv.best_score = score;
+            // the trivial states don't pick a guess, we just go through the answers
+            rv.best_guess = best_guess >= 0 ? e.guesses[best_guess].compact() : e.answers[0].compact();
+            rv.worst_answer = e.answers[worst_answer].compact();
+        }
+    }
+
+    // [answer_bits] are bits of [answers], [guess_bits] a bitset over [guesses]. Same logic as
+    // solve_p_sets plus solve_c_uncached, with the same cutoffs.
+    float Endgame::solve_state(uint64_t answer_bits,
+                               const uint64_t* guess_bits,
+                               const CMask& m,
+                               float score_cutoff,
+                               size_t depth,
+                               double& perf_calls,
+                               int* out_best_guess,
+                               int* out_worst_answer) {
+        perf_calls++;
+        int num_answers = __builtin_popcountll(answer_bits);
+        int first_answer = __builtin_ctzll(answer_bits);
+        if (num_answers <= 2 || m.has_at_most_one_letter_undetermined()) {
+            if (out_worst_answer) *out_worst_answer = num_answers >= 2 ? __builtin_ctzll(answer_bits & (answer_bits - 1)) : first_answer;
+            return num_answers;
+        }
+        if (2 >= score_cutoff) {
+            if (out_worst_answer) *out_worst_answer = first_answer;
+            return score_cutoff;
+        }
+
+        Memo_entry* memo_entry = nullptr;
+        if (depth > 0) {
+            size_t hash = (m.hash() * 0x9E3779B97F4A7C15ull) >> (64 - memo_bits);
+            memo_entry = &memo[hash];
+            // an exact score is good for any cutoff, a cut off one for any lower cutoff
+            if (memo_entry->generation == generation && memo_entry->m == m &&
+                (memo_entry->bound == Bound::exact || score_cutoff <= memo_entry->score)) {
+                return memo_entry->score;
+            }
+        }
+
+        float best_score = no_score;
+        int best_guess = -1;
+        int worst_answer = first_answer;
+
+        // the tablebase's scores are exact, so they're good for any cutoff
+        if (tablebase && size_t(num_answers) <= tablebase->get_max_answers() &&
+            lookup(answer_bits, guess_bits, best_score, out_best_guess, out_worst_answer)) {
+            if (memo_entry) *memo_entry = {m, generation, best_score, Bound::exact};
+            return best_score;
+        }
+
+        // Before searching, the two cheap questions: can we finish next turn (score 2) or the
+        // turn after (score 3)? A no is as useful as a yes when the cutoff is just above.
+        if (scores_2(answer_bits, guess_bits, &best_guess)) {
+            best_score = 2;
+        } else if (3 >= score_cutoff) {
+            best_score = score_cutoff;
+        } else if (scores_3(answer_bits, guess_bits, m, depth, &best_guess)) {
+            best_score = 3;
+        } else if (4 >= score_cutoff) {
+            best_score = score_cutoff;
+        }
+        if (best_score != no_score) {
+            if (out_worst_answer && best_guess >= 0) *out_worst_answer = oracle_worst_answer(answer_bits, best_guess, best_score);
+            if (out_worst_answer && best_guess < 0) *out_worst_answer = first_answer;
+            if (out_best_guess) *out_best_guess = best_guess;
+            if (memo_entry) *memo_entry = {m, generation, best_score, best_score < score_cutoff ? Bound::exact : Bound::lower};
+            return best_score;
+        }
+
+        // answers that were the worst case for an earlier guess are likely to be for the next one
+        // too, so their buckets go first (the generic path's answer reordering does the same)
+        uint64_t killers = 0;
+        bool done = false;
+        for (size_t w = 0; w < guess_words && !done; w++) {
+            for (uint64_t bits = guess_bits[w]; bits && !done; bits &= bits - 1) {
+                size_t g = w * 64 + __builtin_ctzll(bits);
+                prepare_guess(g);
+                float guess_cutoff = std::min(score_cutoff, best_score);
+                float guess_score = 0;
+                int guess_worst = first_answer;
+                const Bucket* b = &buckets[g * max_answers];
+                int n = num_buckets[g];
+                for (int pass = 0; pass < 2 && guess_score < guess_cutoff; pass++) {
+                    for (int i = 0; i < n; i++) {
+                        uint64_t bucket = b[i].answers & answer_bits;
+                        if (!bucket || ((bucket & killers) != 0) != (pass == 0)) continue;
+                        float s = 1;
+                        if (b[i].pattern != Feedback::all_green) {
+                            s += solve_child(bucket, guess_bits, m, g, b[i].pattern, guess_cutoff - 1, depth, perf_calls);
+                        }
+                        if (s > guess_score) {
+                            guess_score = s;
+                            guess_worst = __builtin_ctzll(bucket);
+                        }
+                        if (s >= guess_cutoff) break;
+                    }
+                }
+                killers |= uint64_t(1) << guess_worst;
+                if (guess_score < best_score) {
+                    best_score = guess_score;
+                    best_guess = g;
+                    worst_answer = guess_worst;
+                    if (best_score == 2) done = true;
+                }
+            }
+        }
+        if (best_guess < 0 && depth > 0) {
+            throw std::runtime_error("Got no answers or guesses?");
+        }
+
+        if (out_best_guess) *out_best_guess = best_guess;
+        if (out_worst_answer) *out_worst_answer = worst_answer;
+        if (memo_entry) *memo_entry = {m, generation, best_score, best_score < score_cutoff ? Bound::exact : Bound::lower};
+        return best_score;
+    }
+
+    void Endgame::filter_guesses(const uint64_t* guess_bits, size_t g, Feedback::Pattern pattern, uint64_t* out) {
+        // the guesses still legal are the ones that would have got the same pattern
+        const Feedback::Pattern* row = &guess_patterns[g * (guesses.size() + Feedback::block_size)];
+        for (size_t w = 0; w < guess_words; w++) {
+            uint64_t out_bits = 0;
+            for (uint64_t bits = guess_bits[w]; bits; bits &= bits - 1) {
+                int bit = __builtin_ctzll(bits);
+                if (row[w * 64 + bit] == pattern) out_bits |= uint64_t(1) << bit;
+            }
+            out[w] = out_bits;
+        }
+    }
+
+    bool Endgame::scores_2(uint64_t answer_bits, const uint64_t* guess_bits, int* out_guess) {
+        int num_answers = __builtin_popcountll(answer_bits);
+        for (size_t w = 0; w < guess_words; w++) {
+            for (uint64_t bits = guess_bits[w]; bits; bits &= bits - 1) {
+                size_t g = w * 64 + __builtin_ctzll(bits);
+                prepare_guess(g);
+                // it has to split the root's answers at least as finely as ours
+                if (num_buckets[g] < num_answers) continue;
+                const Bucket* b = &buckets[g * max_answers];
+                int n = num_buckets[g];
+                int i = 0;
+                for (; i < n; i++) {
+                    uint64_t bucket = b[i].answers & answer_bits;
+                    if (bucket & (bucket - 1)) break;
+                }
+                if (i == n) {
+                    if (out_guess) *out_guess = g;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    bool Endgame::scores_3(uint64_t answer_bits, const uint64_t* guess_bits, const CMask& m, size_t depth, int* out_guess) {
+        uint64_t* child_guess_bits = guess_set_at(depth + 1);
+        for (size_t w = 0; w < guess_words; w++) {
+            for (uint64_t bits = guess_bits[w]; bits; bits &= bits - 1) {
+                size_t g = w * 64 + __builtin_ctzll(bits);
+                prepare_guess(g);
+                const Bucket* b = &buckets[g * max_answers];
+                int n = num_buckets[g];
+                int i = 0;
+                for (; i < n; i++) {
+                    // every bucket has to score at most 2 by itself
+                    uint64_t bucket = b[i].answers & answer_bits;
+                    if (__builtin_popcountll(bucket) <= 2) continue;
+                    CMask child_m(m);
+                    child_m.apply(CMask(*answers[__builtin_ctzll(bucket)], *guesses[g]));
+                    if (child_m.has_at_most_one_letter_undetermined()) break;
+                    filter_guesses(guess_bits, g, b[i].pattern, child_guess_bits);
+                    if (!scores_2(bucket, child_guess_bits, nullptr)) break;
+                }
+                if (i == n) {
+                    if (out_guess) *out_guess = g;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    int Endgame::oracle_worst_answer(uint64_t answer_bits, size_t g, float score) {
+        // any answer that isn't a straight win scores 2, for a 3 we need one that can't be
+        // told apart from another answer
+        const Bucket* b = &buckets[g * max_answers];
+        for (int i = 0; i < num_buckets[g]; i++) {
+            uint64_t bucket = b[i].answers & answer_bits;
+            if (!bucket || b[i].pattern == Feedback::all_green) continue;
+            if (score == 2 || (bucket & (bucket - 1))) return __builtin_ctzll(bucket);
+        }
+        return __builtin_ctzll(answer_bits);
+    }
+
+    float Endgame::solve_child(uint64_t answer_bits,
+                               const uint64_t* guess_bits,
+                               const CMask& m,
+                               size_t g,
+                               Feedback::Pattern pattern,
+                               float score_cutoff,
+                               size_t depth,
+                               double& perf_calls) {
+        // the cheap exits first, before we build the child's mask and guesses
+        int num_answers = __builtin_popcountll(answer_bits);
+        if (num_answers <= 2) {
+            perf_calls++;
+            return num_answers;
+        }
+        if (2 >= score_cutoff) {
+            perf_calls++;
+            return score_cutoff;
+        }
+        CMask child_m(m);
+        child_m.apply(CMask(*answers[__builtin_ctzll(answer_bits)], *guesses[g]));
+
+        uint64_t* child_guess_bits = guess_set_at(depth + 1);
+        filter_guesses(guess_bits, g, pattern, child_guess_bits);
+        return solve_state(answer_bits, child_guess_bits, child_m, score_cutoff, depth + 1, perf_calls, nullptr, nullptr);
+    }
+
+    void Endgame::test() {
+        const vector<WordIndex>& all_answers = Dictionary::get_all_answers();
+        const vector<WordIndex>& all_guesses = Dictionary::get_all_answers_and_guesses();
+
+        // states with 3 to 64 answers, and what the generic solver said about them
+        const char* cases[][3] = {
+            {"2004250484040404840404840484840404848484040404040404", "3", "ABACK"},
+            {"5221000000000000000000008000008000000000800000008000", "2", "ABASE"},
+            {"8120810131010101010101018181018101230101810101018101", "2", "BERET"},
+            {"3014351494141494141424941494141414941414141494141414", "3", "ABACK"},
+            {"9010901030101010901010901090101010321020101010101010", "2", "BERET"},
+            {"2004250484040404840404840484040404840484040404040404", "3", "ABACK"},
+            {"220425048404840404042c040484040404840404040484048404", "4", "ABACK"},
+            {"220404048404840404042c040404840404848404040484048404", "3", "BLACK"},
+            {"2004250484040404040404040484040404840404040404040404", "4", "ABACK"},
+            {"0021000000000000800000008000808000008000800000008000", "3", "ABATE"},
+            {"1010901010101010901010901090909010109020901010101010", "3", "AVERT"},
+            {"8000000030000000000000000000800000802100000000000000", "3", "BESET"},
+            {"2200000000008000800028000000808000008000800080008000", "3", "BLACK"},
+            {"5200000000000000000000008000000000000000000000000000", "3", "AGATE"},
+            {"1010101090901090101020901010101010101010901090109090", "4", "ABACK"},
+            {"2004040484040404040404040404840404848404040404040404", "4", "ADAPT"},
+            {"2200000000808000000028000000000000000000800080008080", "4", "ANKLE"},
+            {"0120010101010101810101018101818101018101810101018101", "3", "BRAVE"},
+            {"0021000000800000000000008000008000000000800000008080", "3", "ABASE"},
+            {"9010901010101010901010909090101010101020101010101010", "3", "ERUPT"},
+            {"8000000000008000800080000000808000008000800080008000", "3", "BERET"},
+            {"8120010101010101010101018101018101010101810101018101", "4", "BEECH"},
+            {"8000800034000080000080800080000000220000000080000000", "4", "BERET"},
+        };
+
+        std::stringstream output;
+        std::stringstream expected;
+        for (const auto& c : cases) {
+            CMask m = CMask::of_hex(c[0]);
+            SolveResult rv;
+            solve_p(valid_list(m, all_answers), valid_list(m, all_guesses), m, no_score, nullptr, rv);
+            output << rv.best_score << " " << Word(rv.best_guess) << std::endl;
+            expected << c[1] << " " << c[2] << std::endl;
+
+            // the oracles on their own, against the same root, say 2, 3 or neither, and pick the same guess
+            Endgame& e = get();
+            uint64_t all_answer_bits = e.answers.size() == 64 ? ~uint64_t(0) : (uint64_t(1) << e.answers.size()) - 1;
+            int oracle_guess = -1;
+            if (e.scores_2(all_answer_bits, e.guess_set_at(0), &oracle_guess)) {
+                output << "2 " << Word(e.guesses[oracle_guess].compact()) << std::endl;
+            } else if (e.scores_3(all_answer_bits, e.guess_set_at(0), m, 0, &oracle_guess)) {
+                output << "3 " << Word(e.guesses[oracle_guess].compact()) << std::endl;
+            } else {
+                output << "4 " << c[2] << std::endl;
+            }
+            expected << c[1] << " " << c[2] << std::endl;
+        }
+
+        // a cutoff we can't beat gives back something at least as big, and leaves rv alone
+        CMask m = CMask::of_hex(cases[16][0]);
+        SolveResult rv;
+        rv.best_score = 3;
+        solve_p(valid_list(m, all_answers), valid_list(m, all_guesses), m, no_score, nullptr, rv);
+        output << rv.best_score << " " << Word(rv.best_guess) << std::endl;
+        expected << 3 << " " << Word(no_best_guess) << std::endl;
+
+        std::string output_str = output.str();
+        std::string expected_str = expected.str();
+        if (output_str != expected_str) {
+            throw std::runtime_error("Endgame::test() failed, got\n" + output_str + ", but expected\n" + expected_str);
+        }
+    }
+}
@@ -0,0 +1,120 @@
+/* solve_p for states with at most 64 answers left, which is nearly every state the search visits.
+
+   The generic path pays for a Word_set filter, a partition and a db lookup at every state. Here
+   we do the setup once, at the state where the answers first drop to 64 or fewer (the endgame
+   root), and then solve its whole subtree on bitmasks:
+
+   - The root's answers get local bit numbers 0..63, so a state's answers are one uint64_t, and
+     its legal guesses are a bitset over the root's guesses.
+   - For each guess (the first time any state tries it) we precompute the root answers in each
+     feedback bucket as a uint64_t, so a state's buckets are just (bucket & answers), and the
+     pattern of every root guess, so a child's guesses are one pass over the parent's.
+   - A small direct-mapped memo, keyed by CMask, catches the states reached by more than one path.
+   - States the tablebase has (see tablebase.hpp) are looked up rather than searched.
+   - Before the search proper, two oracles answer "does this state score 2" (some guess splits the
+     answers into singletons) and "does it score 3" (some guess leaves only buckets of at most 2,
+     or buckets that score 2). Most states are settled by one of them, and a no settles the state
+     too when the cutoff is just above, without trying a single child.
+
+   The results are the same as solve_p's (adversarial, without the db): exact below the cutoff,
+   anything at or above it means "at least the cutoff". perf_calls still counts states, but the
+   order we try answers in (and so the cutoffs and the counts) isn't quite the generic one.
+*/
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "dictionary.hpp"
+#include "cmask.hpp"
+#include "solveresult.hpp"
+#include "feedback.hpp"
+#include "deadline.hpp"
+
+namespace Solver {
+    class Tablebase;
+
+    class Endgame {
+    public:
+        static const size_t max_answers = 64;
+        // past this many legal guesses the guess pattern table gets too big (it's guesses^2 bytes),
+        // so leave the state to the generic path
+        static const size_t max_guesses = 4096;
+
+        // Solves state [m], where [answers] (at most max_answers) and [guesses] are exactly what
+        // [m] allows. [rv] comes in as the best result known so far (e.g. from the db), and is
+        // only replaced by a strictly better guess. Its bound is left to the caller: anything at or
+        // above [score_cutoff] is a lower bound. [deadline] can be nullptr, it's only polled once
+        // on the way in.
+        static void solve_p(const std::vector<Dictionary::WordIndex>& answers,
+                            const std::vector<Dictionary::WordIndex>& guesses,
+                            const CMask& m,
+                            float score_cutoff,
+                            Deadline* deadline,
+                            SolveResult& rv);
+
+        // Every thread's endgame looks states up in [tablebase] from now on, nullptr to stop. It
+        // has to outlive the solving.
+        static void set_tablebase(const Tablebase* tablebase);
+        static const Tablebase* get_tablebase();
+
+        static void test();
+    private:
+        typedef Dictionary::WordIndex WordIndex;
+
+        Endgame() : guess_words(0), generation(0) {}
+
+        struct Bucket {
+            uint64_t answers; // of the root's
+            Feedback::Pattern pattern;
+        };
+        struct Memo_entry {
+            CMask m;
+            uint32_t generation;
+            float score;
+            Bound bound; // exact or lower, like SolveResult
+        };
+
+        // everything below is per thread, reused from one root to the next
+        static Endgame& get();
+        void reset(const std::vector<WordIndex>& answers, const std::vector<WordIndex>& guesses);
+        void prepare_guess(size_t g);
+        uint64_t* guess_set_at(size_t depth);
+        bool lookup(uint64_t answer_bits, const uint64_t* guess_bits, float& out_score, int* out_best_guess, int* out_worst_answer) const;
+
+        float solve_state(uint64_t answer_bits, const uint64_t* guess_bits, const CMask& m, float score_cutoff,
+                          size_t depth, double& perf_calls, int* out_best_guess, int* out_worst_answer);
+        // The oracles: is there a legal guess that puts every answer in a bucket of its own, i.e.
+        // does the state score 2, and is there one where every bucket scores at most 2, i.e. does
+        // it score 3. [out_guess] gets the first such guess, the same one the search would pick.
+        bool scores_2(uint64_t answer_bits, const uint64_t* guess_bits, int* out_guess);
+        bool scores_3(uint64_t answer_bits, const uint64_t* guess_bits, const CMask& m, size_t depth, int* out_guess);
+        int oracle_worst_answer(uint64_t answer_bits, size_t g, float score);
+        // out = the guesses in [guess_bits] that get [pattern] against guess [g]
+        void filter_guesses(const uint64_t* guess_bits, size_t g, Feedback::Pattern pattern, uint64_t* out);
+        float solve_child(uint64_t answer_bits, const uint64_t* guess_bits, const CMask& m, size_t g,
+                          Feedback::Pattern pattern, float score_cutoff, size_t depth, double& perf_calls);
+
+        std::vector<WordIndex> answers;
+        std::vector<WordIndex> guesses;
+        size_t guess_words; // uint64_t's in a guess bitset
+        Feedback::Answer_letters answer_letters;
+        Feedback::Answer_letters guess_letters;
+
+        // per root guess g, filled in by prepare_guess
+        std::vector<uint8_t> guess_prepared;
+        std::vector<Bucket> buckets;          // buckets[g * max_answers ...], num_buckets[g] of them
+        std::vector<uint8_t> num_buckets;
+        std::vector<Feedback::Pattern> guess_patterns; // guess_patterns[g * guesses.size() + h] = pattern(h, g)
+
+        std::vector<std::vector<uint64_t>> guess_sets; // one guess bitset per depth
+        std::vector<Feedback::Pattern> pattern_buffer;
+
+        // Tablebase codes of the root's answers and guesses, when there's a tablebase
+        std::vector<uint64_t> answer_codes;
+        std::vector<uint64_t> guess_codes;
+
+        static const size_t memo_bits = 12;
+        std::vector<Memo_entry> memo;
+        uint32_t generation;
+    };
+}
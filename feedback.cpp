@@ -0,0 +1,170 @@
+#include <sstream>
+#include <map>
+#include "feedback.hpp"
+#include "result.hpp"
+#if USE_AVX
+#include <immintrin.h>
+#endif
+
+using std::vector;
+typedef Dictionary::WordIndex WordIndex;
+
+namespace Feedback {
+    static const uint8_t powers_of_3[5] = {1, 3, 9, 27, 81};
+    static const uint8_t not_a_letter = 26;
+
+    Pattern pattern(const Word& answer, const Word& guess) {
+        Pattern rv = 0;
+        int unmatched[26] = {0};
+        for (int p = 0; p < 5; p++) {
+            if (answer[p] == guess[p]) {
+                rv += 2 * powers_of_3[p];
+            } else {
+                unmatched[answer[p] - 'A']++;
+            }
+        }
+        // left to right, each non-green letter is yellow while the answer still has an unmatched copy
+        for (int p = 0; p < 5; p++) {
+            if (answer[p] != guess[p] && unmatched[guess[p] - 'A'] > 0) {
+                unmatched[guess[p] - 'A']--;
+                rv += powers_of_3[p];
+            }
+        }
+        return rv;
+    }
+
+    Answer_letters::Answer_letters(const vector<WordIndex>& answers) {
+        assign(answers.data(), answers.size());
+    }
+
+    void Answer_letters::assign(const WordIndex* answers, size_t num_answers_) {
+        num_answers = num_answers_;
+        stride = (num_answers + block_size - 1) / block_size * block_size;
+        letters.assign(5 * stride, not_a_letter);
+        for (size_t i = 0; i < num_answers; i++) {
+            Word::Compact c = answers[i].compact();
+            for (int p = 0; p < 5; p++) letters[p * stride + i] = c[p] - 'A';
+        }
+    }
+
+    void Answer_letters::swap(size_t i, size_t j) {
+        for (int p = 0; p < 5; p++) std::swap(letters[p * stride + i], letters[p * stride + j]);
+    }
+
+    void patterns(const Answer_letters& answers, WordIndex guess, vector<Pattern>& out) {
+        out.resize(answers.size() + block_size);
+        for (size_t first = 0; first < answers.size(); first += block_size) patterns_block(answers, guess, first, &out[first]);
+        out.resize(answers.size());
+    }
+
+    void patterns_block(const Answer_letters& answers, WordIndex guess, size_t first, Pattern* out) {
+        Word::Compact g = guess.compact();
+        uint8_t guess_letters[5];
+        for (int p = 0; p < 5; p++) guess_letters[p] = g[p] - 'A';
+        const uint8_t* letters[5];
+        for (int p = 0; p < 5; p++) letters[p] = &answers.letters[p * answers.stride + first];
+
+        #if USE_AVX
+        // The same rule as [pattern]: the guess letter at p is yellow if it isn't green and
+        // there are more non-green copies of it in the answer than non-green copies of it in the
+        // guess to the left of p. Everything is a byte per answer, comparisons give 0xFF (= -1)
+        // so subtracting them counts.
+        static_assert(block_size == 32, "one __m256i of answers per block");
+        __m256i a[5];
+        __m256i g_letter[5];
+        __m256i green[5];
+        for (int p = 0; p < 5; p++) {
+            g_letter[p] = _mm256_set1_epi8(guess_letters[p]);
+            a[p] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(letters[p]));
+            green[p] = _mm256_cmpeq_epi8(a[p], g_letter[p]);
+        }
+        __m256i code = _mm256_setzero_si256();
+        for (int p = 0; p < 5; p++) {
+            __m256i available = _mm256_setzero_si256();
+            __m256i used = _mm256_setzero_si256();
+            for (int q = 0; q < 5; q++) {
+                // letter p of the guess against a non-green letter q of the answer
+                available = _mm256_sub_epi8(available, _mm256_andnot_si256(green[q], _mm256_cmpeq_epi8(a[q], g_letter[p])));
+                if (q < p && guess_letters[q] == guess_letters[p]) {
+                    used = _mm256_sub_epi8(used, _mm256_andnot_si256(green[q], _mm256_set1_epi8(-1)));
+                }
+            }
+            __m256i yellow = _mm256_andnot_si256(green[p], _mm256_cmpgt_epi8(available, used));
+            code = _mm256_add_epi8(code, _mm256_and_si256(green[p], _mm256_set1_epi8(2 * powers_of_3[p])));
+            code = _mm256_add_epi8(code, _mm256_and_si256(yellow, _mm256_set1_epi8(powers_of_3[p])));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), code);
+        #else
+        for (size_t i = 0; i < block_size; i++) {
+            Pattern rv = 0;
+            int unmatched[27] = {0};
+            for (int p = 0; p < 5; p++) {
+                if (letters[p][i] == guess_letters[p]) {
+                    rv += 2 * powers_of_3[p];
+                } else {
+                    unmatched[letters[p][i]]++;
+                }
+            }
+            for (int p = 0; p < 5; p++) {
+                if (letters[p][i] != guess_letters[p] && unmatched[guess_letters[p]] > 0) {
+                    unmatched[guess_letters[p]]--;
+                    rv += powers_of_3[p];
+                }
+            }
+            out[i] = rv;
+        }
+        #endif
+    }
+
+    void test() {
+        const vector<WordIndex>& answers = Dictionary::get_all_answers();
+        const vector<WordIndex>& guesses = Dictionary::get_all_answers_and_guesses();
+
+        std::stringstream output;
+        std::stringstream expected;
+
+        output << int(pattern(Word("CRANE"), Word("CRANE"))) << " " << int(pattern(Word("CRANE"), Word("SOARE")))
+               << " " << int(pattern(Word("ABBEY"), Word("BOBBY"))) << std::endl;
+        // SOARE: A and E green, R yellow. BOBBY: only the first B is yellow, ABBEY's other B is green
+        expected << "242 " << (2 * 9 + 27 + 2 * 81) << " " << (1 + 2 * 9 + 2 * 81) << std::endl;
+
+        // [patterns] against [pattern] against Result, and one pattern <=> one CMask for a guess
+        Answer_letters letters(answers);
+        letters.swap(0, 1);
+        vector<WordIndex> swapped = answers;
+        std::swap(swapped[0], swapped[1]);
+        size_t num_pairs = 0;
+        size_t num_wrong = 0;
+        vector<Pattern> out;
+        for (size_t gi = 0; gi < guesses.size(); gi += 97) {
+            WordIndex guess = guesses[gi];
+            patterns(letters, guess, out);
+            if (out.size() != answers.size()) num_wrong++;
+            std::map<Pattern, CMask> mask_by_pattern;
+            std::map<CMask, Pattern> pattern_by_mask;
+            for (size_t i = 0; i < swapped.size(); i++) {
+                const Word& answer = *swapped[i];
+                Pattern slow = pattern(answer, *guess);
+                Result r(answer, *guess);
+                Pattern from_result = 0;
+                for (int p = 0; p < 5; p++) {
+                    if (r.get_result(p) == Result::green) from_result += 2 * powers_of_3[p];
+                    if (r.get_result(p) == Result::yellow) from_result += powers_of_3[p];
+                }
+                CMask nr(answer, *guess);
+                if (out[i] != slow || slow != from_result) num_wrong++;
+                if (!(mask_by_pattern.insert({slow, nr}).first->second == nr)) num_wrong++;
+                if (pattern_by_mask.insert({nr, slow}).first->second != slow) num_wrong++;
+                num_pairs++;
+            }
+        }
+        output << num_pairs << " " << num_wrong << std::endl;
+        expected << ((guesses.size() + 96) / 97) * answers.size() << " 0" << std::endl;
+
+        std::string output_str = output.str();
+        std::string expected_str = expected.str();
+        if (output_str != expected_str) {
+            throw std::runtime_error("Feedback::test() failed, got\n" + output_str + ", but expected\n" + expected_str);
+        }
+    }
+}
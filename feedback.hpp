@@ -0,0 +1,53 @@
+/* Wordle's feedback for a guess as a number, the pattern id: the sum over positions p of
+   3^p * (0 for black, 1 for yellow, 2 for green). So 0..242, and 242 is all green.
+
+   For a fixed guess, two answers have the same pattern exactly when CMask(answer, guess) is the
+   same, so the solver can group answers by pattern with a 243-entry array instead of a
+   map<CMask, ...>, and only build the CMask once per group.
+
+   [patterns] is the fast one: one guess against a whole Answer_letters list, 32 answers per AVX2
+   instruction. [patterns_block] does just 32 of them, for loops that usually stop early.
+*/
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "word.hpp"
+#include "dictionary.hpp"
+
+namespace Feedback {
+    typedef uint8_t Pattern;
+    const int num_patterns = 243;
+    const Pattern all_green = 242;
+    const size_t block_size = 32;
+
+    // the scalar version, same rules as Result(answer, guess)
+    Pattern pattern(const Word& answer, const Word& guess);
+
+    // A list of answers stored a letter position at a time (letters[p][i] is letter p of answer
+    // i, 'A' = 0), which is what [patterns] wants.
+    class Answer_letters {
+    public:
+        Answer_letters() : num_answers(0), stride(0) {}
+        Answer_letters(const std::vector<Dictionary::WordIndex>& answers);
+        // replaces the list, reusing our memory
+        void assign(const Dictionary::WordIndex* answers, size_t num_answers);
+        size_t size() const { return num_answers; }
+        // keeps us in step when the solver reorders its answer list
+        void swap(size_t i, size_t j);
+    private:
+        size_t num_answers;
+        size_t stride; // num_answers padded up to a multiple of block_size with a non-letter,
+                       // which never matches a guess
+        std::vector<uint8_t> letters; // letter p of answer i is letters[p * stride + i]
+        friend void patterns_block(const Answer_letters& answers, Dictionary::WordIndex guess, size_t first, Pattern* out);
+    };
+
+    // out[i] = pattern(answer i, guess). [out] is resized to answers.size().
+    void patterns(const Answer_letters& answers, Dictionary::WordIndex guess, std::vector<Pattern>& out);
+    // out[i] = pattern(answer first + i, guess) for i < block_size, [first] a multiple of
+    // block_size. Past the end of [answers] the patterns are garbage.
+    void patterns_block(const Answer_letters& answers, Dictionary::WordIndex guess, size_t first, Pattern* out);
+
+    void test();
+}
@@ -0,0 +1,294 @@
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "fingerprint_db.hpp"
+#include "dictionary.hpp"
+
+using std::string;
+using std::vector;
+using std::pair;
+using std::cerr;
+using std::endl;
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+using Solver::SolveResult;
+typedef Word::Compact CompactWord;
+
+namespace Db {
+    static const char fingerprint_magic[8] = { 'E', 'W', 'F', 'P', 'D', 'B', '1', 0 };
+
+    // A word's code is its dictionary index, and the placeholder words that show up in results
+    // (no guess / no answer yet) get the codes after the dictionary.
+    static const vector<CompactWord>& word_codes() {
+        static const vector<CompactWord> codes = [] () {
+            vector<CompactWord> c;
+            c.push_back(*Dictionary::fake_word);
+            for (Dictionary::WordIndex w : Dictionary::get_all_answers_and_guesses()) c.push_back(*w);
+            c.push_back(Solver::no_best_guess);
+            c.push_back(Solver::no_worst_answer);
+            c.push_back(Job::no_guess);
+            return c;
+        } ();
+        return codes;
+    }
+
+    static uint16_t encode_word(CompactWord w) {
+        static const vector<pair<CompactWord, uint16_t>> sorted = [] () {
+            vector<pair<CompactWord, uint16_t>> s;
+            const vector<CompactWord>& codes = word_codes();
+            for (size_t i = 0; i < codes.size(); i++) s.push_back({codes[i], static_cast<uint16_t>(i)});
+            std::sort(s.begin(), s.end(), [] (const pair<CompactWord, uint16_t>& lhs, const pair<CompactWord, uint16_t>& rhs) { return lhs.first < rhs.first; });
+            return s;
+        } ();
+        auto it = std::lower_bound(sorted.begin(), sorted.end(), w, [] (const pair<CompactWord, uint16_t>& lhs, CompactWord rhs) { return lhs.first < rhs; });
+        if (it == sorted.end() || !(it->first == w)) {
+            std::stringstream ss;
+            ss << "Can't store " << Word(w) << " in a fingerprint db, it's not in the dictionary";
+            throw std::runtime_error(ss.str());
+        }
+        if (it->second >> Fingerprint_db::bound_shift) throw std::runtime_error("Too many words for a fingerprint db");
+        return it->second;
+    }
+
+    static unsigned int bucket_of(uint64_t fingerprint, unsigned int bucket_bits) {
+        return bucket_bits == 0 ? 0 : fingerprint >> (64 - bucket_bits);
+    }
+
+    //////////////////
+    // Fingerprint_db
+
+    Fingerprint_db::Fingerprint_db(const string& filename_) :
+        filename(filename_), mapped(nullptr), mapped_size(0), bucket_start(nullptr), entries(nullptr), num_entries(0), bucket_bits(0)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Error opening fingerprint db: " + filename);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+            close(fd);
+            throw std::runtime_error("Error stat'ing fingerprint db or it's too short: " + filename);
+        }
+        mapped_size = st.st_size;
+        mapped = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            mapped = nullptr;
+            throw std::runtime_error("Error mmap'ing fingerprint db: " + filename);
+        }
+
+        const Header* header = reinterpret_cast<const Header*>(mapped);
+        num_entries = header->num_entries;
+        bucket_bits = header->bucket_bits;
+        size_t num_buckets = 0;
+        string error;
+        if (memcmp(header->magic, fingerprint_magic, sizeof(fingerprint_magic)) != 0) {
+            error = "not a fingerprint db";
+        } else if (header->num_word_codes != word_codes().size()) {
+            error = "built with a different dictionary";
+        } else if (bucket_bits > 40) {
+            error = "too many buckets";
+        } else {
+            // only shift once we know it's in range
+            num_buckets = size_t(1) << bucket_bits;
+            if (mapped_size != sizeof(Header) + (num_buckets + 1) * sizeof(uint64_t) + num_entries * sizeof(Entry)) error = "wrong size";
+        }
+        if (!error.empty()) {
+            munmap(mapped, mapped_size);
+            mapped = nullptr;
+            throw std::runtime_error("Bad fingerprint db, " + error + ": " + filename);
+        }
+        bucket_start = reinterpret_cast<const uint64_t*>(header + 1);
+        entries = reinterpret_cast<const Entry*>(bucket_start + num_buckets + 1);
+
+        if (!silence) cerr << "Opened fingerprint db: " << filename << " with " << num_entries << " records" << endl;
+    }
+
+    Fingerprint_db::~Fingerprint_db() {
+        if (mapped) munmap(mapped, mapped_size);
+    }
+
+    void Fingerprint_db::save(const Job&, const SolveResult&) {
+    }
+
+    bool Fingerprint_db::query(const Job& j, SolveResult& result) const {
+        uint64_t fingerprint = j.fingerprint();
+        unsigned int b = bucket_of(fingerprint, bucket_bits);
+        const Entry* lo = entries + bucket_start[b];
+        const Entry* hi = entries + bucket_start[b + 1];
+        const Entry* it = std::lower_bound(lo, hi, fingerprint, [] (const Entry& lhs, uint64_t rhs) { return lhs.fingerprint < rhs; });
+        if (it == hi || it->fingerprint != fingerprint) return false;
+
+        const vector<CompactWord>& codes = word_codes();
+        result = SolveResult();
+        result.best_score = it->best_score;
+        result.best_guess = codes[it->best_guess & ((1 << bound_shift) - 1)];
+        result.worst_answer = codes[it->worst_answer];
+        result.set_bound(static_cast<Solver::Bound>(it->best_guess >> bound_shift));
+        return true;
+    }
+
+    size_t Fingerprint_db::query_all(const CMask& m, vector<Record>& out) const {
+        size_t count = 0;
+        for (Objective o : { Objective::adversarial, Objective::pwin1, Objective::pwin2, Objective::pwin3, Objective::pwin4, Objective::pwin5 }) {
+            Job j(m, Job::no_guess, o);
+            SolveResult r;
+            if (query(j, r)) {
+                out.push_back({j, r});
+                count++;
+            }
+        }
+        return count;
+    }
+
+    void write_fingerprint_file(const string& filename, const vector<pair<const Record*, const Record*>>& sources) {
+        ptime start = microsec_clock::local_time();
+        typedef Fingerprint_db::Entry Entry;
+        vector<Entry> entries;
+        size_t total = 0;
+        for (const auto& source : sources) total += source.second - source.first;
+        entries.reserve(total);
+        merge_sorted(sources, [&entries] (const Record& r) {
+            uint16_t best_guess = encode_word(r.second.best_guess) | (static_cast<uint16_t>(r.second.get_bound()) << Fingerprint_db::bound_shift);
+            entries.push_back({ r.first.fingerprint(), r.second.best_score, best_guess, encode_word(r.second.worst_answer) });
+        });
+        std::sort(entries.begin(), entries.end(), [] (const Entry& lhs, const Entry& rhs) { return lhs.fingerprint < rhs.fingerprint; });
+
+        // merge_sorted already dropped duplicate Jobs, so any repeat here is a real collision
+        std::set<uint64_t> collisions;
+        for (size_t i = 1; i < entries.size(); i++) {
+            if (entries[i].fingerprint == entries[i - 1].fingerprint) collisions.insert(entries[i].fingerprint);
+        }
+        if (!collisions.empty()) {
+            std::stringstream ss;
+            uint64_t example = *collisions.begin();
+            ss << collisions.size() << " fingerprint collisions, e.g. these all hash to " << example << ":";
+            merge_sorted(sources, [&ss, example] (const Record& r) {
+                if (r.first.fingerprint() == example) ss << " [" << r.first << "]";
+            });
+            throw std::runtime_error(ss.str());
+        }
+
+        Fingerprint_db::Header header;
+        memcpy(header.magic, fingerprint_magic, sizeof(fingerprint_magic));
+        header.num_entries = entries.size();
+        header.bucket_bits = 0;
+        // about 64 entries (1KB) a bucket
+        while ((entries.size() >> header.bucket_bits) > 64) header.bucket_bits++;
+        header.num_word_codes = word_codes().size();
+
+        vector<uint64_t> bucket_start((size_t(1) << header.bucket_bits) + 1, 0);
+        for (const Entry& e : entries) bucket_start[bucket_of(e.fingerprint, header.bucket_bits) + 1]++;
+        for (size_t b = 1; b < bucket_start.size(); b++) bucket_start[b] += bucket_start[b - 1];
+
+        string tmp_filename = filename + ".tmp";
+        {
+            std::ofstream ofs(tmp_filename, std::ios::binary | std::ios::trunc);
+            ofs.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(bucket_start.data()), bucket_start.size() * sizeof(uint64_t));
+            ofs.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+        }
+        if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+            throw std::runtime_error("Error renaming " + tmp_filename + " to " + filename);
+        }
+        if (!silence) {
+            cerr << "Wrote fingerprint db: " << filename << " with " << entries.size() << " records, took "
+                 << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
+        }
+    }
+
+    void Fingerprint_db::test() {
+        silence = true;
+        string tmpfile = "/tmp/tmp.fingerprint_db." + std::to_string(getpid()) + ".bin";
+        remove(tmpfile.c_str());
+
+        static_assert(sizeof(Entry) == 16, "fingerprint db entries should be 16 bytes");
+
+        // a few thousand Jobs across objectives and with/without a guess, plus one the db won't have
+        const vector<Dictionary::WordIndex>& answers = Dictionary::get_all_answers();
+        const vector<Dictionary::WordIndex>& guesses = Dictionary::get_all_guesses();
+        vector<Record> records;
+        for (size_t i = 0; i < 3000; i++) {
+            CMask m(*answers[i % answers.size()], *guesses[(i * 13) % guesses.size()]);
+            Word::Compact g = (i % 3 == 0) ? Job::no_guess : Word::Compact(*guesses[i % 101]);
+            SolveResult r;
+            r.best_score = (i % 7) + 0.25;
+            if (i % 5 != 0) r.best_guess = *guesses[i % guesses.size()];
+            if (i % 4 != 0) r.worst_answer = *answers[(i * 31) % answers.size()];
+            if (i % 9 == 1) r.set_bound(i % 2 ? Solver::Bound::lower : Solver::Bound::upper);
+            records.push_back({Job(m, g, static_cast<Objective>(i % 6)), r});
+        }
+        Job missing(CMask(*answers[0], *answers[1]), *guesses[0], Objective::pwin3);
+        sort_records(records, 1);
+        write_fingerprint_file(tmpfile, {{records.data(), records.data() + records.size()}});
+
+        std::stringstream output;
+        std::stringstream expected;
+        {
+            Fingerprint_db db(tmpfile);
+            size_t num_ok = 0;
+            for (const Record& rec : records) {
+                SolveResult r;
+                if (db.query(rec.first, r) && r.best_score == rec.second.best_score &&
+                    r.best_guess == rec.second.best_guess && r.worst_answer == rec.second.worst_answer &&
+                    r.get_bound() == rec.second.get_bound()) {
+                    num_ok++;
+                }
+            }
+            // query_all only knows the no_guess record
+            vector<Record> all;
+            size_t n = db.query_all(records[0].first.get_mask(), all);
+            size_t num_no_guess = 0;
+            for (const Record& rec : records) {
+                if (rec.first.get_mask() == records[0].first.get_mask() && rec.first.get_guess() == Job::no_guess) num_no_guess++;
+            }
+            output << db.size() << " " << num_ok << " " << db.query(missing) << " " << (n == num_no_guess && all.size() == n) << endl;
+        }
+        expected << records.size() << " " << records.size() << " 0 1" << endl;
+
+        // words that aren't in the dictionary can't be stored
+        {
+            vector<Record> bad = { records[0] };
+            bad[0].second.best_guess = Word("QQQQQ");
+            try {
+                write_fingerprint_file(tmpfile + ".2", {{bad.data(), bad.data() + bad.size()}});
+                output << "wrote" << endl;
+            } catch (const std::runtime_error& e) {
+                output << "threw" << endl;
+            }
+            expected << "threw" << endl;
+        }
+
+        // a header with a nonsense bucket_bits is rejected, not shifted by
+        {
+            std::fstream f(tmpfile, std::ios::binary | std::ios::in | std::ios::out);
+            uint64_t bucket_bits = 200;
+            f.seekp(offsetof(Header, bucket_bits));
+            f.write(reinterpret_cast<const char*>(&bucket_bits), sizeof(bucket_bits));
+            f.close();
+            try {
+                Fingerprint_db db(tmpfile);
+                output << "opened" << endl;
+            } catch (const std::runtime_error& e) {
+                output << e.what() << endl;
+            }
+            expected << "Bad fingerprint db, too many buckets: " << tmpfile << endl;
+        }
+
+        remove(tmpfile.c_str());
+        silence = false;
+        std::string output_str = output.str();
+        std::string expected_str = expected.str();
+        if (output_str != expected_str) {
+            throw std::runtime_error("Fingerprint_db::test() failed, got\n" + output_str + ", but expected\n" + expected_str);
+        }
+    }
+}
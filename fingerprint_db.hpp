@@ -0,0 +1,79 @@
+/* A read-only db for serving, keyed by Job::fingerprint() instead of the Job itself.
+
+   A Read_only_db record is 56 bytes, 32 of which are the padded CMask. Serving only ever asks
+   "what's the result for this Job", so here each record is just the 8-byte fingerprint plus an
+   8-byte packed value: the score and its Bound, and best guess / worst answer as dictionary indexes. The perf
+   stats aren't kept. That's 16 bytes a record, about 2.8 GB for 175M records instead of ~10 GB.
+
+   The file is written offline (see write_fingerprint_file and `dbtool fingerprint`), which
+   refuses to write it if two different Jobs in the db have the same fingerprint, so a lookup that
+   finds its fingerprint found its Job. A Job that isn't in the db can still collide with one that
+   is, at 175M records that's about a 1 in 10^11 chance per lookup.
+
+   File layout, all little-endian and mmap'ed:
+     Header
+     uint64_t bucket_start[2^bucket_bits + 1] - records whose top bucket_bits bits are b are
+                                                [bucket_start[b], bucket_start[b+1])
+     Entry    entries[num_entries]            - sorted by fingerprint
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include "db.hpp"
+
+namespace Db {
+    class Fingerprint_db : public Db_intf {
+    public:
+        Fingerprint_db(const std::string& filename);
+        ~Fingerprint_db();
+        Fingerprint_db(const Fingerprint_db&) = delete;
+        Fingerprint_db& operator=(const Fingerprint_db&) = delete;
+
+        using Db_intf::save;
+        using Db_intf::query;
+        // ignored, like Read_only_db
+        virtual void save(const Job& j, const Solver::SolveResult& result);
+        virtual bool query(const Job& j, Solver::SolveResult& result) const;
+        // There's no way to enumerate a mask's records by hash, so this only finds the no_guess
+        // records for [m] (one lookup per objective). Per-guess results are still found by query.
+        virtual size_t query_all(const CMask& m, std::vector<Record>& out) const;
+        virtual bool query_all_is_complete() const { return false; }
+
+        size_t size() const { return num_entries; }
+
+        struct Header {
+            char magic[8];
+            uint64_t num_entries;
+            uint64_t bucket_bits;
+            uint64_t num_word_codes; // has to match the dictionary we were built with
+        };
+        struct Entry {
+            uint64_t fingerprint;
+            float best_score;
+            uint16_t best_guess;   // the top two bits are the Bound, see bound_shift
+            uint16_t worst_answer;
+        };
+
+        // word codes are dictionary indexes, well under 2^14
+        static const unsigned int bound_shift = 14;
+
+        static void test();
+    private:
+        std::string filename;
+        void* mapped;
+        size_t mapped_size;
+        const uint64_t* bucket_start;
+        const Entry* entries;
+        uint64_t num_entries;
+        unsigned int bucket_bits;
+    };
+
+    // Writes every record from the sorted [sources] into a fingerprint file. Duplicate Jobs are
+    // dropped the same way as merge_sorted (earliest source wins). Throws, without writing
+    // [filename], if two different Jobs have the same fingerprint or a guess/answer isn't a
+    // dictionary word.
+    void write_fingerprint_file
+    (const std::string& filename,
+     const std::vector<std::pair<const Record*, const Record*>>& sources);
+}
@@ -1,4 +1,5 @@
 #include <sstream>
+#include <cstring>
 #include "job.hpp"
 
 std::ostream& operator<<(std::ostream& os, Objective o) {
@@ -51,6 +52,32 @@ void Job::set_objective(Objective o) {
     guess_and_objective = pack_guess_and_objective(get_guess(), o);
 }
 
+// murmur3's 64-bit finalizer
+static uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+uint64_t Job::fingerprint() const {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&mask);
+    uint64_t words[4];
+    memcpy(words, bytes, 24);
+    uint16_t w3;
+    memcpy(&w3, bytes + 24, 2);
+    words[3] = w3 | (static_cast<uint64_t>(static_cast<uint32_t>(guess_and_objective)) << 16);
+
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+    for (uint64_t w : words) {
+        h = (h ^ fmix64(w)) * 0x87c37b91114253d5ULL;
+        h = (h << 31) | (h >> 33);
+    }
+    return fmix64(h);
+}
+
 Job::Job() :
     mask(),
     guess_and_objective(pack_guess_and_objective(no_guess, Objective::adversarial))
@@ -61,6 +88,13 @@ Job::Job(const CMask& mask_, Word::Compact guess_, Objective objective_) :
     guess_and_objective(pack_guess_and_objective(guess_, objective_))
 {};
 
+Job Job::first_for_mask(const CMask& m) {
+    Job j(m, no_guess, Objective::adversarial);
+    // guess and objective are both packed in as non-negative, so 0 is the smallest
+    j.guess_and_objective = 0;
+    return j;
+}
+
 bool Job::operator<(const Job& k) const {
     if (mask < k.mask) return true;
     if (k.mask < mask) return false;
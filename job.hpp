@@ -4,6 +4,8 @@
 #include "word.hpp"
 #include "cmask.hpp"
 
+namespace Db { class Read_only_db; }
+
 // int32_t, but really we're going to pack this into the 5-bit (26-30) of the guess.
 // Don't change the ints, we assume we can static cast to get the pwin number.
 enum class Objective : int32_t
@@ -41,12 +43,22 @@ public:
     
     static const Word::Compact no_guess;
 
+    // The smallest Job with mask [m], all the Jobs for one mask sort together starting here.
+    static Job first_for_mask(const CMask& m);
+
+    // 64-bit hash of the 26 mask bytes, the guess and the objective (not the padding). Used as the
+    // whole key by Db::Fingerprint_db, so it needs to be well mixed, not just cheap.
+    uint64_t fingerprint() const;
+
     static void test();
 private:
     CMask mask;
 
     // this is really a kludge but I didn't want to re-compute the whole database
     int32_t guess_and_objective;
+
+    // stores guess_and_objective separately from the mask
+    friend class Db::Read_only_db;
 };
 
 std::ostream& operator<<(std::ostream&, Objective o);
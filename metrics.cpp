@@ -0,0 +1,403 @@
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "metrics.hpp"
+
+using std::string;
+using std::endl;
+
+namespace Metrics {
+    uint64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    uint64_t sample_start() {
+        static thread_local int countdown = 0;
+        if (--countdown > 0) return 0;
+        countdown = sample_interval;
+        return now_ns();
+    }
+
+    //////////////////
+    // Counter
+    Counter::Counter() {
+        reset();
+    }
+
+    void Counter::reset() {
+        for (Slot& s : slots) s.n.store(0, std::memory_order_relaxed);
+    }
+
+    int Counter::slot() {
+        static std::atomic<int> next_slot(0);
+        static thread_local int s = next_slot.fetch_add(1, std::memory_order_relaxed) % num_slots;
+        return s;
+    }
+
+    uint64_t Counter::value() const {
+        uint64_t total = 0;
+        for (const Slot& s : slots) total += s.n.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    //////////////////
+    // Histogram
+    static const int sub_buckets = 1 << Histogram::sub_bucket_bits;
+
+    Histogram::Histogram() {
+        reset();
+    }
+
+    void Histogram::reset() {
+        for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+    }
+
+    int Histogram::bucket_of(uint64_t ns) {
+        if (ns < uint64_t(sub_buckets)) return ns;
+        // the power of two, then the next sub_bucket_bits bits below the top one
+        int e = 63 - __builtin_clzll(ns);
+        int b = (e - sub_bucket_bits + 1) * sub_buckets + ((ns >> (e - sub_bucket_bits)) & (sub_buckets - 1));
+        return std::min(b, num_buckets - 1);
+    }
+
+    uint64_t Histogram::bucket_end(int b) {
+        if (b < sub_buckets) return b + 1;
+        int e = b / sub_buckets + sub_bucket_bits - 1;
+        return uint64_t(sub_buckets + b % sub_buckets + 1) << (e - sub_bucket_bits);
+    }
+
+    void Histogram::record(uint64_t ns) {
+        buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    uint64_t Histogram::count() const {
+        uint64_t total = 0;
+        for (int b = 0; b < num_buckets; b++) total += bucket_count(b);
+        return total;
+    }
+
+    uint64_t Histogram::quantile(double q) const {
+        uint64_t total = count();
+        if (total == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * total + 0.5));
+        uint64_t seen = 0;
+        for (int b = 0; b < num_buckets; b++) {
+            seen += bucket_count(b);
+            if (seen >= rank) return bucket_end(b);
+        }
+        return bucket_end(num_buckets - 1);
+    }
+
+    //////////////////
+    // Registry
+    Registry::Series& Registry::series(const string& name, const string& help, Type type, const string& labels) {
+        auto family = families.begin();
+        while (family != families.end() && family->name != name) ++family;
+        if (family == families.end()) {
+            families.push_back({name, help, type, {}});
+            family = families.end() - 1;
+        } else if (family->type != type) {
+            throw std::runtime_error("Metric " + name + " is already registered as another type");
+        }
+        for (Series& s : family->series) {
+            if (s.labels == labels) return s;
+        }
+        family->series.emplace_back();
+        Series& s = family->series.back();
+        s.labels = labels;
+        return s;
+    }
+
+    Counter& Registry::counter(const string& name, const string& help, const string& labels) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Series& s = series(name, help, Type::counter, labels);
+        if (!s.counter) s.counter.reset(new Counter);
+        return *s.counter;
+    }
+
+    Gauge& Registry::gauge(const string& name, const string& help, const string& labels) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Series& s = series(name, help, Type::gauge, labels);
+        if (!s.gauge && !s.fn) s.gauge.reset(new Gauge);
+        if (!s.gauge) throw std::runtime_error("Metric " + name + " is already registered as a gauge_fn");
+        return *s.gauge;
+    }
+
+    Histogram& Registry::histogram(const string& name, const string& help, const string& labels) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Series& s = series(name, help, Type::histogram, labels);
+        if (!s.histogram) s.histogram.reset(new Histogram);
+        return *s.histogram;
+    }
+
+    void Registry::gauge_fn(const string& name, const string& help, const std::function<double()>& f) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Series& s = series(name, help, Type::gauge, "");
+        if (s.gauge) throw std::runtime_error("Metric " + name + " is already registered as a gauge");
+        s.fn = f;
+    }
+
+    // enough digits for a byte count or a nanosecond sum in seconds
+    static string number(double x) {
+        std::ostringstream os;
+        os << std::setprecision(15) << x;
+        return os.str();
+    }
+
+    // "name{labels}", or just the name
+    static string series_name(const string& name, const string& labels) {
+        return labels.empty() ? name : name + "{" + labels + "}";
+    }
+
+    void Registry::write_prometheus(std::ostream& os) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Family& f : families) {
+            static const char* type_names[] = {"counter", "gauge", "histogram"};
+            os << "# HELP " << f.name << " " << f.help << "\n"
+               << "# TYPE " << f.name << " " << type_names[static_cast<int>(f.type)] << "\n";
+            for (const Series& s : f.series) {
+                if (s.counter) os << series_name(f.name, s.labels) << " " << s.counter->value() << "\n";
+                if (s.gauge) os << series_name(f.name, s.labels) << " " << s.gauge->value() << "\n";
+                if (s.fn) os << series_name(f.name, s.labels) << " " << number(s.fn()) << "\n";
+                if (s.histogram) {
+                    const Histogram& h = *s.histogram;
+                    string le_prefix = s.labels.empty() ? "" : s.labels + ",";
+                    // cumulative, at each power of two the buckets line up with
+                    uint64_t cumulative = 0;
+                    int b = 0;
+                    for (int k = 10; k <= 45; k++) {
+                        for (; b < Histogram::num_buckets && Histogram::bucket_end(b) <= (uint64_t(1) << k); b++) cumulative += h.bucket_count(b);
+                        os << f.name << "_bucket{" << le_prefix << "le=\"" << number((uint64_t(1) << k) / 1e9) << "\"} " << cumulative << "\n";
+                    }
+                    for (; b < Histogram::num_buckets; b++) cumulative += h.bucket_count(b);
+                    os << f.name << "_bucket{" << le_prefix << "le=\"+Inf\"} " << cumulative << "\n"
+                       << series_name(f.name + "_sum", s.labels) << " " << number(h.sum_ns() / 1e9) << "\n"
+                       << series_name(f.name + "_count", s.labels) << " " << cumulative << "\n";
+                }
+            }
+        }
+    }
+
+    void Registry::reset() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Family& f : families) {
+            for (Series& s : f.series) {
+                if (s.counter) s.counter->reset();
+                if (s.histogram) s.histogram->reset();
+            }
+        }
+    }
+
+    static double resident_bytes() {
+        // pages: total size, then resident
+        std::ifstream statm("/proc/self/statm");
+        double size = 0, resident = 0;
+        statm >> size >> resident;
+        return resident * sysconf(_SC_PAGESIZE);
+    }
+
+    Registry& registry() {
+        static Registry* r = [] {
+            Registry* r = new Registry; // never destroyed, threads may still be counting at exit
+            r->gauge_fn("process_resident_memory_bytes", "Resident memory size in bytes.", resident_bytes);
+            return r;
+        }();
+        return *r;
+    }
+
+    void Registry::test() {
+        std::stringstream output;
+        std::stringstream expected;
+
+        // the buckets tile the numbers, and each holds its value to within 25%
+        bool tiled = true;
+        for (int b = 1; b < Histogram::num_buckets; b++) {
+            uint64_t start = Histogram::bucket_end(b - 1);
+            if (Histogram::bucket_of(start) != b || Histogram::bucket_of(Histogram::bucket_end(b) - 1) != b) tiled = false;
+            if (Histogram::bucket_end(b) - start > start / 4 + 1) tiled = false;
+        }
+        output << "tiled: " << tiled << " " << Histogram::bucket_end(Histogram::num_buckets - 1) << endl;
+        expected << "tiled: 1 " << (uint64_t(1) << 45) << endl;
+
+        Registry r;
+        r.counter("wordle_reset_total", "Reset.").add(9);
+        r.reset();
+        r.counter("wordle_solves_total", "Solves.", "solver=\"p\"").add(3);
+        r.counter("wordle_solves_total", "Solves.", "solver=\"c\"").add();
+        r.counter("wordle_solves_total", "Solves.", "solver=\"p\"").add(2);
+        std::thread([&] { r.counter("wordle_solves_total", "Solves.", "solver=\"p\"").add(); }).join();
+        r.gauge("wordle_in_flight", "In flight.").set(7);
+        r.gauge_fn("wordle_answer", "The answer.", [] { return 42.5; });
+        Histogram& h = r.histogram("wordle_solve_seconds", "Solve latency.", "solver=\"p\"");
+        for (uint64_t ns : {500ull, 1500ull, 1500ull, 3000000000ull}) h.record(ns);
+        output << "quantiles: " << h.quantile(0.5) << " " << h.quantile(1) << endl;
+        expected << "quantiles: 1536 " << Histogram::bucket_end(Histogram::bucket_of(3000000000ull)) << endl;
+        try {
+            r.gauge("wordle_solves_total", "Solves.");
+            output << "type clash: none" << endl;
+        } catch (const std::runtime_error&) {
+            output << "type clash: thrown" << endl;
+        }
+        expected << "type clash: thrown" << endl;
+
+        std::ostringstream text;
+        r.write_prometheus(text);
+        // everything but the histogram's middle buckets
+        std::istringstream lines(text.str());
+        string line;
+        while (std::getline(lines, line)) {
+            if (line.find("_bucket") == string::npos || line.find("le=\"1.024e-06\"") != string::npos ||
+                line.find("le=\"2.048e-06\"") != string::npos || line.find("le=\"+Inf\"") != string::npos) {
+                output << line << endl;
+            }
+        }
+        expected << "# HELP wordle_reset_total Reset." << endl
+                 << "# TYPE wordle_reset_total counter" << endl
+                 << "wordle_reset_total 0" << endl
+                 << "# HELP wordle_solves_total Solves." << endl
+                 << "# TYPE wordle_solves_total counter" << endl
+                 << "wordle_solves_total{solver=\"p\"} 6" << endl
+                 << "wordle_solves_total{solver=\"c\"} 1" << endl
+                 << "# HELP wordle_in_flight In flight." << endl
+                 << "# TYPE wordle_in_flight gauge" << endl
+                 << "wordle_in_flight 7" << endl
+                 << "# HELP wordle_answer The answer." << endl
+                 << "# TYPE wordle_answer gauge" << endl
+                 << "wordle_answer 42.5" << endl
+                 << "# HELP wordle_solve_seconds Solve latency." << endl
+                 << "# TYPE wordle_solve_seconds histogram" << endl
+                 << "wordle_solve_seconds_bucket{solver=\"p\",le=\"1.024e-06\"} 1" << endl
+                 << "wordle_solve_seconds_bucket{solver=\"p\",le=\"2.048e-06\"} 3" << endl
+                 << "wordle_solve_seconds_bucket{solver=\"p\",le=\"+Inf\"} 4" << endl
+                 << "wordle_solve_seconds_sum{solver=\"p\"} 3.0000035" << endl
+                 << "wordle_solve_seconds_count{solver=\"p\"} 4" << endl;
+
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Registry::test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
+
+    //////////////////
+    // Http_endpoint
+    Http_endpoint::Http_endpoint(Registry& r, uint16_t port_) : registry(r), port(port_), stopping(false) {
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) throw std::runtime_error(string("Couldn't create socket: ") + strerror(errno));
+        int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        socklen_t len = sizeof(addr);
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 16) < 0 ||
+            getsockname(listen_fd, reinterpret_cast<sockaddr*>(&addr), &len) < 0) {
+            int err = errno;
+            close(listen_fd);
+            throw std::runtime_error("Couldn't listen on port " + std::to_string(port) + ": " + strerror(err));
+        }
+        port = ntohs(addr.sin_port);
+    }
+
+    Http_endpoint::~Http_endpoint() {
+        stop();
+        close(listen_fd);
+    }
+
+    void Http_endpoint::run() {
+        while (!stopping) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                break;
+            }
+            serve(fd);
+            close(fd);
+        }
+    }
+
+    void Http_endpoint::stop() {
+        if (stopping.exchange(true)) return;
+        // wakes up accept
+        shutdown(listen_fd, SHUT_RDWR);
+    }
+
+    void Http_endpoint::serve(int fd) {
+        // a client that never finishes its request doesn't get to hold up the next one
+        timeval timeout = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        string request;
+        char chunk[1024];
+        while (request.find("\r\n\r\n") == string::npos && request.size() < 8192) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            request.append(chunk, n);
+        }
+
+        std::ostringstream body;
+        registry.write_prometheus(body);
+        string reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                       std::to_string(body.str().size()) + "\r\nConnection: close\r\n\r\n" + body.str();
+        size_t sent = 0;
+        while (sent < reply.size()) {
+            ssize_t n = send(fd, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            sent += n;
+        }
+    }
+
+    void Http_endpoint::test() {
+        std::stringstream output;
+        std::stringstream expected;
+
+        Registry r;
+        r.counter("wordle_requests_total", "Requests.").add(5);
+        Http_endpoint endpoint(r, 0);
+        std::thread server_thread([&] { endpoint.run(); });
+
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(endpoint.get_port());
+        string reply;
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+            string request = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+            send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+            char chunk[4096];
+            ssize_t n;
+            while ((n = recv(fd, chunk, sizeof(chunk), 0)) > 0) reply.append(chunk, n);
+        }
+        if (fd >= 0) close(fd);
+        endpoint.stop();
+        server_thread.join();
+
+        output << reply.substr(0, reply.find("\r\n")) << endl;
+        expected << "HTTP/1.0 200 OK" << endl;
+        output << reply.substr(reply.find("\r\n\r\n") + 4);
+        expected << "# HELP wordle_requests_total Requests." << endl
+                 << "# TYPE wordle_requests_total counter" << endl
+                 << "wordle_requests_total 5" << endl;
+
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Http_endpoint::test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
+}
@@ -0,0 +1,170 @@
+/* Process-wide counters, gauges and latency histograms for running the solver as a service, in
+   Prometheus' text format so the usual scraper can keep an eye on a server without anyone
+   asking it for {"stats": true}.
+
+   What's counted (everything is prefixed wordle_):
+     db_queries_total, db_hits_total   per objective, every query the solver makes
+     db_query_seconds                  a sample of those queries' latencies, see sample_start()
+     solves_total, solve_seconds       per solver (p, c, b), the public solve_* calls
+     solve_timeouts_total, solve_cancelled_total
+     requests_total, request_errors_total, request_seconds, requests_in_flight
+                                       the server's solve requests, per priority
+     singleflight_cache_entries        the results the servers' Singleflights hold
+   and process_resident_memory_bytes.
+
+   The hot paths only ever touch a metric they looked up once: a Counter is a few cache line
+   sized atomics so threads mostly add to their own, recording in a Histogram is two atomic adds
+   and it's only fed a sample of the db queries. The Registry's lock is just for registering a metric
+   and for writing them out.
+
+   Histograms are HDR style, four buckets per power of two of nanoseconds (so a value is known to
+   within 25%) from 1ns up to about ten hours. A scrape gets one "le" per power of two, which is
+   plenty to draw percentiles from.
+
+   wordle --serve --metrics-port <port> serves them on http://127.0.0.1:<port>/metrics (any path
+   really).
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <cstdint>
+
+namespace Metrics {
+    // now, in nanoseconds on the steady clock
+    uint64_t now_ns();
+
+    // For timing something on a hot path only now and then: now_ns() for one call in
+    // sample_interval on this thread, 0 for the rest. Histogram::record_since ignores the 0s.
+    static const int sample_interval = 16;
+    uint64_t sample_start();
+
+    class Counter {
+    public:
+        Counter();
+        void add(uint64_t n = 1) { slots[slot()].n.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t value() const;
+        void reset();
+    private:
+        static const int num_slots = 8;
+        struct alignas(64) Slot {
+            std::atomic<uint64_t> n;
+        };
+        // this thread's slot
+        static int slot();
+        Slot slots[num_slots];
+    };
+
+    class Gauge {
+    public:
+        Gauge() : v(0) {}
+        void set(int64_t x) { v.store(x, std::memory_order_relaxed); }
+        void add(int64_t x) { v.fetch_add(x, std::memory_order_relaxed); }
+        int64_t value() const { return v.load(std::memory_order_relaxed); }
+    private:
+        std::atomic<int64_t> v;
+    };
+
+    class Histogram {
+    public:
+        static const int sub_bucket_bits = 2;
+        static const int num_buckets = 176; // up to 2^45ns, a bit under 10 hours
+
+        Histogram();
+        void record(uint64_t ns);
+        // records now_ns() - [start], unless [start] is 0 (see sample_start)
+        void record_since(uint64_t start) {
+            if (start) record(now_ns() - start);
+        }
+
+        uint64_t count() const;
+        uint64_t sum_ns() const { return sum.load(std::memory_order_relaxed); }
+        // the upper end of the bucket holding the [q] quantile, 0 if there's nothing yet
+        uint64_t quantile(double q) const;
+
+        static int bucket_of(uint64_t ns);
+        // the smallest value above bucket [b]
+        static uint64_t bucket_end(int b);
+        uint64_t bucket_count(int b) const { return buckets[b].load(std::memory_order_relaxed); }
+        void reset();
+    private:
+        std::atomic<uint64_t> buckets[num_buckets];
+        std::atomic<uint64_t> sum;
+    };
+
+    class Registry {
+    public:
+        // Each returns the metric called [name] with [labels] (the inside of Prometheus' {...},
+        // e.g. "solver=\"p\"", or empty), making it the first time. The metric lives as long as
+        // the Registry. Throws if [name] is already a different type of metric.
+        Counter& counter(const std::string& name, const std::string& help, const std::string& labels = "");
+        Gauge& gauge(const std::string& name, const std::string& help, const std::string& labels = "");
+        Histogram& histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+        // a gauge that's whatever [f] says when we're scraped
+        void gauge_fn(const std::string& name, const std::string& help, const std::function<double()>& f);
+
+        // Prometheus text exposition format (version 0.0.4), in the order things were registered
+        void write_prometheus(std::ostream& os);
+
+        // Zeroes the counters and histograms, e.g. once wordle's self-tests have counted into
+        // them. Not while anyone's scraping, counters aren't meant to go down. Gauges are left
+        // alone, they go back down by themselves.
+        void reset();
+
+        static void test();
+    private:
+        enum class Type { counter, gauge, histogram };
+        struct Series {
+            std::string labels;
+            std::unique_ptr<Counter> counter;
+            std::unique_ptr<Gauge> gauge;
+            std::unique_ptr<Histogram> histogram;
+            std::function<double()> fn;
+        };
+        struct Family {
+            std::string name;
+            std::string help;
+            Type type;
+            std::vector<Series> series;
+        };
+        Series& series(const std::string& name, const std::string& help, Type type, const std::string& labels);
+
+        // guarded by mutex
+        std::mutex mutex;
+        std::vector<Family> families;
+    };
+
+    // the process-wide one everything counts into
+    Registry& registry();
+
+    // Answers every HTTP request on 127.0.0.1:[port] with [r]'s write_prometheus. One at a time,
+    // a scrape is quick.
+    class Http_endpoint {
+    public:
+        // Listens straight away, [port] 0 for any free one
+        Http_endpoint(Registry& r, uint16_t port);
+        ~Http_endpoint();
+        Http_endpoint(const Http_endpoint&) = delete;
+        Http_endpoint& operator=(const Http_endpoint&) = delete;
+
+        uint16_t get_port() const { return port; }
+        // serves until stop()
+        void run();
+        // safe to call from any thread
+        void stop();
+
+        static void test();
+    private:
+        void serve(int fd);
+
+        Registry& registry;
+        uint16_t port;
+        int listen_fd;
+        std::atomic<bool> stopping;
+    };
+}
@@ -0,0 +1,94 @@
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf_counters.hpp"
+
+using std::endl;
+
+namespace Solver {
+    const char* Perf_counters::event_name(int e) {
+        static const char* names[num_events] = {"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"};
+        return names[e];
+    }
+
+    static perf_event_attr attr_for(int e) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        switch (e) {
+        case Perf_counters::cycles:        attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+        case Perf_counters::instructions:  attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+        case Perf_counters::llc_misses:    attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+        case Perf_counters::branch_misses: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+        case Perf_counters::l1d_misses:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        }
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return attr;
+    }
+
+    Perf_counters::Perf_counters() : group_fd(-1), num_open(0) {
+        for (int e = 0; e < num_events; e++) {
+            perf_event_attr attr = attr_for(e);
+            // the group starts disabled and its members follow it
+            attr.disabled = group_fd < 0;
+            fds[e] = syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+            position[e] = fds[e] >= 0 ? num_open++ : -1;
+            if (fds[e] >= 0 && group_fd < 0) group_fd = fds[e];
+        }
+        if (group_fd >= 0) {
+            ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+
+    Perf_counters::~Perf_counters() {
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+    }
+
+    void Perf_counters::read(uint64_t (&out)[num_events]) const {
+        // PERF_FORMAT_GROUP: the number of events, then each value in the order they joined
+        uint64_t buffer[1 + num_events] = {0};
+        if (group_fd < 0 || ::read(group_fd, buffer, sizeof(buffer)) < ssize_t(sizeof(uint64_t) * (1 + num_open))) {
+            for (uint64_t& o : out) o = 0;
+            return;
+        }
+        for (int e = 0; e < num_events; e++) out[e] = position[e] >= 0 ? buffer[1 + position[e]] : 0;
+    }
+
+    void Perf_counters::test() {
+        std::stringstream output;
+        std::stringstream expected;
+
+        // whatever's open has to count forwards, and what isn't has to stay 0
+        Perf_counters counters;
+        uint64_t before[num_events], after[num_events];
+        counters.read(before);
+        volatile uint64_t sum = 0;
+        for (int i = 0; i < 100000; i++) sum = sum + i;
+        counters.read(after);
+        bool sane = true;
+        for (int e = 0; e < num_events; e++) {
+            if (!counters.is_open(e) && (before[e] || after[e])) sane = false;
+            if (after[e] < before[e]) sane = false;
+        }
+        if (counters.is_open(instructions) && after[instructions] - before[instructions] < 100000) sane = false;
+        output << "sane: " << sane << endl;
+        expected << "sane: 1" << endl;
+
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Perf_counters::test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
+}
@@ -0,0 +1,41 @@
+/* The CPU's own counters (cycles, instructions, cache and branch misses) for the calling thread,
+   through perf_event_open(2), so Solve_stats can say which phase of the search is missing cache
+   rather than just how long it took.
+
+   Only what the kernel lets us have: a high kernel.perf_event_paranoid, a container's seccomp
+   policy or a VM without a PMU can each leave some or all of the events closed. Those read as 0
+   and is_open() says which they are, nothing else changes.
+
+   The open events are one perf group, so read() is one syscall that gets them all at the same
+   moment. That's still a syscall, so only wrap things that take a while.
+*/
+
+#pragma once
+#include <cstdint>
+
+namespace Solver {
+    class Perf_counters {
+    public:
+        enum Event { cycles, instructions, l1d_misses, llc_misses, branch_misses };
+        static const int num_events = 5;
+        static const char* event_name(int e);
+
+        // Starts counting for the calling thread (and only it) in user space
+        Perf_counters();
+        ~Perf_counters();
+        Perf_counters(const Perf_counters&) = delete;
+        Perf_counters& operator=(const Perf_counters&) = delete;
+
+        bool is_open(int e) const { return position[e] >= 0; }
+        bool any_open() const { return group_fd >= 0; }
+        // the counts since we started, 0 for the events that aren't open
+        void read(uint64_t (&out)[num_events]) const;
+
+        static void test();
+    private:
+        int group_fd; // the first event that opened, -1 if none did
+        int fds[num_events];
+        int position[num_events]; // in the group's read, -1 if not open
+        int num_open;
+    };
+}
@@ -0,0 +1,228 @@
+#include <iostream>
+#include <sstream>
+#include <future>
+#include <algorithm>
+#include "scheduler.hpp"
+
+using std::vector;
+using std::cerr;
+using std::endl;
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+
+namespace Server {
+    const char* priority_name(Priority p) {
+        return p == Priority::interactive ? "interactive" : "background";
+    }
+
+    bool Scheduler::Task::operator<(const Task& t) const {
+        if (deadline != t.deadline) return deadline > t.deadline;
+        return seq > t.seq;
+    }
+
+    Scheduler::Scheduler(unsigned int num_threads_) :
+        num_threads(std::max(num_threads_, 1u)),
+        background_yield(*this),
+        next_seq(0),
+        background_running(0),
+        paused(0),
+        stopping(false),
+        interactive_in_system(0)
+    {
+        for (Class_stats& s : stats) s = Class_stats({0, 0, 0, 0, 0, 0});
+        for (unsigned int i = 0; i < num_threads; i++) {
+            workers.emplace_back(&Scheduler::worker_main, this, Priority::interactive);
+            workers.emplace_back(&Scheduler::worker_main, this, Priority::background);
+        }
+    }
+
+    Scheduler::~Scheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_wakeup.notify_all();
+        background_wakeup.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+
+    void Scheduler::submit(Priority p, ptime deadline, std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Task t = { std::move(task), deadline, microsec_clock::local_time(), next_seq++ };
+            if (p == Priority::interactive) {
+                interactive_queue.push(std::move(t));
+                interactive_in_system++;
+            } else {
+                background_queue.push_back(std::move(t));
+            }
+            stats[static_cast<int>(p)].queued++;
+        }
+        work_wakeup.notify_all();
+    }
+
+    bool Scheduler::background_may_run_locked() const {
+        uint64_t taken = std::min<uint64_t>(interactive_in_system, num_threads);
+        return background_running < num_threads - taken;
+    }
+
+    void Scheduler::Background_yield::at_node() {
+        if (scheduler.interactive_in_system.load(std::memory_order_relaxed) == 0) return;
+        std::unique_lock<std::mutex> lock(scheduler.mutex);
+        // we're counted in background_running, so give way if we're over our share
+        scheduler.background_running--;
+        if (scheduler.background_may_run_locked() || scheduler.stopping) {
+            scheduler.background_running++;
+            return;
+        }
+        scheduler.paused++;
+        scheduler.background_wakeup.wait(lock, [this] { return scheduler.stopping || scheduler.background_may_run_locked(); });
+        scheduler.paused--;
+        scheduler.background_running++;
+    }
+
+    void Scheduler::worker_main(Priority p) {
+        bool interactive = p == Priority::interactive;
+        Class_stats& s = stats[static_cast<int>(p)];
+        if (!interactive) Solver::set_yield_hook(&background_yield);
+        while (true) {
+            Task t;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (interactive) {
+                    work_wakeup.wait(lock, [this] { return stopping || !interactive_queue.empty(); });
+                    if (stopping) return;
+                    t = interactive_queue.top();
+                    interactive_queue.pop();
+                } else {
+                    work_wakeup.wait(lock, [this] { return stopping || (!background_queue.empty() && background_may_run_locked()); });
+                    if (stopping) return;
+                    t = std::move(background_queue.front());
+                    background_queue.pop_front();
+                    background_running++;
+                }
+                s.queued--;
+                s.running++;
+            }
+
+            ptime started = microsec_clock::local_time();
+            try {
+                t.run();
+            } catch (const std::exception& e) {
+                cerr << "Scheduler: " << priority_name(p) << " task threw: " << e.what() << endl;
+            }
+            ptime finished = microsec_clock::local_time();
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                s.running--;
+                s.completed++;
+                s.total_wait_us += (started - t.submitted).total_microseconds();
+                double latency_us = (finished - t.submitted).total_microseconds();
+                s.total_latency_us += latency_us;
+                s.max_latency_us = std::max(s.max_latency_us, latency_us);
+                if (interactive) {
+                    interactive_in_system--;
+                } else {
+                    background_running--;
+                }
+            }
+            // either way there's a slot free for a background task
+            background_wakeup.notify_all();
+            work_wakeup.notify_all();
+        }
+    }
+
+    Scheduler::Class_stats Scheduler::get_stats(Priority p) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats[static_cast<int>(p)];
+    }
+
+    uint64_t Scheduler::num_paused() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return paused;
+    }
+
+    void Scheduler::test() {
+        std::stringstream output;
+        std::stringstream expected;
+        ptime now = microsec_clock::local_time();
+
+        // interactive tasks run earliest deadline first
+        {
+            Scheduler scheduler(1);
+            std::promise<void> release;
+            std::shared_future<void> released = release.get_future().share();
+            std::promise<void> blocker_started;
+            scheduler.submit(Priority::interactive, now, [&] { blocker_started.set_value(); released.wait(); });
+            blocker_started.get_future().wait();
+
+            std::mutex order_mutex;
+            vector<int> order;
+            vector<std::promise<void>> done(3);
+            for (int i : {3, 1, 2}) {
+                scheduler.submit(Priority::interactive, now + boost::posix_time::seconds(i), [&, i] {
+                    std::lock_guard<std::mutex> lock(order_mutex);
+                    order.push_back(i);
+                    done[i - 1].set_value();
+                });
+            }
+            output << "queued: " << scheduler.get_stats(Priority::interactive).queued << endl;
+            expected << "queued: 3" << endl;
+            release.set_value();
+            for (std::promise<void>& d : done) d.get_future().wait();
+            output << "order:";
+            for (int i : order) output << " " << i;
+            output << endl;
+            expected << "order: 1 2 3" << endl;
+        }
+
+        // a background task pauses at its next node while an interactive one runs
+        {
+            Scheduler scheduler(1);
+            std::atomic<bool> interactive_running(false);
+            std::atomic<bool> stop_background(false);
+            int overlapping_nodes = 0;
+            std::promise<void> background_started, background_done, interactive_done;
+            scheduler.submit(Priority::background, boost::posix_time::pos_infin, [&] {
+                background_started.set_value();
+                while (!stop_background) {
+                    scheduler.background_yield.at_node();
+                    if (interactive_running) overlapping_nodes++;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+                background_done.set_value();
+            });
+            background_started.get_future().wait();
+            uint64_t paused_during = 0;
+            scheduler.submit(Priority::interactive, now, [&] {
+                interactive_running = true;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                paused_during = scheduler.num_paused();
+                interactive_running = false;
+                interactive_done.set_value();
+            });
+            interactive_done.get_future().wait();
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            stop_background = true;
+            background_done.get_future().wait();
+            // the background task can be in the middle of one node when the interactive one starts
+            output << "paused: " << paused_during << " " << (overlapping_nodes <= 1) << endl;
+            expected << "paused: 1 1" << endl;
+
+            // wait for the workers to finish their bookkeeping
+            while (scheduler.get_stats(Priority::background).running > 0 || scheduler.get_stats(Priority::interactive).running > 0) {
+                std::this_thread::yield();
+            }
+            Class_stats interactive = scheduler.get_stats(Priority::interactive);
+            Class_stats background = scheduler.get_stats(Priority::background);
+            output << "stats: " << interactive.completed << " " << background.completed << " "
+                   << (interactive.max_latency_us >= 50000) << " " << (interactive.total_latency_us >= interactive.total_wait_us) << endl;
+            expected << "stats: 1 1 1 1" << endl;
+        }
+
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Scheduler::test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
+}
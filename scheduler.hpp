@@ -0,0 +1,102 @@
+/* Runs the daemon's work in two classes, so the same box can answer the website and chew through
+   precompute at once.
+
+   interactive: latency matters. Run earliest deadline first on their own pool of threads.
+   background:  throughput matters. Run in submission order on a second pool.
+
+   Both pools have [num_threads] threads, but only [num_threads] tasks are meant to be running at
+   once: every interactive task that's queued or running takes a slot away from the background
+   tasks. A background task notices at its next solve_p or solve_b node (see Solver::Yield_hook) and waits
+   there until a slot is free again, so an interactive request never sits behind a multi-minute
+   subtree, only behind one node of it.
+
+   A background task that's paused still holds whatever it was solving, so anything that waits on
+   another task's result (Singleflight) mustn't make an interactive task wait on a background one.
+*/
+
+#pragma once
+#include <vector>
+#include <queue>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+#include <cstdint>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "solver.hpp"
+
+namespace Server {
+    enum class Priority { interactive = 0, background = 1 };
+    static const int num_priorities = 2;
+    const char* priority_name(Priority p);
+
+    class Scheduler {
+    public:
+        Scheduler(unsigned int num_threads);
+        // drops whatever's still queued and waits for the running tasks
+        ~Scheduler();
+        Scheduler(const Scheduler&) = delete;
+        Scheduler& operator=(const Scheduler&) = delete;
+
+        // Runs [task] on one of [p]'s threads. Interactive tasks with earlier deadlines go first
+        // ([deadline] only orders them, it's up to [task] to give up once it's passed).
+        void submit(Priority p, boost::posix_time::ptime deadline, std::function<void()> task);
+
+        struct Class_stats {
+            uint64_t queued;    // right now
+            uint64_t running;   // right now, background tasks that are paused included
+            uint64_t completed;
+            double total_wait_us;    // submitted -> started, over completed tasks
+            double total_latency_us; // submitted -> finished, over completed tasks
+            double max_latency_us;
+        };
+        Class_stats get_stats(Priority p);
+        // background tasks paused at a node right now
+        uint64_t num_paused();
+
+        static void test();
+    private:
+        struct Task {
+            std::function<void()> run;
+            boost::posix_time::ptime deadline;
+            boost::posix_time::ptime submitted;
+            uint64_t seq; // ties go to whoever came first
+            // for the priority_queue, so the top is the earliest deadline
+            bool operator<(const Task& t) const;
+        };
+
+        // what background threads have as their Solver::Yield_hook
+        class Background_yield : public Solver::Yield_hook {
+        public:
+            Background_yield(Scheduler& scheduler) : scheduler(scheduler) {}
+            virtual void at_node();
+        private:
+            Scheduler& scheduler;
+        };
+
+        void worker_main(Priority p);
+        // background slots left over by the interactive tasks, with [mutex] held
+        bool background_may_run_locked() const;
+
+        unsigned int num_threads;
+        Background_yield background_yield;
+        std::vector<std::thread> workers;
+
+        // guarded by mutex
+        std::mutex mutex;
+        std::condition_variable work_wakeup;       // something was queued, or we're stopping
+        std::condition_variable background_wakeup; // interactive work went away
+        std::priority_queue<Task> interactive_queue;
+        std::deque<Task> background_queue;
+        uint64_t next_seq;
+        uint64_t background_running; // not counting the paused ones
+        uint64_t paused;
+        Class_stats stats[num_priorities];
+        bool stopping;
+        // interactive queued + running, readable without the lock so at_node is one load when
+        // there's nothing to yield to
+        std::atomic<uint64_t> interactive_in_system;
+    };
+}
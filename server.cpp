@@ -0,0 +1,707 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+// property_tree still includes the old boost/bind.hpp, which complains otherwise
+#define BOOST_BIND_GLOBAL_PLACEHOLDERS
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include "server.hpp"
+#include "result.hpp"
+#include "solver.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+using std::string;
+using std::vector;
+using std::cerr;
+using std::endl;
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+using Solver::SolveResult;
+using Solver::Bound;
+typedef Dictionary::WordIndex WordIndex;
+
+namespace Server {
+    Request::Request() :
+        has_guess(false),
+        objective(0),
+        cutoff(999),
+        deadline(boost::posix_time::pos_infin),
+        anytime(false),
+        priority(Priority::interactive),
+        stats(false) {}
+
+    Request Request::of_json(const string& line) {
+        boost::property_tree::ptree pt;
+        std::istringstream is(line);
+        boost::property_tree::read_json(is, pt);
+
+        Request r;
+        if (boost::optional<string> mask = pt.get_optional<string>("mask")) {
+            if (mask->length() != CMask::num_hex_chars) throw std::runtime_error("Bad mask: " + *mask);
+            r.m = CMask::of_hex(*mask);
+        }
+        if (boost::optional<boost::property_tree::ptree&> results = pt.get_child_optional("results")) {
+            for (const auto& kv : *results) {
+                r.m.apply(CMask(Result(kv.second.data())));
+            }
+        }
+        if (boost::optional<string> guess = pt.get_optional<string>("guess")) {
+            r.has_guess = true;
+            r.guess = Dictionary::to_word_index(Word(*guess));
+        }
+        r.objective = pt.get<int>("objective", 0);
+        if (r.objective < static_cast<int>(Objective::adversarial) || r.objective > static_cast<int>(Objective::pwin5)) {
+            throw std::runtime_error("Bad objective: " + std::to_string(r.objective));
+        }
+        r.cutoff = pt.get<float>("cutoff", 999);
+        double timeout_ms = pt.get<double>("timeout_ms", 0);
+        if (timeout_ms > 0) {
+            // the solver checks against local time
+            r.deadline = microsec_clock::local_time() + boost::posix_time::microseconds(static_cast<int64_t>(timeout_ms * 1000));
+        }
+        r.anytime = pt.get<bool>("anytime", false);
+        string priority = pt.get<string>("priority", priority_name(Priority::interactive));
+        if (priority == priority_name(Priority::background)) {
+            r.priority = Priority::background;
+        } else if (priority != priority_name(Priority::interactive)) {
+            throw std::runtime_error("Bad priority: " + priority);
+        }
+        r.stats = pt.get<bool>("stats", false);
+        return r;
+    }
+
+    float Request::flight_cutoff() const {
+        return objective > 0 ? std::numeric_limits<float>::infinity() : cutoff;
+    }
+
+    static const char* bound_name(Bound b) {
+        switch (b) {
+        case Bound::lower: return "lower";
+        case Bound::upper: return "upper";
+        default: return "exact";
+        }
+    }
+
+    // every Singleflight's cache together
+    static Metrics::Gauge& cache_entries() {
+        static Metrics::Gauge& g = Metrics::registry().gauge("wordle_singleflight_cache_entries", "Results held in the servers' in-memory caches.");
+        return g;
+    }
+
+    Singleflight::Singleflight(size_t max_cached_) : max_cached(max_cached_), stats({0, 0, 0}) {}
+
+    Singleflight::~Singleflight() {
+        cache_entries().add(-static_cast<int64_t>(cache.size()));
+    }
+
+    SolveResult Singleflight::run(const Job& j, float score_cutoff, Priority priority, ptime timeout, const Solver::Cancel_token* cancel,
+                                  const std::function<SolveResult()>& solve) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            auto cached = cache.find(j);
+            if (cached != cache.end() && cached->second.good_for(score_cutoff)) {
+                stats.cache_hits++;
+                return cached->second;
+            }
+            auto flight = in_flight.find(j);
+            if (flight == in_flight.end()) break;
+            if (priority == Priority::interactive && flight->second->priority == Priority::background) {
+                // solve it alongside without taking over the flight, see the header
+                stats.solved++;
+                lock.unlock();
+                SolveResult result = solve();
+                lock.lock();
+                publish_locked(j, result);
+                return result;
+            }
+
+            std::shared_ptr<Flight> f = flight->second;
+            while (!f->done) {
+                // nothing wakes us on a cancel, so look every cancel_check_ms
+                if (cancel && cancel->is_cancelled()) throw Solver::Cancelled();
+                if (timeout.is_pos_infinity() && !cancel) {
+                    flight_done.wait(lock);
+                } else {
+                    int64_t us = cancel ? cancel_check_ms * 1000 : std::numeric_limits<int64_t>::max();
+                    if (!timeout.is_pos_infinity()) {
+                        int64_t left = (timeout - microsec_clock::local_time()).total_microseconds();
+                        if (left <= 0) throw Solver::Timeout();
+                        us = std::min(us, left);
+                    }
+                    flight_done.wait_for(lock, std::chrono::microseconds(us));
+                }
+            }
+            if (!f->failed && f->result.good_for(score_cutoff)) {
+                stats.joined++;
+                return f->result;
+            }
+            // it failed (e.g. its own timeout) or was cut off too early for us, so go again
+        }
+
+        std::shared_ptr<Flight> f = std::make_shared<Flight>(priority);
+        in_flight[j] = f;
+        stats.solved++;
+        lock.unlock();
+        SolveResult result;
+        try {
+            result = solve();
+        } catch (...) {
+            lock.lock();
+            f->done = f->failed = true;
+            in_flight.erase(j);
+            flight_done.notify_all();
+            throw;
+        }
+        lock.lock();
+        f->done = true;
+        f->result = result;
+        in_flight.erase(j);
+        publish_locked(j, result);
+        flight_done.notify_all();
+        return result;
+    }
+
+    void Singleflight::publish_locked(const Job& j, const SolveResult& result) {
+        if (max_cached == 0) return;
+        auto it = cache.find(j);
+        if (it != cache.end()) {
+            if (result.get_bound() == Bound::exact || it->second.get_bound() != Bound::exact) it->second = result;
+            return;
+        }
+        if (cache.size() >= max_cached) {
+            cache.erase(cache_order.front());
+            cache_order.pop_front();
+            cache_entries().add(-1);
+        }
+        cache[j] = result;
+        cache_order.push_back(j);
+        cache_entries().add(1);
+    }
+
+    Singleflight::Stats Singleflight::get_stats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    void Singleflight::test() {
+        std::stringstream output;
+        std::stringstream expected;
+        Singleflight flights(2);
+        CMask m;
+        Job j1(CMask(m).apply(CMask(Result("CRANE _____"))), Job::no_guess, Objective::adversarial);
+        Job j2(CMask(m).apply(CMask(Result("SOARE _____"))), Job::no_guess, Objective::adversarial);
+        Job j3(CMask(m).apply(CMask(Result("ROATE _____"))), Job::no_guess, Objective::adversarial);
+        auto result = [] (float score, Solver::Bound bound) {
+            SolveResult rv;
+            rv.best_score = score;
+            rv.set_bound(bound);
+            return rv;
+        };
+
+        // the second request turns up while the first is still solving and gets its result
+        std::atomic<int> num_solves(0);
+        auto slow_solve = [&] () {
+            num_solves++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            return result(5, Bound::exact);
+        };
+        SolveResult first, second;
+        std::thread t1([&] { first = flights.run(j1, 999, Priority::interactive, boost::posix_time::pos_infin, nullptr, slow_solve); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        std::thread t2([&] { second = flights.run(j1, 999, Priority::interactive, boost::posix_time::pos_infin, nullptr, slow_solve); });
+        t1.join();
+        t2.join();
+        output << "joined: " << num_solves << " " << first.best_score << " " << second.best_score << endl;
+        expected << "joined: 1 5 5" << endl;
+
+        // and the one after that is a cache hit
+        auto fail = [] () -> SolveResult { throw std::runtime_error("shouldn't solve"); };
+        output << "cached: " << flights.run(j1, 999, Priority::interactive, boost::posix_time::pos_infin, nullptr, fail).best_score << endl;
+        expected << "cached: 5" << endl;
+
+        // a lower bound only does for cutoffs it's already at, and an exact result replaces it
+        flights.run(j2, 3, Priority::interactive, boost::posix_time::pos_infin, nullptr, [&] { return result(3, Bound::lower); });
+        output << "bound: " << flights.run(j2, 3, Priority::interactive, boost::posix_time::pos_infin, nullptr, fail).best_score << " ";
+        output << flights.run(j2, 999, Priority::interactive, boost::posix_time::pos_infin, nullptr, [&] { return result(4, Bound::exact); }).best_score << " ";
+        output << flights.run(j2, 2, Priority::interactive, boost::posix_time::pos_infin, nullptr, fail).best_score << endl;
+        expected << "bound: 3 4 4" << endl;
+
+        // the oldest result goes once the cache is full
+        flights.run(j3, 999, Priority::interactive, boost::posix_time::pos_infin, nullptr, [&] { return result(6, Bound::exact); });
+        output << "evicted: " << flights.run(j1, 999, Priority::interactive, boost::posix_time::pos_infin, nullptr, [&] { return result(7, Bound::exact); }).best_score << endl;
+        expected << "evicted: 7" << endl;
+
+        // a failed solve isn't cached
+        try {
+            flights.run(j3, 999, Priority::interactive, boost::posix_time::pos_infin, nullptr, fail);
+            flights.run(Job(m, Job::no_guess, Objective::adversarial), 999, Priority::interactive, boost::posix_time::pos_infin, nullptr, fail);
+        } catch (const std::exception& e) {
+            output << "failed: " << e.what() << endl;
+        }
+        expected << "failed: shouldn't solve" << endl;
+
+        // an interactive request doesn't wait behind a background solve of the same Job
+        {
+            Singleflight mixed(2);
+            std::promise<void> release;
+            std::shared_future<void> released = release.get_future().share();
+            std::promise<void> background_started;
+            std::thread background([&] {
+                mixed.run(j1, 999, Priority::background, boost::posix_time::pos_infin, nullptr, [&] {
+                    background_started.set_value();
+                    released.wait();
+                    return result(5, Bound::exact);
+                });
+            });
+            background_started.get_future().wait();
+            output << "interactive: " << mixed.run(j1, 999, Priority::interactive, boost::posix_time::pos_infin, nullptr, [&] { return result(4, Bound::exact); }).best_score << endl;
+            expected << "interactive: 4" << endl;
+            release.set_value();
+            background.join();
+        }
+
+        // someone waiting on a flight stops waiting once their request is cancelled
+        {
+            Singleflight waiting(2);
+            std::promise<void> release;
+            std::shared_future<void> released = release.get_future().share();
+            std::promise<void> started;
+            std::thread solving([&] {
+                waiting.run(j1, 999, Priority::interactive, boost::posix_time::pos_infin, nullptr, [&] {
+                    started.set_value();
+                    released.wait();
+                    return result(5, Bound::exact);
+                });
+            });
+            started.get_future().wait();
+            Solver::Cancel_token cancel;
+            cancel.cancel();
+            try {
+                waiting.run(j1, 999, Priority::interactive, boost::posix_time::pos_infin, &cancel, fail);
+                output << "waiter: not cancelled" << endl;
+            } catch (const Solver::Cancelled& e) {
+                output << "waiter: " << e.what() << endl;
+            }
+            expected << "waiter: cancelled" << endl;
+            release.set_value();
+            solving.join();
+        }
+
+        // an anytime pwin result isn't enough for the next request, which has no deadline
+        {
+            Singleflight pwin(2);
+            Job j(j1.get_mask(), Job::no_guess, Objective::pwin3);
+            Request hurried = Request::of_json("{\"objective\": 3, \"timeout_ms\": 200, \"anytime\": true}");
+            Request patient = Request::of_json("{\"objective\": 3}");
+            pwin.run(j, hurried.flight_cutoff(), Priority::interactive, hurried.deadline, nullptr, [&] { return result(0.5, Bound::lower); });
+            output << "pwin: " << pwin.run(j, patient.flight_cutoff(), Priority::interactive, patient.deadline, nullptr, [&] { return result(0.75, Bound::exact); }).best_score << " ";
+            output << pwin.run(j, patient.flight_cutoff(), Priority::interactive, patient.deadline, nullptr, fail).best_score << endl;
+            expected << "pwin: 0.75 0.75" << endl;
+        }
+
+        Stats stats = flights.get_stats();
+        output << "stats: " << stats.cache_hits << " " << stats.joined << " " << stats.solved << endl;
+        expected << "stats: 4 1 6" << endl;
+
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Singleflight::test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
+
+    static string error_reply(const string& what) {
+        return "{\"error\": " + Solver::Tracer::quote(what) + "}";
+    }
+
+    string answer(Db::Db_intf* db, const Request& r, Singleflight* flights, const Solver::Cancel_token* cancel) {
+        const vector<WordIndex>& answers = Dictionary::get_all_answers();
+        const vector<WordIndex>& guesses = Dictionary::get_all_answers_and_guesses();
+        try {
+            auto solve = [&] () {
+                if (r.objective > 0) {
+                    return Solver::solve_b(db, answers, guesses, r.m, r.objective, 0, false, true, r.deadline, r.anytime, cancel);
+                } else if (r.has_guess) {
+                    return Solver::solve_c(db, Solver::valid_list(r.m, answers), guesses, r.m, r.guess, r.cutoff, false, true, nullptr, r.deadline, r.anytime, cancel);
+                } else {
+                    return Solver::solve_p(db, answers, guesses, r.m, r.cutoff, false, true, r.deadline, r.anytime, cancel);
+                }
+            };
+            SolveResult g;
+            if (flights) {
+                Job j(r.m,
+                      r.has_guess && r.objective == 0 ? r.guess.compact() : Job::no_guess,
+                      r.objective > 0 ? static_cast<Objective>(r.objective) : Objective::adversarial);
+                g = flights->run(j, r.flight_cutoff(), r.priority, r.deadline, cancel, solve);
+            } else {
+                g = solve();
+            }
+
+            std::ostringstream os;
+            os << "{\"mask\": " << Solver::Tracer::quote(r.m.to_hex())
+               << ", \"best_score\": " << g.best_score
+               << ", \"bound\": " << Solver::Tracer::quote(bound_name(g.get_bound()))
+               << ", \"best_guess\": \"" << Word(g.best_guess) << "\""
+               << ", \"worst_answer\": \"" << Word(g.worst_answer) << "\""
+               << ", \"perf_calls\": " << g.perf_calls
+               << ", \"perf_seconds\": " << g.get_perf_microseconds() / 1e6 << "}";
+            return os.str();
+        } catch (const std::exception& e) {
+            return error_reply(e.what());
+        }
+    }
+
+    string handle(Db::Db_intf* db, const string& line, Singleflight* flights) {
+        try {
+            return answer(db, Request::of_json(line), flights);
+        } catch (const std::exception& e) {
+            return error_reply(e.what());
+        }
+    }
+
+    Socket_server::Socket_server(Db::Db_intf& db_, const string& socket_path_, unsigned int num_threads) :
+        db(db_),
+        flights(100000),
+        socket_path(socket_path_),
+        listen_fd(-1),
+        next_solve_id(0),
+        stopping(false),
+        scheduler(num_threads)
+    {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("Socket path too long: " + socket_path);
+        }
+        strcpy(addr.sun_path, socket_path.c_str());
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) throw std::runtime_error(string("Couldn't create socket: ") + strerror(errno));
+        // left over from a server that didn't shut down cleanly
+        unlink(socket_path.c_str());
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+            int err = errno;
+            close(listen_fd);
+            throw std::runtime_error("Couldn't listen on " + socket_path + ": " + strerror(err));
+        }
+    }
+
+    Socket_server::~Socket_server() {
+        stop();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            connections_closed.wait(lock, [this] { return active.empty(); });
+        }
+        close(listen_fd);
+        unlink(socket_path.c_str());
+    }
+
+    void Socket_server::run() {
+        if (!Db::silence) cerr << "Serving on " << socket_path << endl;
+
+        while (true) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            int err = errno;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) {
+                if (fd >= 0) close(fd);
+                break;
+            }
+            if (fd < 0) {
+                if (err == EINTR || err == ECONNABORTED) continue;
+                cerr << "Server: accept failed on " << socket_path << ": " << strerror(err) << endl;
+                break;
+            }
+            // detached, we count them out again in [active] instead
+            std::shared_ptr<Solver::Cancel_token> cancel = std::make_shared<Solver::Cancel_token>();
+            active[fd] = cancel;
+            std::thread(&Socket_server::connection_main, this, fd, cancel).detach();
+        }
+
+        stop();
+        std::unique_lock<std::mutex> lock(mutex);
+        connections_closed.wait(lock, [this] { return active.empty(); });
+    }
+
+    void Socket_server::stop() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) return;
+        stopping = true;
+        // wakes up accept, and any connection waiting on its client
+        shutdown(listen_fd, SHUT_RDWR);
+        for (const auto& connection : active) {
+            shutdown(connection.first, SHUT_RDWR);
+            // and stops its solves, so it isn't stuck waiting for them
+            connection.second->cancel();
+        }
+    }
+
+    void Socket_server::connection_main(int fd, std::shared_ptr<Solver::Cancel_token> cancel) {
+        serve_connection(fd, cancel);
+        // nobody's left to send the replies to, so stop whatever's still queued or running
+        cancel->cancel();
+        // stop() only shuts down fds in [active], so it can't hit one we've closed
+        std::lock_guard<std::mutex> lock(mutex);
+        active.erase(fd);
+        close(fd);
+        connections_closed.notify_all();
+    }
+
+    static bool send_all(int fd, const string& s) {
+        size_t sent = 0;
+        while (sent < s.size()) {
+            ssize_t n = send(fd, s.data() + sent, s.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    // what the process-wide metrics (see metrics.hpp) count for the requests
+    struct Request_metrics {
+        struct Class {
+            Metrics::Counter* requests;
+            Metrics::Counter* errors;
+            Metrics::Histogram* latency; // from when it was read to its reply
+        };
+        Request_metrics() {
+            Metrics::Registry& r = Metrics::registry();
+            for (Priority p : {Priority::interactive, Priority::background}) {
+                string labels = string("priority=\"") + priority_name(p) + "\"";
+                Class& c = p == Priority::interactive ? interactive : background;
+                c.requests = &r.counter("wordle_requests_total", "Solve requests read.", labels);
+                c.errors = &r.counter("wordle_request_errors_total", "Solve requests answered with an error.", labels);
+                c.latency = &r.histogram("wordle_request_seconds", "Solve request latency, queueing included.", labels);
+            }
+            bad_requests = &r.counter("wordle_bad_requests_total", "Requests that couldn't be parsed.");
+            in_flight = &r.gauge("wordle_requests_in_flight", "Solve requests being answered right now.");
+        }
+        const Class& of(Priority p) const { return p == Priority::interactive ? interactive : background; }
+        Class interactive;
+        Class background;
+        Metrics::Counter* bad_requests;
+        Metrics::Gauge* in_flight;
+    };
+
+    static const Request_metrics& request_metrics() {
+        static const Request_metrics metrics;
+        return metrics;
+    }
+
+    class Socket_server::Progress_reporter : public Solver::Progress_hook {
+    public:
+        Progress_reporter(Socket_server& server_, const Request& r) : server(server_) {
+            std::lock_guard<std::mutex> lock(server.mutex);
+            id = server.next_solve_id++;
+            Solving& s = server.solving[id];
+            s.m = r.m;
+            s.priority = r.priority;
+            s.started = false;
+            Solver::set_progress_hook(this);
+        }
+        ~Progress_reporter() {
+            Solver::set_progress_hook(nullptr);
+            std::lock_guard<std::mutex> lock(server.mutex);
+            server.solving.erase(id);
+        }
+        // once per top level guess, so the lock is nothing next to the solve
+        void on_progress(const Solver::Progress& p) override {
+            std::lock_guard<std::mutex> lock(server.mutex);
+            Solving& s = server.solving[id];
+            s.started = true;
+            s.progress = p;
+        }
+    private:
+        Socket_server& server;
+        uint64_t id;
+    };
+
+    void Socket_server::serve_connection(int fd, std::shared_ptr<Solver::Cancel_token> cancel) {
+        string buffer;
+        char chunk[4096];
+        while (true) {
+            ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;
+            buffer.append(chunk, n);
+
+            // queue everything we've read, then answer it in order
+            vector<std::function<string()>> replies;
+            size_t start = 0;
+            size_t newline;
+            while ((newline = buffer.find('\n', start)) != string::npos) {
+                string line = buffer.substr(start, newline - start);
+                start = newline + 1;
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (line.find_first_not_of(" \t") == string::npos) continue;
+
+                std::shared_ptr<Request> r = std::make_shared<Request>();
+                try {
+                    *r = Request::of_json(line);
+                } catch (const std::exception& e) {
+                    request_metrics().bad_requests->add();
+                    string reply = error_reply(e.what());
+                    replies.push_back([reply] { return reply; });
+                    continue;
+                }
+                if (r->stats) {
+                    // when its turn comes, so it includes the requests before it
+                    replies.push_back([this] { return get_stats_json(); });
+                    continue;
+                }
+                auto reply = std::make_shared<std::promise<string>>();
+                std::shared_future<string> future = reply->get_future().share();
+                const Request_metrics::Class* metrics = &request_metrics().of(r->priority);
+                metrics->requests->add();
+                uint64_t read_ns = Metrics::now_ns();
+                scheduler.submit(r->priority, r->deadline, [this, r, reply, cancel, metrics, read_ns] {
+                    Progress_reporter reporter(*this, *r);
+                    request_metrics().in_flight->add(1);
+                    string answered = answer(&db, *r, &flights, cancel.get());
+                    request_metrics().in_flight->add(-1);
+                    if (answered.compare(0, 9, "{\"error\":") == 0) metrics->errors->add();
+                    metrics->latency->record_since(read_ns);
+                    reply->set_value(answered);
+                });
+                replies.push_back([future] {
+                    try {
+                        return future.get();
+                    } catch (const std::exception& e) {
+                        // the scheduler dropped it on shutdown
+                        return error_reply(e.what());
+                    }
+                });
+            }
+            buffer.erase(0, start);
+
+            for (const auto& reply : replies) {
+                if (!send_all(fd, reply() + "\n")) return;
+            }
+        }
+    }
+
+    static void class_stats_json(std::ostream& os, Scheduler::Class_stats s) {
+        double completed = std::max<double>(s.completed, 1);
+        os << "{\"queued\": " << s.queued
+           << ", \"running\": " << s.running
+           << ", \"completed\": " << s.completed
+           << ", \"mean_wait_ms\": " << s.total_wait_us / completed / 1000
+           << ", \"mean_latency_ms\": " << s.total_latency_us / completed / 1000
+           << ", \"max_latency_ms\": " << s.max_latency_us / 1000 << "}";
+    }
+
+    string Socket_server::get_stats_json() {
+        Singleflight::Stats f = flights.get_stats();
+        std::ostringstream os;
+        os << "{\"interactive\": ";
+        class_stats_json(os, scheduler.get_stats(Priority::interactive));
+        os << ", \"background\": ";
+        class_stats_json(os, scheduler.get_stats(Priority::background));
+        os << ", \"background_paused\": " << scheduler.num_paused()
+           << ", \"singleflight\": {\"cache_hits\": " << f.cache_hits << ", \"joined\": " << f.joined << ", \"solved\": " << f.solved << "}";
+        os << ", \"solving\": [";
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto s = solving.begin(); s != solving.end(); ++s) {
+            os << (s == solving.begin() ? "" : ", ") << "{\"mask\": \"" << s->second.m.to_hex()
+               << "\", \"priority\": \"" << priority_name(s->second.priority) << "\"";
+            if (s->second.started) {
+                const Solver::Progress& p = s->second.progress;
+                os << ", \"done\": " << p.done << ", \"total\": " << p.total
+                   << ", \"best_score\": " << p.best.best_score << ", \"best_guess\": \"" << p.best.best_guess << "\""
+                   << ", \"calls_per_second\": " << p.calls_per_second << ", \"eta_seconds\": " << p.eta_seconds;
+            }
+            os << "}";
+        }
+        os << "]}";
+        return os.str();
+    }
+
+    // the perf stats change from run to run (the endgame memo outlives a request)
+    static string without_perf(const string& reply) {
+        size_t pos = reply.find(", \"perf_calls\"");
+        if (pos == string::npos) return reply;
+        return reply.substr(0, pos) + "}";
+    }
+
+    void Socket_server::test() {
+        std::stringstream output;
+        std::stringstream expected;
+        bool prev_silence = Db::silence;
+        Db::silence = true;
+        Db::Read_only_db db;
+
+        output << without_perf(handle(&db, "{\"results\": [\"CRANE ._~__\"]}")) << endl;
+        expected << "{\"mask\": \"" << CMask(Result("CRANE ._~__")).to_hex() << "\", \"best_score\": 3, \"bound\": \"exact\", "
+                 << "\"best_guess\": \"CABAL\", \"worst_answer\": \"CACTI\"}" << endl;
+        output << without_perf(handle(&db, "{\"results\": [\"CRANE ._~__\"], \"guess\": \"CHAMP\", \"cutoff\": 2}")) << endl;
+        expected << "{\"mask\": \"" << CMask(Result("CRANE ._~__")).to_hex() << "\", \"best_score\": 2, \"bound\": \"lower\", "
+                 << "\"best_guess\": \"CHAMP\", \"worst_answer\": \"CABAL\"}" << endl;
+        output << handle(&db, "{\"results\": [\"CRANE ._~_\"]}") << endl;
+        expected << "{\"error\": \"Expected 5 letter word and 5 results, not: CRANE ._~_\"}" << endl;
+        output << handle(&db, "{\"objective\": 9}") << endl;
+        expected << "{\"error\": \"Bad objective: 9\"}" << endl;
+        // the whole game, but it's been cancelled already so it stops at the first check
+        Solver::Cancel_token cancelled;
+        cancelled.cancel();
+        output << answer(&db, Request::of_json("{}"), nullptr, &cancelled) << endl;
+        expected << "{\"error\": \"cancelled\"}" << endl;
+
+        // and the same over a socket, a batch of requests on one connection
+        string path = "/tmp/wordle_server_test." + std::to_string(getpid()) + ".sock";
+        {
+            Socket_server server(db, path, 2);
+            std::thread server_thread([&] { server.run(); });
+
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            strcpy(addr.sun_path, path.c_str());
+            if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+                server.stop();
+                server_thread.join();
+                throw std::runtime_error("Socket_server::test() couldn't connect to " + path);
+            }
+            send_all(fd, "{\"results\": [\"CRANE ._~__\"], \"cutoff\": 2, \"priority\": \"background\"}\n"
+                     "{\"guess\": \"ZZZZZ\"}\n"
+                     "{\"stats\": true}\n");
+            string replies;
+            char chunk[4096];
+            ssize_t n;
+            while (std::count(replies.begin(), replies.end(), '\n') < 3 && (n = recv(fd, chunk, sizeof(chunk), 0)) > 0) {
+                replies.append(chunk, n);
+            }
+            close(fd);
+            server.stop();
+            server_thread.join();
+
+            std::istringstream lines(replies);
+            string line;
+            while (std::getline(lines, line)) {
+                // the queue stats depend on timing, the singleflight ones don't
+                size_t singleflight = line.find("\"singleflight\"");
+                output << (singleflight == string::npos ? without_perf(line) : line.substr(singleflight)) << endl;
+            }
+        }
+        expected << "{\"mask\": \"" << CMask(Result("CRANE ._~__")).to_hex() << "\", \"best_score\": 2, \"bound\": \"lower\", "
+                 << "\"best_guess\": \"CABAL\", \"worst_answer\": \"CABBY\"}" << endl;
+        expected << "{\"error\": \"Word not in dictionary\"}" << endl;
+        expected << "\"singleflight\": {\"cache_hits\": 0, \"joined\": 0, \"solved\": 1}, \"solving\": []}" << endl;
+
+        Db::silence = prev_silence;
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Socket_server::test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
+}
@@ -0,0 +1,187 @@
+/* A long-running solver: loads the dictionary, tables and db once and then answers requests over a
+   Unix-domain socket, so a request costs whatever the lookup or solve costs rather than process
+   startup plus a db load. `wordle --serve <socket>` runs one.
+
+   The protocol is one JSON object per line each way. A request looks like
+     {"results": ["SOARE __.~_", "CLINT _~___"], "mask": "<hex>", "guess": "CRANE",
+      "objective": 0, "cutoff": 4, "timeout_ms": 1000}
+   and every field is optional. Like wordle's command line, the state is [mask] (default: nothing
+   known yet) with each of [results] applied. With a [guess] it's solve_c for that guess,
+   otherwise solve_p, and an [objective] > 0 is solve_b's win-within-N-turns. The reply is
+     {"mask": "<hex>", "best_score": 3, "bound": "exact", "best_guess": "CRANE",
+      "worst_answer": "PLANT", "perf_calls": 459, "perf_seconds": 0.0012}
+   or {"error": "..."} if the request couldn't be parsed or solved (e.g. it timed out). With
+   "anytime": true a request that times out gets whatever the solver had found by then instead,
+   with "bound" saying which side of it the real score is.
+
+   One thread accepts connections and a pool of workers serve them, each worker takes one
+   connection and answers its requests in order until the client hangs up. The solver's scratch
+   and the endgame memo are already per thread, so the workers only share the db, which has to
+   be thread safe (see Db::Locked_db).
+
+   A popular position that misses the db tends to get asked for by lots of clients at once, so
+   every solve goes through a Singleflight: the first request for a Job solves it, the ones that
+   turn up while it's running wait for its result, and the result then goes into a small
+   in-memory cache in front of the db.
+
+   Requests are "interactive" (the default) or have "priority": "background", see scheduler.hpp.
+   A connection's requests are all handed to the Scheduler as soon as they're read and answered
+   in order, so a client can send a whole batch of background work down one connection. Each
+   connection gets its own thread, which mostly waits; the Scheduler's threads do the solving.
+   When a client hangs up, or the server stops, the solves for its requests are cancelled.
+   {"stats": true} is answered straight away with the queue depth and latency of each class, and
+   how far each solve that's running has got (see Solver::Progress).
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "cmask.hpp"
+#include "dictionary.hpp"
+#include "db.hpp"
+#include "job.hpp"
+#include "solveresult.hpp"
+#include "solver.hpp"
+#include "scheduler.hpp"
+
+namespace Server {
+    struct Request {
+        Request();
+        CMask m;
+        bool has_guess;
+        Dictionary::WordIndex guess;
+        int objective; // 0 = adversarial, otherwise solve_b's num_turns
+        float cutoff;
+        // from "timeout_ms", which counts from when the request was read, so time spent queued
+        // counts too. pos_infin for none.
+        boost::posix_time::ptime deadline;
+        // once [deadline] passes, reply with the best found so far (as a bound) instead of an error
+        bool anytime;
+        Priority priority;
+        bool stats; // a request for get_stats_json rather than a solve
+
+        // the score_cutoff to hand Singleflight::run. pwin has no cutoff, and an anytime result for
+        // it is only a lower bound on the chance of winning, so nothing but an exact one will do.
+        float flight_cutoff() const;
+
+        // throws if [line] isn't a valid request
+        static Request of_json(const std::string& line);
+    };
+
+    // Solves each Job at most once at a time, see the top of the file.
+    class Singleflight {
+    public:
+        // keeps the last [max_cached] results
+        Singleflight(size_t max_cached);
+        ~Singleflight();
+
+        // Returns a result for [j] that's good for [score_cutoff] (see SolveResult::good_for):
+        // from the cache, from a solve of [j] that's already running, or from calling [solve]
+        // ourselves. Throws whatever [solve] throws, or Timeout if [timeout] passes (Cancelled if
+        // [cancel], which can be nullptr, is cancelled) while we're waiting for someone else's solve.
+        //
+        // An interactive request never waits for a background one's solve, the background one
+        // could be paused until the interactive ones are done. It solves for itself instead.
+        Solver::SolveResult run(const Job& j,
+                                float score_cutoff,
+                                Priority priority,
+                                boost::posix_time::ptime timeout,
+                                const Solver::Cancel_token* cancel,
+                                const std::function<Solver::SolveResult()>& solve);
+
+        struct Stats {
+            uint64_t cache_hits;
+            uint64_t joined; // waited for someone else's solve and used it
+            uint64_t solved;
+        };
+        Stats get_stats();
+
+        // how often a waiter looks at its Cancel_token
+        static const int cancel_check_ms = 10;
+
+        static void test();
+    private:
+        struct Flight {
+            Flight(Priority priority) : priority(priority), done(false), failed(false) {}
+            Priority priority;
+            bool done;
+            bool failed;
+            Solver::SolveResult result;
+        };
+        // an exact result replaces a bound, never the other way round
+        void publish_locked(const Job& j, const Solver::SolveResult& result);
+
+        size_t max_cached;
+        std::mutex mutex;
+        std::condition_variable flight_done;
+        std::map<Job, std::shared_ptr<Flight>> in_flight;
+        std::map<Job, Solver::SolveResult> cache;
+        std::deque<Job> cache_order; // oldest first, for evicting
+        Stats stats;
+    };
+
+    // The reply line to [r], never throws: errors come back as {"error": ...}. No newline.
+    // [flights] can be nullptr, then every request solves for itself. Cancelling [cancel] (if
+    // any) makes the solve give up like a timeout.
+    std::string answer(Db::Db_intf* db, const Request& r, Singleflight* flights = nullptr, const Solver::Cancel_token* cancel = nullptr);
+    // parses [line] and answers it
+    std::string handle(Db::Db_intf* db, const std::string& line, Singleflight* flights = nullptr);
+
+    class Socket_server {
+    public:
+        // Binds [socket_path] (replacing whatever was there) straight away, so clients can
+        // connect as soon as this returns, but nothing is answered until run().
+        Socket_server(Db::Db_intf& db, const std::string& socket_path, unsigned int num_threads);
+        ~Socket_server();
+        Socket_server(const Socket_server&) = delete;
+        Socket_server& operator=(const Socket_server&) = delete;
+
+        // serves until stop(), then waits for the connections to close
+        void run();
+        // safe to call from any thread, hangs up on every client
+        void stop();
+
+        std::string get_stats_json();
+
+        static void test();
+    private:
+        // registers a request's solve in [solving] for as long as it runs
+        class Progress_reporter;
+        struct Solving {
+            CMask m;
+            Priority priority;
+            bool started; // whether there's been any progress yet
+            Solver::Progress progress;
+        };
+
+        void connection_main(int fd, std::shared_ptr<Solver::Cancel_token> cancel);
+        void serve_connection(int fd, std::shared_ptr<Solver::Cancel_token> cancel);
+
+        Db::Db_intf& db;
+        Singleflight flights;
+        std::string socket_path;
+        int listen_fd;
+
+        // guarded by mutex
+        std::mutex mutex;
+        std::condition_variable connections_closed;
+        // each connection's token, cancelled when it hangs up or we stop
+        std::map<int, std::shared_ptr<Solver::Cancel_token>> active;
+        // the solves running now, by when they started
+        std::map<uint64_t, Solving> solving;
+        uint64_t next_solve_id;
+        bool stopping;
+
+        // last, so it's destroyed (and its threads are done with [flights] and [db]) first
+        Scheduler scheduler;
+    };
+}
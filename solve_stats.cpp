@@ -0,0 +1,181 @@
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include "solve_stats.hpp"
+
+using std::string;
+using std::endl;
+
+namespace Solver {
+    const char* phase_name(Phase p) {
+        static const char* names[num_phases] = {"db", "filter", "partition", "endgame"};
+        return names[static_cast<int>(p)];
+    }
+
+    // every counter, in the order they're printed
+    static const struct {
+        const char* name;
+        uint64_t Depth_stats::*field;
+    } counters[] = {
+        {"p_nodes", &Depth_stats::p_nodes},
+        {"c_nodes", &Depth_stats::c_nodes},
+        {"b_nodes", &Depth_stats::b_nodes},
+        {"endgame_roots", &Depth_stats::endgame_roots},
+        {"endgame_nodes", &Depth_stats::endgame_nodes},
+        {"db_queries", &Depth_stats::db_queries},
+        {"db_hits", &Depth_stats::db_hits},
+        {"cutoffs", &Depth_stats::cutoffs},
+        {"filters", &Depth_stats::filters},
+        {"filtered_guesses", &Depth_stats::filtered_guesses},
+    };
+
+    static string timer_name(int phase) {
+        return string(phase_name(static_cast<Phase>(phase))) + "_us";
+    }
+
+    Depth_stats::Depth_stats() {
+        for (const auto& c : counters) this->*c.field = 0;
+        for (int p = 0; p < num_phases; p++) {
+            phase_us[p] = 0;
+            for (int e = 0; e < Perf_counters::num_events; e++) phase_events[p][e] = 0;
+        }
+    }
+
+    void Depth_stats::add(const Depth_stats& d) {
+        for (const auto& c : counters) this->*c.field += d.*c.field;
+        for (int p = 0; p < num_phases; p++) {
+            phase_us[p] += d.phase_us[p];
+            for (int e = 0; e < Perf_counters::num_events; e++) phase_events[p][e] += d.phase_events[p][e];
+        }
+    }
+
+    Depth_stats Solve_stats::total() const {
+        Depth_stats rv;
+        for (const Depth_stats& d : depths) rv.add(d);
+        return rv;
+    }
+
+    void Solve_stats::add(const Solve_stats& s) {
+        for (size_t depth = 0; depth < s.depths.size(); depth++) at(depth).add(s.depths[depth]);
+    }
+
+    static void print_row(std::ostream& os, const string& label, const Depth_stats& d) {
+        os << std::setw(6) << label;
+        for (const auto& c : counters) os << " " << std::setw(string(c.name).size()) << d.*c.field;
+        for (int p = 0; p < num_phases; p++) os << " " << std::setw(timer_name(p).size()) << static_cast<uint64_t>(d.phase_us[p]);
+        os << endl;
+    }
+
+    // what fraction [part] is of [whole], for the miss rates
+    static double ratio(uint64_t part, uint64_t whole) {
+        return whole ? static_cast<double>(part) / whole : 0;
+    }
+
+    static void print_events(std::ostream& os, const Perf_counters& perf, const string& label, const Depth_stats& d) {
+        for (int p = 0; p < num_phases; p++) {
+            const uint64_t* events = d.phase_events[p];
+            if (!d.phase_us[p]) continue;
+            os << std::setw(6) << label << " " << std::setw(9) << phase_name(static_cast<Phase>(p));
+            for (int e = 0; e < Perf_counters::num_events; e++) {
+                os << " " << std::setw(14);
+                if (perf.is_open(e)) {
+                    os << events[e];
+                } else {
+                    os << "-";
+                }
+            }
+            os << std::fixed << std::setprecision(2)
+               << " " << std::setw(5) << ratio(events[Perf_counters::instructions], events[Perf_counters::cycles])
+               << " " << std::setw(7) << 1000 * ratio(events[Perf_counters::llc_misses], events[Perf_counters::instructions])
+               << std::defaultfloat << endl;
+        }
+    }
+
+    void Solve_stats::print(std::ostream& os) const {
+        os << std::setw(6) << "depth";
+        for (const auto& c : counters) os << " " << c.name;
+        for (int p = 0; p < num_phases; p++) os << " " << timer_name(p);
+        os << endl;
+        for (size_t depth = 0; depth < depths.size(); depth++) print_row(os, std::to_string(depth), depths[depth]);
+        print_row(os, "total", total());
+
+        if (!perf) return;
+        os << endl << std::setw(6) << "depth" << " " << std::setw(9) << "phase";
+        for (int e = 0; e < Perf_counters::num_events; e++) os << " " << std::setw(14) << Perf_counters::event_name(e);
+        os << " " << std::setw(5) << "ipc" << " " << std::setw(7) << "llc/ki" << endl;
+        for (size_t depth = 0; depth < depths.size(); depth++) print_events(os, *perf, std::to_string(depth), depths[depth]);
+        print_events(os, *perf, "total", total());
+    }
+
+    static void depth_json(std::ostream& os, const Perf_counters* perf, const Depth_stats& d) {
+        os << "{";
+        bool first = true;
+        for (const auto& c : counters) {
+            os << (first ? "" : ", ") << "\"" << c.name << "\": " << d.*c.field;
+            first = false;
+        }
+        for (int p = 0; p < num_phases; p++) os << ", \"" << timer_name(p) << "\": " << d.phase_us[p];
+        if (perf) {
+            os << ", \"events\": {";
+            for (int p = 0; p < num_phases; p++) {
+                os << (p ? ", " : "") << "\"" << phase_name(static_cast<Phase>(p)) << "\": {";
+                bool first = true;
+                for (int e = 0; e < Perf_counters::num_events; e++) {
+                    if (!perf->is_open(e)) continue;
+                    os << (first ? "" : ", ") << "\"" << Perf_counters::event_name(e) << "\": " << d.phase_events[p][e];
+                    first = false;
+                }
+                os << "}";
+            }
+            os << "}";
+        }
+        os << "}";
+    }
+
+    string Solve_stats::to_json() const {
+        std::ostringstream os;
+        os << "{\"depths\": [";
+        for (size_t depth = 0; depth < depths.size(); depth++) {
+            if (depth) os << ", ";
+            depth_json(os, perf, depths[depth]);
+        }
+        os << "], \"total\": ";
+        depth_json(os, perf, total());
+        os << "}";
+        return os.str();
+    }
+
+    void Solve_stats::test() {
+        std::stringstream output;
+        std::stringstream expected;
+
+        // two threads' worth, one of them deeper
+        Solve_stats a, b;
+        a.at(0).p_nodes = 1;
+        a.at(0).c_nodes = 10;
+        a.at(1).p_nodes = 7;
+        a.at(0).phase_us[static_cast<int>(Phase::db)] = 1.5;
+        b.at(0).p_nodes = 2;
+        b.at(2).cutoffs = 3;
+        a.add(b);
+        output << "depths: " << a.get_depths().size() << " " << a.at(0).p_nodes << " " << a.at(2).cutoffs << endl;
+        expected << "depths: 3 3 3" << endl;
+        Depth_stats total = a.total();
+        output << "total: " << total.p_nodes << " " << total.c_nodes << " " << total.cutoffs << " " << total.phase_us[static_cast<int>(Phase::db)] << endl;
+        expected << "total: 10 10 3 1.5" << endl;
+
+        Solve_stats one;
+        one.at(0).b_nodes = 4;
+        output << one.to_json() << endl;
+        expected << "{\"depths\": [{\"p_nodes\": 0, \"c_nodes\": 0, \"b_nodes\": 4, \"endgame_roots\": 0, \"endgame_nodes\": 0, "
+                 << "\"db_queries\": 0, \"db_hits\": 0, \"cutoffs\": 0, \"filters\": 0, \"filtered_guesses\": 0, "
+                 << "\"db_us\": 0, \"filter_us\": 0, \"partition_us\": 0, \"endgame_us\": 0}], \"total\": {\"p_nodes\": 0, "
+                 << "\"c_nodes\": 0, \"b_nodes\": 4, \"endgame_roots\": 0, \"endgame_nodes\": 0, \"db_queries\": 0, \"db_hits\": 0, "
+                 << "\"cutoffs\": 0, \"filters\": 0, \"filtered_guesses\": 0, \"db_us\": 0, \"filter_us\": 0, \"partition_us\": 0, "
+                 << "\"endgame_us\": 0}}" << endl;
+
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Solve_stats::test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
+}
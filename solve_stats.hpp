@@ -0,0 +1,85 @@
+/* Where a solve spent its time, counted per depth of the recursion, so a slow query can be
+   explained from one run rather than a rerun under perf.
+
+   Counting is off unless a thread asks for it with Solver::set_solve_stats, and then that
+   thread's solves count into its own Solve_stats, so threads never share counters. To see a whole
+   pool's work, give each thread a Solve_stats and add() them up afterwards.
+
+   Depth is the solve_p depth: a solve_c is counted at the depth of the solve_p that tried its
+   guess. The phase times read the clock, so a run with stats on is a little slower than one
+   without.
+
+   Give the Solve_stats a Perf_counters (for the same thread) and every phase also counts the
+   CPU's cycles, instructions, cache and branch misses. That's two syscalls a phase, so the
+   counts include some of the kernel's work and the times get worse, but the ratios between the
+   phases and depths are what matter.
+*/
+
+#pragma once
+#include <vector>
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include "perf_counters.hpp"
+
+namespace Solver {
+    // the parts of a state's search that get timed
+    enum class Phase { db, filter, partition, endgame };
+    static const int num_phases = 4;
+    const char* phase_name(Phase p);
+
+    struct Depth_stats {
+        Depth_stats();
+
+        // states searched, by solver
+        uint64_t p_nodes;
+        uint64_t c_nodes;
+        uint64_t b_nodes;
+        // solve_p states handed to the endgame, and the states it searched for them
+        uint64_t endgame_roots;
+        uint64_t endgame_nodes;
+        // db lookups, and the ones that settled the state (or guess) without a search
+        uint64_t db_queries;
+        uint64_t db_hits;
+        // searches cut short because they couldn't beat the cutoff
+        uint64_t cutoffs;
+        // guess sets filtered down to a state, and the guesses left in them
+        uint64_t filters;
+        uint64_t filtered_guesses;
+
+        // microseconds in each phase, and Perf_counters' counts (if any) in each
+        double phase_us[num_phases];
+        uint64_t phase_events[num_phases][Perf_counters::num_events];
+
+        void add(const Depth_stats& d);
+    };
+
+    class Solve_stats {
+    public:
+        Solve_stats() : perf(nullptr) {}
+
+        // [perf] has to be counting the thread doing the solving, nullptr to stop
+        void set_perf_counters(const Perf_counters* p) { perf = p; }
+        const Perf_counters* get_perf_counters() const { return perf; }
+
+        Depth_stats& at(size_t depth) {
+            if (depth >= depths.size()) depths.resize(depth + 1);
+            return depths[depth];
+        }
+        const std::vector<Depth_stats>& get_depths() const { return depths; }
+        Depth_stats total() const;
+        void add(const Solve_stats& s);
+
+        // a table, one row per depth and a total, then one per phase and depth for the
+        // Perf_counters if we had any
+        void print(std::ostream& os) const;
+        // {"depths": [{...}, ...], "total": {...}}. With Perf_counters, each has "events" too:
+        // {"db": {"cycles": ..., ...}, ...}
+        std::string to_json() const;
+
+        static void test();
+    private:
+        std::vector<Depth_stats> depths;
+        const Perf_counters* perf;
+    };
+}
@@ -4,11 +4,20 @@
 #include <set>
 #include <map>
 #include <algorithm>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <exception>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include "word.hpp"
 #include "result.hpp"
 #include "dictionary.hpp"
 #include "solver.hpp"
+#include "word_set.hpp"
+#include "feedback.hpp"
+#include "endgame.hpp"
+#include "metrics.hpp"
 
 using std::string;
 using std::vector;
@@ -28,65 +37,388 @@ namespace Solver {
     SolveResult::SolveResult() : best_score(99999), best_guess(no_best_guess), worst_answer(no_worst_answer), perf_calls(1), perf_microseconds(0) {};
 
     vector<WordIndex> valid_list(const CMask& m, const vector<WordIndex>& dict) {
-        vector<WordIndex> r;
-        r.reserve(dict.size());
-        for (WordIndex w : dict) {
-            if (m.check(*w)) r.push_back(w);
-        }
-        return r;
+        return Word_set::of_list(dict).filter(m).to_list();
     }
 
     // returns count of valid answers, only outputting the first two
     int valid_count(const CMask& m, const vector<WordIndex>& dict, Word::Compact& out1, Word::Compact& out2) {
-        int c = 0;
-        for (WordIndex w : dict) {
-            if (m.check(*w)) {
-                if (c==0) {
-                    out1 = *w;
-                } else if (c==1) {
-                    out2 = *w;
-                }
-                c++;                
-            }
-        }
-        return c;
+        return Word_set::of_list(dict).filter(m).count_and_first_two(out1, out2);
     }
     
     ptime now() {
         return boost::posix_time::microsec_clock::local_time();
     }
     
-    const bool adversarial = true; // Code is kinda broken for average case right now.
     const unsigned int max_num_results_any_guess = 150;
+
+    Write_back_policy::Write_back_policy() : min_calls(0), min_microseconds(0) {}
+    Write_back_policy::Write_back_policy(double min_calls_, double min_microseconds_) :
+        min_calls(min_calls_), min_microseconds(min_microseconds_) {}
+
+    bool Write_back_policy::admits(const SolveResult& r, double microseconds) const {
+        if (r.get_bound() != Bound::exact) return false;
+        return (min_calls > 0 && r.perf_calls >= min_calls) || (min_microseconds > 0 && microseconds >= min_microseconds);
+    }
+
+    static Write_back_policy write_back_policy;
+
+    void set_write_back_policy(const Write_back_policy& policy) {
+        write_back_policy = policy;
+    }
+
+    const Write_back_policy& get_write_back_policy() {
+        return write_back_policy;
+    }
+
+    static thread_local Yield_hook* yield_hook = nullptr;
+
+    void set_yield_hook(Yield_hook* hook) {
+        yield_hook = hook;
+    }
+
+    static thread_local Solve_stats* solve_stats = nullptr;
+
+    void set_solve_stats(Solve_stats* stats) {
+        solve_stats = stats;
+    }
+
+    static thread_local Tracer* tracer = nullptr;
+
+    void set_tracer(Tracer* t) {
+        tracer = t;
+    }
+
+    static thread_local Progress_hook* progress_hook = nullptr;
+    // whether a Progress_tracker is already reporting on this thread
+    static thread_local bool progress_tracked = false;
+
+    void set_progress_hook(Progress_hook* hook) {
+        progress_hook = hook;
+    }
+
+    // Reports a top level loop's progress to the progress hook, if there is one and no loop
+    // further out is reporting already
+    class Progress_tracker {
+    public:
+        Progress_tracker(size_t total) : active(progress_hook && !progress_tracked) {
+            if (!active) return;
+            progress_tracked = true;
+            start = std::chrono::steady_clock::now();
+            p.done = 0;
+            p.total = total;
+            p.calls = 0;
+            recent_calls_per_step = 0;
+        }
+        ~Progress_tracker() {
+            if (active) progress_tracked = false;
+        }
+        // one more guess (or answer) done, [calls] is the total so far
+        void step(const SolveResult& best, double calls) {
+            if (!active) return;
+            double step_calls = calls - p.calls;
+            p.done++;
+            p.best = best;
+            p.calls = calls;
+            p.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            p.calls_per_second = p.seconds > 0 ? p.calls / p.seconds : 0;
+            // a moving average over roughly the last 20 steps
+            recent_calls_per_step = p.done == 1 ? step_calls : 0.95 * recent_calls_per_step + 0.05 * step_calls;
+            p.eta_seconds = p.calls_per_second > 0 ? (p.total - p.done) * recent_calls_per_step / p.calls_per_second : -1;
+            progress_hook->on_progress(p);
+        }
+    private:
+        bool active;
+        std::chrono::steady_clock::time_point start;
+        Progress p;
+        double recent_calls_per_step;
+    };
+
+    static string word_string(const Word& w) {
+        std::ostringstream os;
+        os << w;
+        return os.str();
+    }
+
+    // A Tracer span for one solve_p state or solve_c guess, recorded when it goes out of scope
+    // with whatever [result] points to then (but not if a timeout is unwinding it). Does nothing
+    // unless we're tracing [depth], so only fill in [name] and [args] if it's true.
+    class Trace_span {
+    public:
+        Trace_span(const char* category, size_t depth, float cutoff, const SolveResult* result) :
+            active(tracer && depth < tracer->get_max_depth()) {
+            if (!active) return;
+            this->category = category;
+            this->cutoff = cutoff;
+            this->result = result;
+            from_db = false;
+            start_us = tracer->now_us();
+        }
+        ~Trace_span() {
+            if (!active || std::uncaught_exceptions()) return;
+            Bound b = result->get_bound();
+            std::ostringstream os;
+            os << args << (args.empty() ? "" : ", ")
+               << "\"cutoff\": " << cutoff << ", \"score\": " << result->best_score
+               << ", \"bound\": \"" << (b == Bound::lower ? "lower" : b == Bound::upper ? "upper" : "exact") << "\""
+               << ", \"best_guess\": \"" << Word(result->best_guess) << "\""
+               << ", \"worst_answer\": \"" << Word(result->worst_answer) << "\""
+               << ", \"db_hit\": " << (from_db ? "true" : "false");
+            tracer->record(category, name, start_us, tracer->now_us(), os.str());
+        }
+        explicit operator bool() const { return active; }
+        // the result came from the db rather than a search
+        void set_from_db(const SolveResult* r) {
+            result = r;
+            from_db = true;
+        }
+
+        string name;
+        string args; // the inside of a JSON object, the result's get added
+    private:
+        bool active;
+        const char* category;
+        float cutoff;
+        const SolveResult* result;
+        bool from_db;
+        int64_t start_us;
+    };
+
+    // Adds how long it's alive (and its Perf_counters counts) to one of solve_stats' phases at
+    // [depth], if we're counting. Don't hold one across a recursive call, solve_stats->at() can
+    // move the depths.
+    class Phase_timer {
+    public:
+        Phase_timer(Phase phase, size_t depth) : phase(static_cast<int>(phase)), depth(depth) {
+            if (!solve_stats) return;
+            if (solve_stats->get_perf_counters()) solve_stats->get_perf_counters()->read(start_events);
+            start = std::chrono::steady_clock::now();
+        }
+        ~Phase_timer() {
+            if (!solve_stats) return;
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            Depth_stats& d = solve_stats->at(depth);
+            if (const Perf_counters* perf = solve_stats->get_perf_counters()) {
+                uint64_t end_events[Perf_counters::num_events];
+                perf->read(end_events);
+                for (int e = 0; e < Perf_counters::num_events; e++) d.phase_events[phase][e] += end_events[e] - start_events[e];
+            }
+            d.phase_us[phase] += std::chrono::duration<double, std::micro>(end - start).count();
+        }
+    private:
+        int phase;
+        size_t depth;
+        std::chrono::steady_clock::time_point start;
+        uint64_t start_events[Perf_counters::num_events];
+    };
+
+    // When a state's search started. The steady clock, it's read at every state when the
+    // write-back policy has a time in it. Default-constructed if nobody timed the search.
+    typedef std::chrono::steady_clock::time_point Start_time;
+
+    static double microseconds_since(Start_time start) {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // whether a state has to note its start time so write_back can see how long it took
+    static bool time_for_write_back(const Db_intf* db) {
+        return db && write_back_policy.min_microseconds > 0;
+    }
+
+    // Saves [rv] as the db's answer to (m, guess) if the write-back policy admits it. [start] is
+    // when the search started, or Start_time() if it wasn't timed.
+    static void write_back(Db_intf* db, const CMask& m, Word::Compact guess, SolveResult rv, Start_time start) {
+        if (!db) return;
+        double microseconds = 0;
+        if (start != Start_time()) {
+            microseconds = microseconds_since(start);
+            // below the top level nothing else timed it
+            if (rv.get_perf_microseconds() == 0) rv.set_perf_microseconds(microseconds);
+        }
+        if (write_back_policy.admits(rv, microseconds)) db->save(m, guess, Objective::adversarial, rv);
+    }
+
+    // What a call in the recursion knows at compile time: whether it's solving the adversarial
+    // objective, whether it prints debug info or times itself, whether there's a Deadline to
+    // poll, and whether it should return what it has rather than throw once the timeout passes.
+    // Only the top level ever prints, times or returns early, every call below it uses Child, so
+    // the hot recursion has none of that code in it.
+    template <bool adversarial_, bool debug_, bool track_time_, bool has_timeout_, bool anytime_>
+    struct Policy {
+        static const bool adversarial = adversarial_;
+        static const bool debug = debug_;
+        static const bool track_time = track_time_;
+        static const bool has_timeout = has_timeout_;
+        static const bool anytime = anytime_;
+        typedef Policy<adversarial_, false, false, has_timeout_, false> Child;
+    };
+
+    template <bool adversarial, bool debug, bool track_time, typename F>
+    static SolveResult with_timeout_policy(const Deadline& deadline, bool anytime, F f) {
+        if (!deadline.is_set()) return f(Policy<adversarial, debug, track_time, false, false>());
+        if (anytime) return f(Policy<adversarial, debug, track_time, true, true>());
+        return f(Policy<adversarial, debug, track_time, true, false>());
+    }
+
+    // Returns f(P()) for the Policy P matching the top level's runtime flags
+    template <bool adversarial, typename F>
+    static SolveResult with_policy(bool debug, bool track_time, const Deadline& deadline, bool anytime, F f) {
+        if (debug) {
+            if (track_time) return with_timeout_policy<adversarial, true, true>(deadline, anytime, f);
+            return with_timeout_policy<adversarial, true, false>(deadline, anytime, f);
+        }
+        if (track_time) return with_timeout_policy<adversarial, false, true>(deadline, anytime, f);
+        return with_timeout_policy<adversarial, false, false>(deadline, anytime, f);
+    }
+
+    // what the process-wide metrics (see metrics.hpp) count for each public solve_*
+    struct Solve_metrics {
+        Solve_metrics(const char* solver) {
+            Metrics::Registry& r = Metrics::registry();
+            string labels = string("solver=\"") + solver + "\"";
+            solves = &r.counter("wordle_solves_total", "Solves started.", labels);
+            timeouts = &r.counter("wordle_solve_timeouts_total", "Solves that ran out of time.", labels);
+            cancelled = &r.counter("wordle_solve_cancelled_total", "Solves that were cancelled.", labels);
+            latency = &r.histogram("wordle_solve_seconds", "How long the solves that finished took.", labels);
+        }
+        Metrics::Counter* solves;
+        Metrics::Counter* timeouts;
+        Metrics::Counter* cancelled;
+        Metrics::Histogram* latency;
+    };
+
+    // with_policy for a public solve_*, counted in [metrics]
+    template <bool adversarial, typename F>
+    static SolveResult with_counted_policy(const Solve_metrics& metrics, bool debug, bool track_time, const Deadline& deadline, bool anytime, F f) {
+        uint64_t start = Metrics::now_ns();
+        metrics.solves->add();
+        try {
+            SolveResult rv = with_policy<adversarial>(debug, track_time, deadline, anytime, f);
+            metrics.latency->record_since(start);
+            return rv;
+        } catch (const Cancelled&) {
+            metrics.cancelled->add();
+            throw;
+        } catch (const Timeout&) {
+            metrics.timeouts->add();
+            throw;
+        }
+    }
+
+    // Code is kinda broken for average case right now, so solve_p and solve_c are always
+    // adversarial. solve_b is the other objectives.
+    const bool adversarial = true;
     
-    vector<pair<int, WordIndex>> sort_by_heuristic(const vector<WordIndex>& answers,
-                                                    const vector<WordIndex>& guesses,
-                                                    const CMask& m) {
+    vector<pair<int, WordIndex>> sort_by_heuristic(const Word_set& answers,
+                                                    const Word_set& guesses) {
 
+         Feedback::Answer_letters answer_letters(answers.to_list());
+         vector<Feedback::Pattern> patterns;
          vector<pair<int, WordIndex>> scores;
-         for (WordIndex g : guesses) {
+         guesses.for_each([&] (WordIndex g) {
+             // answers are already valid for m, so the ones still valid after g are exactly the
+             // ones with the same pattern
+             int count_by_pattern[Feedback::num_patterns] = {0};
+             Feedback::patterns(answer_letters, g, patterns);
+             for (Feedback::Pattern p : patterns) count_by_pattern[p]++;
              int still_valid_count = 0;
-
-             map<CMask, int> cache;
-             for (WordIndex a : answers) {
-                 CMask nr(*a, *g);
-                 if (!cache.count(nr)) {
-                     CMask nm(m);
-                     nm.apply(nr);
-                     int sv = 0;
-                     for (WordIndex a2 : answers) {
-                         if (nm.check(*a2)) sv++;
-                     }
-                     cache.insert({nr, sv});
-                 }
-                 still_valid_count += cache.at(nr);
-             }
+             for (int count : count_by_pattern) still_valid_count += count * count;
              scores.push_back({still_valid_count, g});
-         }
+         });
          std::sort(scores.begin(), scores.end());
          return scores;
     }
-    
+
+    // Everything solve_p_sets and solve_c_uncached need at one depth of the recursion. There's one
+    // per depth per thread, reused from one state to the next, so once a search has been to its
+    // deepest depth it doesn't allocate any more.
+    struct Depth_scratch {
+        // solve_p_sets
+        vector<Record> cached;
+        vector<pair<Word::Compact, SolveResult>> cached_guesses;
+        vector<WordIndex> answer_order;
+        Feedback::Answer_letters answer_letters;
+        Word_set valid_guesses;
+        vector<WordIndex> guesses_to_check;
+
+        // solve_c_uncached, see partition_by_pattern
+        vector<Feedback::Pattern> patterns;
+        vector<WordIndex> answers_by_pattern;
+        size_t pattern_start[Feedback::num_patterns + 1];
+    };
+
+    static Depth_scratch& scratch_at(size_t depth) {
+        // unique_ptr so growing the vector doesn't move the scratch of the depths above us
+        static thread_local vector<std::unique_ptr<Depth_scratch>> scratch;
+        while (scratch.size() <= depth) scratch.emplace_back(new Depth_scratch);
+        return *scratch[depth];
+    }
+
+    // Partitions [answer_order] by their pattern against [guess]: afterwards the answers with
+    // pattern p are scratch.answers_by_pattern[scratch.pattern_start[p] .. scratch.pattern_start[p+1]),
+    // in [answer_order]'s order, and scratch.patterns[i] is the pattern of answer_order[i].
+    static void partition_by_pattern(const vector<WordIndex>& answer_order,
+                                     const Feedback::Answer_letters& answer_letters,
+                                     WordIndex guess,
+                                     Depth_scratch& scratch) {
+        Feedback::patterns(answer_letters, guess, scratch.patterns);
+        size_t* start = scratch.pattern_start;
+        std::fill(start, start + Feedback::num_patterns + 1, 0);
+        for (Feedback::Pattern p : scratch.patterns) start[p + 1]++;
+        for (int p = 0; p < Feedback::num_patterns; p++) start[p + 1] += start[p];
+        scratch.answers_by_pattern.resize(answer_order.size());
+        // a counting sort, using start[p] as the next free slot for p and then putting it back
+        for (size_t i = 0; i < answer_order.size(); i++) {
+            scratch.answers_by_pattern[start[scratch.patterns[i]]++] = answer_order[i];
+        }
+        for (int p = Feedback::num_patterns; p > 0; p--) start[p] = start[p - 1];
+        start[0] = 0;
+    }
+
+    // The versions of solve_p, solve_c and solve_b the recursion actually uses.
+    //
+    // [answers] is exactly what [m] allows (solve_c_uncached hands each child its own range of
+    // answers). [prev_guesses] is exactly what the parent state allowed, and [m] is the parent state
+    // with [new_result] applied, so we only need to filter the guesses by [new_result]. We put
+    // that off until we know we need it, a lot of states never look at the guesses.
+    template <typename P>
+    static SolveResult solve_p_sets(Db_intf* db,
+                                    const WordIndex* answers,
+                                    size_t num_answers,
+                                    const Word_set& prev_guesses,
+                                    const CMask& new_result,
+                                    const CMask& m,
+                                    float score_cutoff,
+                                    Deadline& deadline,
+                                    size_t depth);
+
+    // [valid_guesses] is exactly what [m] allows. [answer_order] is the answers [m] allows, in the
+    // order to try them, [answer_letters] is [answer_order] again for Feedback::patterns, and
+    // [out_worst_answer_index] is an index into it.
+    template <typename P>
+    static SolveResult solve_c_sets(Db_intf* db,
+                                    const vector<WordIndex>& answer_order,
+                                    const Feedback::Answer_letters& answer_letters,
+                                    const Word_set& valid_guesses,
+                                    const CMask& m,
+                                    WordIndex guess,
+                                    float score_cutoff,
+                                    int* out_worst_answer_index,
+                                    Deadline& deadline,
+                                    size_t depth);
+
+    // solve_c_sets once we know (m, guess) isn't in the db
+    template <typename P>
+    static SolveResult solve_c_uncached(Db_intf* db,
+                                        const vector<WordIndex>& answer_order,
+                                        const Feedback::Answer_letters& answer_letters,
+                                        const Word_set& valid_guesses,
+                                        const CMask& m,
+                                        WordIndex guess,
+                                        float score_cutoff,
+                                        int* out_worst_answer_index,
+                                        Deadline& deadline,
+                                        size_t depth);
+
     SolveResult solve_p(Db_intf* db,
                         const vector<WordIndex>& prev_valid_answers,
                         const vector<WordIndex>& prev_valid_guesses,
@@ -94,193 +426,358 @@ namespace Solver {
                         float score_cutoff,
                         bool debug_extra_info_top_level,
                         bool track_time,
-                        ptime timeout) {
+                        ptime timeout,
+                        bool anytime,
+                        const Cancel_token* cancel) {
+        vector<WordIndex> valid_answers = valid_list(m, prev_valid_answers);
+        Word_set guesses = Word_set::of_list(prev_valid_guesses);
+        Deadline deadline(timeout, cancel);
+        static const Solve_metrics metrics("p");
+        return with_counted_policy<adversarial>(metrics, debug_extra_info_top_level, track_time, deadline, anytime, [&] (auto policy) {
+            return solve_p_sets<decltype(policy)>(db,
+                                                  valid_answers.data(),
+                                                  valid_answers.size(),
+                                                  guesses,
+                                                  m,
+                                                  m,
+                                                  score_cutoff,
+                                                  deadline,
+                                                  0);
+        });
+    }
 
-        SolveResult rv;
-        if (db && db->query(m, Job::no_guess, Objective::adversarial, rv)) return rv;
+    template <typename P>
+    static SolveResult solve_p_sets(Db_intf* db,
+                                    const WordIndex* answers,
+                                    size_t num_answers,
+                                    const Word_set& prev_guesses,
+                                    const CMask& new_result,
+                                    const CMask& m,
+                                    float score_cutoff,
+                                    Deadline& deadline,
+                                    size_t depth) {
+        Depth_scratch& scratch = scratch_at(depth);
 
-        ptime start;
-        if (track_time || timeout != boost::posix_time::pos_infin) {
-            start = now();
-            if (start > timeout) throw std::runtime_error("timeout");
+        SolveResult rv;
+        Trace_span span("solve_p", depth, score_cutoff, &rv);
+        if (span) {
+            span.name = std::to_string(num_answers) + " answers";
+            span.args = "\"answers\": " + std::to_string(num_answers);
+            // a contradictory state has none, that's reported further down
+            if (num_answers > 0) span.args += ", \"first_answer\": \"" + word_string(*answers[0]) + "\"";
+        }
+        // Everything the db knows about this state in one lookup, the result for the whole state if
+        // we're lucky, otherwise the results for some of the guesses (see below).
+        vector<Record>& cached = scratch.cached;
+        cached.clear();
+        if (solve_stats) solve_stats->at(depth).p_nodes++;
+        if (db) {
+            Phase_timer timer(Phase::db, depth);
+            uint64_t sample = Metrics::sample_start();
+            db->query_all(m, cached);
+            Db::count_query(Objective::adversarial, !cached.empty(), sample);
+            if (solve_stats) solve_stats->at(depth).db_queries++;
         }
+        vector<pair<Word::Compact, SolveResult>>& cached_guesses = scratch.cached_guesses;
+        cached_guesses.clear();
+        // a result for the state that doesn't settle it, e.g. from a search that was cut off
+        SolveResult cached_state;
+        for (const Record& r : cached) {
+            if (r.first.get_objective() != Objective::adversarial) continue;
+            if (r.first.get_guess() == Job::no_guess) {
+                if (r.second.good_for(score_cutoff)) {
+                    if (solve_stats) solve_stats->at(depth).db_hits++;
+                    if (span) span.set_from_db(&r.second);
+                    return r.second;
+                }
+                cached_state = r.second;
+                continue;
+            }
+            cached_guesses.push_back({r.first.get_guess(), r.second});
+        }
+        // already sorted by guess since they're in Job order and all the same objective
+        // (and if the db's query_all can't find every guess, we still have to ask it about each one)
+        bool query_each_guess = db && !db->query_all_is_complete();
+
+        if (P::has_timeout) deadline.poll();
+        Start_time start;
+        if (P::track_time || time_for_write_back(db)) start = std::chrono::steady_clock::now();
         
         if (m.has_at_most_one_letter_undetermined()) {
-            int num_valid = valid_count(m, prev_valid_answers, rv.best_guess, rv.worst_answer);
-            if (num_valid == 1) {
-                rv.worst_answer = rv.best_guess;
-            }
-            if (adversarial) {
+            int num_valid = num_answers;
+            if (num_valid >= 1) rv.best_guess = rv.worst_answer = answers[0].compact();
+            if (num_valid >= 2) rv.worst_answer = answers[1].compact();
+            if (P::adversarial) {
                 rv.best_score = num_valid;
             } else {
                 rv.best_score = (1.0 + num_valid) / 2.0f;
             }
-            if (track_time) rv.perf_microseconds = (now() - start).total_microseconds();
+            if (P::track_time) rv.perf_microseconds = microseconds_since(start);
 
-            if (debug_extra_info_top_level) {
+            if (P::debug) {
                 cout <<  "At most one letter, determined, no choice but to go through these " << num_valid << endl;
-                for (WordIndex answer : valid_list(m, prev_valid_answers)) {
-                    cout << " " << *answer << endl;
-                }
+                for (size_t i = 0; i < num_answers; i++) cout << " " << *answers[i] << endl;
             }
             return rv;                
         }
         
-        vector<WordIndex> valid_answers = valid_list(m, prev_valid_answers);
-        vector<WordIndex> valid_guesses = valid_list(m, prev_valid_guesses);
-        vector<WordIndex> guesses_to_check;
-        const vector<WordIndex>* guess_to_check_ptr = nullptr; // will point to one of the above
-    
-        if (debug_extra_info_top_level) {
-            vector<pair<int, WordIndex>> scores = sort_by_heuristic(valid_answers, valid_guesses, m);
-            std::reverse(scores.begin(), scores.end());
-            guesses_to_check.reserve(valid_guesses.size());
-            for (unsigned int i = 0 ; i < valid_guesses.size() ; i++) {
-                guesses_to_check.push_back(scores[i].second);
-            }
-            if (debug_extra_info_top_level) {
-                cout << "Sorted " << valid_guesses.size() << " by hueristic: " << guesses_to_check.size() << endl;
-            }
-            guess_to_check_ptr = &guesses_to_check;
-        } else {
-            guess_to_check_ptr = &valid_guesses;
-        }
-
-        if (debug_extra_info_top_level || valid_answers.empty() || valid_guesses.empty()) {
-            cout <<  "num_valid_answers: " << valid_answers.size() << " num_valid_guesses: " << valid_guesses.size() << endl;
-        }
-    
-        if (valid_answers.empty() || valid_guesses.empty()) {
+        // the answers get reordered as we go (see below)
+        vector<WordIndex>& answer_order = scratch.answer_order;
+        answer_order.assign(answers, answers + num_answers);
+        if (answer_order.empty()) {
+            cout <<  "num_valid_answers: 0" << endl;
             throw std::runtime_error("Got no answers or guesses?");
         }
 
-        if (valid_answers.size() == 1) {
+        if (answer_order.size() == 1) {
             rv.best_score = 1;
-            rv.best_guess = *valid_answers[0];
-            rv.worst_answer = *valid_answers[0];
-            if (track_time) rv.perf_microseconds = (now() - start).total_microseconds();
+            rv.best_guess = answer_order[0].compact();
+            rv.worst_answer = answer_order[0].compact();
+            if (P::track_time) rv.perf_microseconds = microseconds_since(start);
             return rv;
-        } else if (valid_answers.size() == 2) {
-            if (adversarial) {
+        } else if (answer_order.size() == 2) {
+            if (P::adversarial) {
                 rv.best_score = 2;
             } else {
                 rv.best_score = 1.5;
             }
-            rv.best_guess = *valid_answers[0];
-            rv.worst_answer = *valid_answers[1];
-            if (track_time) rv.perf_microseconds = (now() - start).total_microseconds();
+            rv.best_guess = answer_order[0].compact();
+            rv.worst_answer = answer_order[1].compact();
+            if (P::track_time) rv.perf_microseconds = microseconds_since(start);
             return rv;
         }
 
         float best_possible_score ;
-        if (adversarial) {
-            if (valid_answers.size() > max_num_results_any_guess) {
+        if (P::adversarial) {
+            if (answer_order.size() > max_num_results_any_guess) {
                 best_possible_score = 3;
             } else {
                 best_possible_score = 2;
             }
         } else {
-            best_possible_score = 1.0f + (valid_answers.size () - 1.0) / valid_answers.size();
+            best_possible_score = 1.0f + (answer_order.size () - 1.0) / answer_order.size();
         }
         if (best_possible_score >= score_cutoff) {
             //std::cout << "cutoff " << m << " " << best_possible_score  << " >= " << score_cutoff << std::endl;
             // CR fix math for non-adversarial
             rv.best_score = score_cutoff;
-            rv.best_guess = *valid_answers[0];
-            rv.worst_answer = *valid_answers[1]; // this isn't necessarily correct in the adversarial-3 case
-            if (track_time) rv.perf_microseconds = (now() - start).total_microseconds();
+            rv.best_guess = answer_order[0].compact();
+            rv.worst_answer = answer_order[1].compact(); // this isn't necessarily correct in the adversarial-3 case
+            if (P::track_time) rv.perf_microseconds = microseconds_since(start);
+            rv.set_bound(Bound::lower);
+            if (solve_stats) solve_stats->at(depth).cutoffs++;
             return rv;
         }
+
+        size_t num_valid_guesses;
+        {
+            Phase_timer timer(Phase::filter, depth);
+            prev_guesses.filter_into(new_result, scratch.valid_guesses);
+            num_valid_guesses = scratch.valid_guesses.count();
+        }
+        const Word_set& valid_guesses = scratch.valid_guesses;
+        vector<WordIndex>& guesses_to_check = scratch.guesses_to_check;
+        if (solve_stats) {
+            solve_stats->at(depth).filters++;
+            solve_stats->at(depth).filtered_guesses += num_valid_guesses;
+        }
     
-        if (debug_extra_info_top_level && valid_answers.size() < 20) {
-            for (WordIndex w : valid_answers) {
+        if (P::debug || P::anytime) {
+            vector<pair<int, WordIndex>> scores = sort_by_heuristic(Word_set::of_list(answer_order), valid_guesses);
+            // if we might stop early, try the guesses that split the answers best first
+            if (!P::anytime) std::reverse(scores.begin(), scores.end());
+            guesses_to_check.clear();
+            for (unsigned int i = 0 ; i < num_valid_guesses ; i++) {
+                guesses_to_check.push_back(scores[i].second);
+            }
+            if (P::debug) {
+                cout << "Sorted " << num_valid_guesses << " by hueristic: " << guesses_to_check.size() << endl;
+            }
+        } else {
+            valid_guesses.to_list(guesses_to_check);
+        }
+        if (P::debug || guesses_to_check.empty()) {
+            cout <<  "num_valid_answers: " << answer_order.size() << " num_valid_guesses: " << num_valid_guesses << endl;
+        }
+        if (guesses_to_check.empty()) {
+            throw std::runtime_error("Got no answers or guesses?");
+        }
+
+        if (P::debug && answer_order.size() < 20) {
+            for (WordIndex w : answer_order) {
                 cout << " Valid answer: " << *w << endl;
             }
         }
 
         double perf_calls = 1;
 
+        // Start from the best guess the db already knows, so every other guess gets a tighter cutoff
+        // from the start. We trust the db that these are all valid guesses. A lower bound doesn't
+        // say how good a guess is, an upper bound does (and we still search that guess below).
+        if (P::adversarial) {
+            if (cached_state.get_bound() == Bound::upper) {
+                rv.best_score = cached_state.best_score;
+                rv.best_guess = cached_state.best_guess;
+                rv.worst_answer = cached_state.worst_answer;
+            }
+            for (const auto& guess_and_result : cached_guesses) {
+                if (guess_and_result.second.get_bound() != Bound::lower && guess_and_result.second.best_score < rv.best_score) {
+                    rv.best_score = guess_and_result.second.best_score;
+                    rv.best_guess = guess_and_result.first;
+                    rv.worst_answer = guess_and_result.second.worst_answer;
+                }
+            }
+            if (rv.best_score <= best_possible_score && !P::debug) {
+                if (P::track_time) rv.perf_microseconds = microseconds_since(start);
+                if (solve_stats) solve_stats->at(depth).db_hits++;
+                if (span) span.set_from_db(&rv);
+                return rv;
+            }
+        }
+
+        // everything above was cheap, this is where a search starts
+        if (yield_hook) yield_hook->at_node();
+
+        // from here on small states are solved on bitmasks, see endgame.hpp. It can't stop part
+        // way, so an anytime top level does the first level itself.
+        if (P::adversarial && !P::debug && !P::anytime &&
+            answer_order.size() <= Endgame::max_answers && guesses_to_check.size() <= Endgame::max_guesses) {
+            {
+                Phase_timer timer(Phase::endgame, depth);
+                Endgame::solve_p(answer_order, guesses_to_check, m, score_cutoff, P::has_timeout ? &deadline : nullptr, rv);
+            }
+            if (solve_stats) {
+                solve_stats->at(depth).endgame_roots++;
+                solve_stats->at(depth).endgame_nodes += rv.perf_calls;
+            }
+            if (span) span.args += ", \"endgame\": true";
+            if (P::track_time) rv.perf_microseconds = microseconds_since(start);
+            if (rv.best_score >= score_cutoff) rv.set_bound(Bound::lower);
+            write_back(db, m, Job::no_guess, rv, start);
+            return rv;
+        }
+
+        Feedback::Answer_letters& answer_letters = scratch.answer_letters;
+        answer_letters.assign(answer_order.data(), answer_order.size());
         map<WordIndex, float> score_by_guess;
         int next_answer_slot_to_swap_into = 0;
-        for (unsigned int guess_index = 0; guess_index < guess_to_check_ptr->size(); guess_index++) {       
-            WordIndex guess = (*guess_to_check_ptr)[guess_index];
-            if (debug_extra_info_top_level) {
-                cout << now() << " On guess #" << guess_index << "/" << valid_guesses.size() << ": " << *guess << "..." << std::flush;
-            }
+        bool timed_out = false;
+        Progress_tracker progress(guesses_to_check.size());
+        try {
+        for (unsigned int guess_index = 0; guess_index < guesses_to_check.size(); guess_index++) {       
+            WordIndex guess = guesses_to_check[guess_index];
+            auto debug_line = [&] () -> std::ostream& {
+                return cout << now() << " Guess #" << guess_index << "/" << num_valid_guesses << ": " << *guess;
+            };
 
             float score_to_use;
-            WordIndex worst_answer = guess; // overwritten later in adversarial, left as this garbage otherwise
+            Word::Compact worst_answer = guess.compact(); // overwritten later in adversarial, left as this garbage otherwise
             // Normally we don't care unless this guess can improve on the best (rv.best_score), but if we are
             // listing all the best guesses we actually care whether this guess matches the best or is worse.
-            float new_cutoff = std::min(score_cutoff, rv.best_score + (debug_extra_info_top_level ? 0.1f : 0));
+            float new_cutoff = std::min(score_cutoff, rv.best_score + (P::debug ? 0.1f : 0));
 
-            if (adversarial) {
+            auto cached_guess =
+                std::lower_bound
+                (cached_guesses.begin(),
+                 cached_guesses.end(),
+                 guess.compact(),
+                 [] (const pair<Word::Compact, SolveResult>& lhs, Word::Compact rhs) { return lhs.first < rhs; });
+
+            if (P::adversarial && cached_guess != cached_guesses.end() && cached_guess->first == guess.compact() &&
+                cached_guess->second.good_for(new_cutoff)) {
+                if (solve_stats) solve_stats->at(depth).db_hits++;
+                score_to_use = cached_guess->second.best_score;
+                worst_answer = cached_guess->second.worst_answer;
+            } else if (P::adversarial) {
                 int worst_answer_index;
                 SolveResult this_guess_worst_case =
-                    solve_c(db,
-                            valid_answers,
-                            valid_guesses,
-                            CMask(m),
-                            guess,
-                            new_cutoff,
-                            false,
-                            false,
-                            &worst_answer_index,
-			    timeout);
+                    (query_each_guess ? solve_c_sets<typename P::Child> : solve_c_uncached<typename P::Child>)
+                    (db,
+                     answer_order,
+                     answer_letters,
+                     valid_guesses,
+                     CMask(m),
+                     guess,
+                     new_cutoff,
+                     &worst_answer_index,
+                     deadline,
+                     depth);
 
 		perf_calls += this_guess_worst_case.perf_calls; 
 
-                worst_answer = valid_answers[worst_answer_index];
+                worst_answer = answer_order[worst_answer_index].compact();
                 if (worst_answer_index > next_answer_slot_to_swap_into) {
                     // hack to sort worst cases up to exit earlier
-                    std::swap(valid_answers[worst_answer_index], valid_answers[next_answer_slot_to_swap_into]);
+                    std::swap(answer_order[worst_answer_index], answer_order[next_answer_slot_to_swap_into]);
+                    answer_letters.swap(worst_answer_index, next_answer_slot_to_swap_into);
                     next_answer_slot_to_swap_into++;
                 }
                 score_to_use = this_guess_worst_case.best_score;
             } else {
                 double sum_answer_s = 0;            
-                map<CMask, float> possible_results;
-                for (unsigned int answer_index = 0 ; answer_index < valid_answers.size() ; answer_index++) {
-                    WordIndex answer = valid_answers[answer_index];
-                    CMask nr(*answer, *guess);
-                    if (!possible_results.count(nr)) {
-		        SolveResult sr = solve_p(nullptr, valid_answers, valid_guesses, CMask(m).apply(nr), new_cutoff - 1, false, false, timeout);
+                float score_by_pattern[Feedback::num_patterns] = {0}; // 0 = not solved yet
+                partition_by_pattern(answer_order, answer_letters, guess, scratch);
+                for (unsigned int answer_index = 0 ; answer_index < answer_order.size() ; answer_index++) {
+                    Feedback::Pattern pattern = scratch.patterns[answer_index];
+                    if (!score_by_pattern[pattern]) {
+                        CMask nr(*answer_order[answer_index], *guess);
+		        SolveResult sr = solve_p_sets<typename P::Child>(nullptr,
+                                                      &scratch.answers_by_pattern[scratch.pattern_start[pattern]],
+                                                      scratch.pattern_start[pattern + 1] - scratch.pattern_start[pattern],
+                                                      valid_guesses, nr, CMask(m).apply(nr), new_cutoff - 1, deadline, depth + 1);
 		        perf_calls += sr.perf_calls; 
 		        // CR fix math for non-adversarial
-		        possible_results[nr] = sr.best_score + 1;
+		        score_by_pattern[pattern] = sr.best_score + 1;
                     }
-                    float s = possible_results.at(nr);
-                    sum_answer_s += s;
+                    sum_answer_s += score_by_pattern[pattern];
                 }
-                score_to_use = sum_answer_s / valid_answers.size();
+                score_to_use = sum_answer_s / answer_order.size();
             }
-            if (debug_extra_info_top_level) {
+            if (P::debug) {
                 score_by_guess.insert({guess, score_to_use});
             }
 
             // we have a score
             if (score_to_use < rv.best_score) {
-                if (debug_extra_info_top_level) {
-                    cout << " took " << score_to_use << " steps (worst answer " << *worst_answer << "), is new best, prev: " << rv.best_guess << " with " << rv.best_score << endl;
+                if (P::debug) {
+                    debug_line() << " took " << score_to_use << " steps (worst answer " << Word(worst_answer) << "), is new best, prev: " << rv.best_guess << " with " << rv.best_score << endl;
                 }
                 rv.best_score = score_to_use;
-                rv.worst_answer = *worst_answer;
-                rv.best_guess = *guess;
-                if (adversarial && score_to_use == 2 && !debug_extra_info_top_level) break;
+                rv.worst_answer = worst_answer;
+                rv.best_guess = guess.compact();
+                if (P::adversarial && score_to_use == 2 && !P::debug) {
+                    progress.step(rv, perf_calls);
+                    break;
+                }
             } else if (score_to_use == rv.best_score) {
-                if (debug_extra_info_top_level) {
-                    cout << " took " << score_to_use << " steps (worst answer " << *worst_answer << "), tied with prev: " << rv.best_guess << " with " << rv.best_score << endl;
+                if (P::debug) {
+                    debug_line() << " took " << score_to_use << " steps (worst answer " << Word(worst_answer) << "), tied with prev: " << rv.best_guess << " with " << rv.best_score << endl;
                 }
             } else {
-                if (debug_extra_info_top_level) {
-                    cout << " took " << score_to_use << " steps (worst answer " << *worst_answer << "), loses to prev: " << rv.best_guess << " with " << rv.best_score << endl;
+                if (P::debug) {
+                    debug_line() << " took " << score_to_use << " steps (worst answer " << Word(worst_answer) << "), loses to prev: " << rv.best_guess << " with " << rv.best_score << endl;
                 }
             }
+            progress.step(rv, perf_calls);
+        }
+        } catch (const Timeout&) {
+            // the best guess so far is only worth returning if it came in under the cutoff, a
+            // score at the cutoff is a lower bound for that guess, not the state
+            if (!P::anytime || rv.best_score >= score_cutoff) throw;
+            timed_out = true;
         }
-        if (track_time) rv.perf_microseconds = (now() - start).total_microseconds();
+        if (P::track_time) rv.perf_microseconds = microseconds_since(start);
         rv.perf_calls = perf_calls;
+        if (timed_out) {
+            // we didn't get to every guess, so the state could do better
+            rv.set_bound(Bound::upper);
+            return rv;
+        }
+        // every guess came out at or above the cutoff, so all we know is that the state does too
+        if (P::adversarial && rv.best_score >= score_cutoff) rv.set_bound(Bound::lower);
+        if (P::adversarial) write_back(db, m, Job::no_guess, rv, start);
 
-        if (debug_extra_info_top_level) {
+        if (P::debug) {
             for (auto const& guess_and_score : score_by_guess) {
                 WordIndex guess = guess_and_score.first;
                 float score = guess_and_score.second;
@@ -303,22 +800,60 @@ namespace Solver {
                         bool debug_extra_info_top_level,
 			bool track_time,
                         int* out_worst_answer_index,
-                        ptime timeout) {
+                        ptime timeout,
+                        bool anytime,
+                        const Cancel_token* cancel) {
         if (debug_extra_info_top_level || valid_answers.empty() || prev_valid_guesses.empty()) {
             cout <<  "num_valid_answers: " << valid_answers.size() << " num_valid_guesses: " << prev_valid_guesses.size() << endl;
         }
+        Feedback::Answer_letters answer_letters(valid_answers);
+        Word_set valid_guesses = Word_set::of_list(prev_valid_guesses).filter(m);
+        Deadline deadline(timeout, cancel);
+        static const Solve_metrics metrics("c");
+        return with_counted_policy<adversarial>(metrics, debug_extra_info_top_level, track_time, deadline, anytime, [&] (auto policy) {
+            return solve_c_sets<decltype(policy)>(db,
+                                                  valid_answers,
+                                                  answer_letters,
+                                                  valid_guesses,
+                                                  m,
+                                                  guess,
+                                                  score_cutoff,
+                                                  out_worst_answer_index,
+                                                  deadline,
+                                                  0);
+        });
+    }
 
-        ptime start;
-        if (track_time || timeout != boost::posix_time::pos_infin) {
-            start = now();
-            if (start > timeout) throw std::runtime_error("timeout");
-        }
-	
+    template <typename P>
+    static SolveResult solve_c_sets(Db_intf* db,
+                                    const vector<WordIndex>& answer_order,
+                                    const Feedback::Answer_letters& answer_letters,
+                                    const Word_set& valid_guesses,
+                                    const CMask& m,
+                                    WordIndex guess,
+                                    float score_cutoff,
+                                    int* out_worst_answer_index,
+                                    Deadline& deadline,
+                                    size_t depth) {
          SolveResult rv;
-         if (db->query(m, *guess, Objective::adversarial, rv)) {
+         bool hit;
+         {
+             Phase_timer timer(Phase::db, depth);
+             hit = db->query(m, *guess, Objective::adversarial, rv) && rv.good_for(score_cutoff);
+         }
+         if (solve_stats) {
+             solve_stats->at(depth).db_queries++;
+             if (hit) solve_stats->at(depth).db_hits++;
+         }
+         if (hit) {
+             Trace_span span("solve_c", depth, score_cutoff, &rv);
+             if (span) {
+                 span.name = word_string(*guess);
+                 span.set_from_db(&rv);
+             }
              if (out_worst_answer_index) {
-                 for (unsigned int answer_index = 0 ; answer_index < valid_answers.size() ; answer_index++) {
-                     if (Word::Compact(*valid_answers[answer_index]) == rv.worst_answer) {
+                 for (unsigned int answer_index = 0 ; answer_index < answer_order.size() ; answer_index++) {
+                     if (answer_order[answer_index].compact() == rv.worst_answer) {
                          *out_worst_answer_index = answer_index;
                          return rv;
                      }
@@ -329,54 +864,109 @@ namespace Solver {
              }
 
          }
+         return solve_c_uncached<P>(db, answer_order, answer_letters, valid_guesses, m, guess, score_cutoff, out_worst_answer_index, deadline, depth);
+     }
+
+    template <typename P>
+    static SolveResult solve_c_uncached(Db_intf* db,
+                                        const vector<WordIndex>& answer_order,
+                                        const Feedback::Answer_letters& answer_letters,
+                                        const Word_set& valid_guesses,
+                                        const CMask& m,
+                                        WordIndex guess,
+                                        float score_cutoff,
+                                        int* out_worst_answer_index,
+                                        Deadline& deadline,
+                                        size_t depth) {
+        if (P::has_timeout) deadline.poll();
+        Start_time start;
+        if (P::track_time || time_for_write_back(db)) start = std::chrono::steady_clock::now();
+	
+         SolveResult rv;
          rv.best_score = 0;
-         rv.best_guess = *guess;
+         rv.best_guess = guess.compact();
+         Trace_span span("solve_c", depth, score_cutoff, &rv);
+         if (span) {
+             span.name = word_string(*guess);
+             span.args = "\"answers\": " + std::to_string(answer_order.size());
+         }
         
-         map<CMask, float> possible_results;
-         for (unsigned int answer_index = 0 ; answer_index < valid_answers.size() ; answer_index++) {
-             WordIndex answer = valid_answers[answer_index];
-             CMask nr(*answer, *guess);                
-             if (debug_extra_info_top_level) {
-                 cout << now() << " On answer #" << answer_index << "/" << valid_answers.size() << ": " << *answer << "..." << std::flush;
-             }
-             if (!possible_results.count(nr)) {
-                 if (answer == guess) {
-                     possible_results[nr] = 1;
+         // answers with the same pattern leave the same state, so we solve each pattern once, and
+         // hand it its answers as a range of scratch.answers_by_pattern
+         Depth_scratch& scratch = scratch_at(depth);
+         if (solve_stats) solve_stats->at(depth).c_nodes++;
+         {
+             Phase_timer timer(Phase::partition, depth);
+             partition_by_pattern(answer_order, answer_letters, guess, scratch);
+         }
+         float score_by_pattern[Feedback::num_patterns] = {0}; // 0 = not solved yet
+         auto solve_child = [&] (WordIndex answer, Feedback::Pattern pattern, Db_intf* child_db) {
+             CMask nr(*answer, *guess);
+             size_t first = scratch.pattern_start[pattern];
+             return solve_p_sets<typename P::Child>(child_db, &scratch.answers_by_pattern[first], scratch.pattern_start[pattern + 1] - first,
+                                                    valid_guesses, nr, CMask(m).apply(nr), score_cutoff - 1, deadline, depth + 1);
+         };
+         bool timed_out = false;
+         Progress_tracker progress(answer_order.size());
+         try {
+         for (unsigned int answer_index = 0 ; answer_index < answer_order.size() ; answer_index++) {
+             WordIndex answer = answer_order[answer_index];
+             Feedback::Pattern pattern = scratch.patterns[answer_index];
+             auto debug_line = [&] () -> std::ostream& {
+                 return cout << now() << " Answer #" << answer_index << "/" << answer_order.size() << ": " << *answer;
+             };
+             if (!score_by_pattern[pattern]) {
+                 if (pattern == Feedback::all_green) {
+                     score_by_pattern[pattern] = 1;
                  } else {
-                     SolveResult sr = solve_p(db, valid_answers, prev_valid_guesses, CMask(m).apply(nr), score_cutoff - 1, false, false, timeout);
+                     SolveResult sr = solve_child(answer, pattern, db);
                      rv.perf_calls += sr.perf_calls; 
-                     possible_results[nr] = sr.best_score + 1;
+                     score_by_pattern[pattern] = sr.best_score + 1;
                  }
              }
-             float s = possible_results.at(nr);
+             float s = score_by_pattern[pattern];
              if (s > rv.best_score) {
-                 if (debug_extra_info_top_level) {
-                     cout << " took " << s << " steps, is new best, prev: " << rv.worst_answer << " with " << rv.best_score << endl;
+                 if (P::debug) {
+                     debug_line() << " took " << s << " steps, is new best, prev: " << rv.worst_answer << " with " << rv.best_score << endl;
                  }
                  rv.best_score = s;
-                 rv.worst_answer = *answer;
+                 rv.worst_answer = answer.compact();
                  if (out_worst_answer_index) *out_worst_answer_index = answer_index;
-             } else if (s == rv.best_score && debug_extra_info_top_level) {
-                 if (debug_extra_info_top_level) { 
-                     cout << " took " << s << " steps, tied with prev: " << rv.worst_answer << " with " << rv.best_score << endl;
+             } else if (s == rv.best_score && P::debug) {
+                 if (P::debug) { 
+                     debug_line() << " took " << s << " steps, tied with prev: " << rv.worst_answer << " with " << rv.best_score << endl;
                  }
              } else {
-                 if (debug_extra_info_top_level) {
-                     cout << " took " << s << " steps, loses to prev: " << rv.worst_answer << " with " << rv.best_score << endl;
+                 if (P::debug) {
+                     debug_line() << " took " << s << " steps, loses to prev: " << rv.worst_answer << " with " << rv.best_score << endl;
                  }
              }
-             if (s >= score_cutoff) break;
+             progress.step(rv, rv.perf_calls);
+             if (s >= score_cutoff) {
+                 if (solve_stats && answer_index + 1 < answer_order.size()) solve_stats->at(depth).cutoffs++;
+                 break;
+             }
+         }
+         } catch (const Timeout&) {
+             if (!P::anytime || rv.best_score == 0) throw;
+             timed_out = true;
          }
-         if (track_time) rv.perf_microseconds = (now() - start).total_microseconds();
-
-         if (debug_extra_info_top_level) {
-             for (WordIndex answer : valid_answers) {
-                 CMask nr(*answer, *guess);
-                 if (!possible_results.count(nr)) {
-                     SolveResult sr = solve_p(nullptr, valid_answers, prev_valid_guesses, CMask(m).apply(nr), score_cutoff - 1, false, false, timeout);
-                     possible_results[nr] = sr.best_score + 1;
+         if (P::track_time) rv.perf_microseconds = microseconds_since(start);
+         // we stopped at the first answer that reached the cutoff (or the timeout), there could
+         // be worse ones
+         if (rv.best_score >= score_cutoff || timed_out) rv.set_bound(Bound::lower);
+         if (timed_out) return rv;
+         write_back(db, m, guess.compact(), rv, start);
+
+         if (P::debug) {
+             for (unsigned int answer_index = 0 ; answer_index < answer_order.size() ; answer_index++) {
+                 WordIndex answer = answer_order[answer_index];
+                 Feedback::Pattern pattern = scratch.patterns[answer_index];
+                 if (!score_by_pattern[pattern]) {
+                     SolveResult sr = solve_child(answer, pattern, nullptr);
+                     score_by_pattern[pattern] = sr.best_score + 1;
                  }
-                 float s = possible_results.at(nr);
+                 float s = score_by_pattern[pattern];
                  if (s == rv.best_score) {
                      cout << " Equally good answer: " << *answer << " with score " << s << endl;
                  }
@@ -386,6 +976,16 @@ namespace Solver {
          return rv;
      }
     
+    template <typename P>
+    static SolveResult solve_b_sets(Db::Db_intf* db,
+                                    const Word_set& valid_answers,
+                                    const Word_set& prev_valid_guesses,
+                                    const CMask& m,
+                                    int num_turns,
+                                    float cutoff,
+                                    Deadline& deadline,
+                                    size_t depth);
+
     SolveResult solve_b(Db::Db_intf* db,
                         const vector<WordIndex>& prev_valid_answers,
                         const vector<WordIndex>& prev_valid_guesses,
@@ -394,25 +994,55 @@ namespace Solver {
                         float cutoff,
                         bool debug_extra_info_top_level,
                         bool track_time,
-                        boost::posix_time::ptime timeout
+                        boost::posix_time::ptime timeout,
+                        bool anytime,
+                        const Cancel_token* cancel
                         ) {
+        Word_set valid_answers = Word_set::of_list(prev_valid_answers).filter(m);
+        Word_set valid_guesses = Word_set::of_list(prev_valid_guesses).filter(m);
+        Deadline deadline(timeout, cancel);
+        static const Solve_metrics metrics("b");
+        return with_counted_policy<false>(metrics, debug_extra_info_top_level, track_time, deadline, anytime, [&] (auto policy) {
+            return solve_b_sets<decltype(policy)>(db, valid_answers, valid_guesses, m, num_turns, cutoff, deadline, 0);
+        });
+    }
+
+    // like solve_p_sets, [valid_answers] and [prev_valid_guesses] are already filtered by [m]
+    template <typename P>
+    static SolveResult solve_b_sets(Db::Db_intf* db,
+                                    const Word_set& valid_answers,
+                                    const Word_set& prev_valid_guesses,
+                                    const CMask& m,
+                                    int num_turns,
+                                    float cutoff,
+                                    Deadline& deadline,
+                                    size_t depth
+                                    ) {
         SolveResult rv;
         if (num_turns <= 0) {
             rv.best_score = 0;
             return rv;
         }
-        if (db && num_turns <= 5 && db->query(m, Job::no_guess, static_cast<Objective>(num_turns), rv)) {
-            return rv;
+        if (solve_stats) solve_stats->at(depth).b_nodes++;
+        if (db && num_turns <= 5) {
+            bool hit;
+            {
+                Phase_timer timer(Phase::db, depth);
+                hit = db->query(m, Job::no_guess, static_cast<Objective>(num_turns), rv);
+            }
+            if (solve_stats) {
+                solve_stats->at(depth).db_queries++;
+                if (hit) solve_stats->at(depth).db_hits++;
+            }
+            if (hit) return rv;
         }
 
-        ptime start;
-        if (track_time || timeout != boost::posix_time::pos_infin) {
-            start = now();
-            if (start > timeout) throw std::runtime_error("timeout");
-        }
+        if (P::has_timeout) deadline.poll();
+        Start_time start;
+        if (P::track_time) start = std::chrono::steady_clock::now();
 
         if (num_turns == 1 || m.has_at_most_one_letter_undetermined()) {
-            int num_valid = valid_count(m, prev_valid_answers, rv.best_guess, rv.best_guess);
+            int num_valid = valid_answers.count_and_first_two(rv.best_guess, rv.best_guess);
             if (!num_valid) {
                 throw std::runtime_error("Got num_valid = 0?");
             }
@@ -422,107 +1052,273 @@ namespace Solver {
             } else {
                 rv.best_score = (static_cast<float>(num_turns)) / num_valid;
             }
-            if (track_time) rv.perf_microseconds = (now() - start).total_microseconds();
+            if (P::track_time) rv.perf_microseconds = microseconds_since(start);
             
-            if (debug_extra_info_top_level) {
+            if (P::debug) {
                 cout <<  "One turn left or at most one letter determined, no choice but to go through " << num_valid << " answers" << endl;
                 if (num_valid < 20) {
-                    for (WordIndex answer : valid_list(m, prev_valid_answers)) {
-                        cout << " " << *answer << endl;
-                    }
+                    valid_answers.for_each([] (WordIndex answer) { cout << " " << *answer << endl; });
                 }
             }
             return rv;                
         }
 
-        vector<WordIndex> valid_answers = valid_list(m, prev_valid_answers);       
-        vector<WordIndex> valid_guesses = valid_list(m, prev_valid_guesses);
+        // everything above was cheap, this is where a search starts
+        if (yield_hook) yield_hook->at_node();
+
+        vector<WordIndex> answer_list = valid_answers.to_list();
+        Feedback::Answer_letters answer_letters(answer_list);
+        vector<Feedback::Pattern> patterns;
+        vector<WordIndex> valid_guesses = prev_valid_guesses.to_list();
 
         if (num_turns > 2) {
-            vector<pair<int, WordIndex>> sorted_guesses = sort_by_heuristic(valid_answers, valid_guesses, m);
+            vector<pair<int, WordIndex>> sorted_guesses = sort_by_heuristic(valid_answers, prev_valid_guesses);
             for (size_t i = 0; i < valid_guesses.size(); i++) {
                 valid_guesses[i] = sorted_guesses[i].second;
             }
         } 
 
         rv.best_score = 0;
+        bool found = false;
+        bool timed_out = false;
+        Progress_tracker progress(valid_guesses.size());
+        try {
         for (unsigned int guess_index = 0; guess_index < valid_guesses.size(); guess_index++) {
             WordIndex guess = valid_guesses[guess_index];
-
-            if (debug_extra_info_top_level) {
-                cout << now() << " On guess #" << guess_index << "/" << valid_guesses.size() << ": " << *guess << "..." << std::flush;
-            }
+            auto debug_line = [&] () -> std::ostream& {
+                return cout << now() << " Guess #" << guess_index << "/" << valid_guesses.size() << ": " << *guess;
+            };
 
             float score_this_guess;
+            Feedback::patterns(answer_letters, guess, patterns);
             if (num_turns == 2) {
+                int count_by_pattern[Feedback::num_patterns] = {0};
+                for (Feedback::Pattern p : patterns) count_by_pattern[p]++;
                 int still_valid_count = 0;
-                map<CMask, int> cache;
-                for (WordIndex a : valid_answers) {
-                    CMask nr(*a, *guess);
-                    if (!cache.count(nr)) {
-                        CMask nm(m);
-                        nm.apply(nr);
-                        int sv = 0;
-                        for (WordIndex a2 : valid_answers) {
-                            if (nm.check(*a2)) sv++;
-                        }
-                        cache.insert({nr, sv});
-                    }
-                    still_valid_count += cache.at(nr);
-                }
-                score_this_guess = (static_cast<float>(valid_answers.size())) / still_valid_count;
+                for (int count : count_by_pattern) still_valid_count += count * count;
+                score_this_guess = (static_cast<float>(answer_list.size())) / still_valid_count;
             } else {
-                map<CMask, float> cache;
+                float score_by_pattern[Feedback::num_patterns];
+                bool solved[Feedback::num_patterns] = {false}; // scores can be 0 here
                 double sum_score = 0;
-                double max_possible_score = valid_answers.size();
-                for (WordIndex a : valid_answers) {
-                    CMask nr(*a, *guess);
-                    if (!cache.count(nr)) {
+                double max_possible_score = answer_list.size();
+                for (size_t answer_index = 0; answer_index < answer_list.size(); answer_index++) {
+                    Feedback::Pattern pattern = patterns[answer_index];
+                    if (!solved[pattern]) {
+                        CMask nr(*answer_list[answer_index], *guess);
                         CMask nm(m);
                         nm.apply(nr);
 
                         // not really clear this cutoff thing helps
-                        float new_cutoff = std::max(cutoff, rv.best_score + (debug_extra_info_top_level ? 0.0001f : 0));
+                        float new_cutoff = std::max(cutoff, rv.best_score + (P::debug ? 0.0001f : 0));
                         
-                        SolveResult sr = solve_b(db, valid_answers, valid_guesses, nm, num_turns - 1, new_cutoff, false, false, timeout);
+                        SolveResult sr = solve_b_sets<typename P::Child>(db, valid_answers.filtered(nr), prev_valid_guesses.filtered(nr), nm, num_turns - 1, new_cutoff, deadline, depth + 1);
                         rv.perf_calls += sr.perf_calls;
-                        cache.insert({nr, sr.best_score});
+                        score_by_pattern[pattern] = sr.best_score;
+                        solved[pattern] = true;
                     }
-                    sum_score += cache.at(nr);
-                    max_possible_score -= (1 - cache.at(nr));
+                    sum_score += score_by_pattern[pattern];
+                    max_possible_score -= (1 - score_by_pattern[pattern]);
 
-                    if (max_possible_score < cutoff - 0.0001f && !debug_extra_info_top_level) {
+                    if (max_possible_score < cutoff - 0.0001f && !P::debug) {
+                        if (solve_stats) solve_stats->at(depth).cutoffs++;
                         break;
                     }
                 }
-                score_this_guess = sum_score / valid_answers.size();
+                score_this_guess = sum_score / answer_list.size();
             }
 
             if (score_this_guess > rv.best_score) {                    
-                if (debug_extra_info_top_level) {
-                    cout << " won with p=" << score_this_guess
+                if (P::debug) {
+                    debug_line() << " won with p=" << score_this_guess
                          << ", is new best, prev: " << rv.best_guess
                          << " with " << rv.best_score << endl;
                 }
 
-                rv.best_guess = *guess;
+                rv.best_guess = guess.compact();
                 rv.best_score = score_this_guess;                
+                found = true;
             } else if (score_this_guess == rv.best_score) {
-                if (debug_extra_info_top_level) {
-                    cout << " won with p=" << score_this_guess
+                if (P::debug) {
+                    debug_line() << " won with p=" << score_this_guess
                          << ", tied with prev: " << rv.best_guess
                          << " with " << rv.best_score << endl;
                 }
             } else {
-                if (debug_extra_info_top_level) {
-                    cout << " won with p=" << score_this_guess
+                if (P::debug) {
+                    debug_line() << " won with p=" << score_this_guess
                          << ", loses to prev: " << rv.best_guess
                          << " with " << rv.best_score << endl;
                 }
             }
+            progress.step(rv, rv.perf_calls);
+        }
+        } catch (const Timeout&) {
+            if (!P::anytime || !found) throw;
+            timed_out = true;
         }
 
-        if (track_time) rv.perf_microseconds = (now() - start).total_microseconds();        
+        if (P::track_time) rv.perf_microseconds = microseconds_since(start);        
+        // a guess we didn't get to could win more often
+        if (timed_out) rv.set_bound(Bound::lower);
         return rv;
     }
+
+    // a db that also remembers everything it was asked to save
+    class Save_log_db : public Read_write_db {
+    public:
+        Save_log_db() : Read_write_db(false) {}
+        using Read_write_db::save;
+        virtual void save(const Job& j, const SolveResult& result) {
+            saved.push_back({j, result});
+            Read_write_db::save(j, result);
+        }
+        vector<Record> saved;
+    };
+
+    void test() {
+        const vector<WordIndex>& answers = Dictionary::get_all_answers();
+        const vector<WordIndex>& guesses = Dictionary::get_all_answers_and_guesses();
+        CMask m;
+        m.apply(CMask(Result("SOARE ___~_")));
+        Write_back_policy prev_policy = get_write_back_policy();
+
+        std::stringstream output;
+        std::stringstream expected;
+
+        // nothing gets written back by default
+        Save_log_db db_default;
+        set_write_back_policy(Write_back_policy());
+        SolveResult rv = solve_p(&db_default, answers, guesses, m, 999, false, false);
+        output << "default: " << rv.best_score << " " << db_default.saved.size() << endl;
+        expected << "default: 4 0" << endl;
+
+        // only exact results that took enough calls, including the root
+        Save_log_db db;
+        set_write_back_policy(Write_back_policy(100, 0));
+        SolveResult first = solve_p(&db, answers, guesses, m, 999, false, false);
+        size_t num_admitted = 0;
+        bool root_saved = false;
+        for (const Record& r : db.saved) {
+            if (r.second.get_bound() == Bound::exact && r.second.perf_calls >= 100) num_admitted++;
+            if (r.first.get_mask() == m && r.first.get_guess() == Job::no_guess) root_saved = r.second.best_score == first.best_score;
+        }
+        output << "written back: " << (db.saved.size() > 0) << " " << (num_admitted == db.saved.size()) << " " << root_saved << endl;
+        expected << "written back: 1 1 1" << endl;
+
+        // and the next solve of the same state is a db hit that writes nothing
+        size_t num_saved = db.saved.size();
+        SolveResult second = solve_p(&db, answers, guesses, m, 999, false, false);
+        output << "second: " << second.best_score << " " << (second.best_guess == first.best_guess) << " " << (db.saved.size() - num_saved) << endl;
+        expected << "second: 4 1 0" << endl;
+
+        // a timeout before anything's found throws, anytime or not
+        ptime past = now() - boost::posix_time::seconds(1);
+        for (bool anytime : {false, true}) {
+            try {
+                solve_p(nullptr, answers, guesses, m, 999, false, false, past, anytime);
+                output << "timeout: none" << endl;
+            } catch (const Timeout&) {
+                output << "timeout: thrown" << endl;
+            }
+            expected << "timeout: thrown" << endl;
+        }
+
+        // one that stops part way through gives the best guess so far, as an upper bound. The
+        // hook cancels the solve once the first few guesses are done.
+        class Cancel_at : public Yield_hook {
+        public:
+            Cancel_at(int n) : n(n), nodes(0) {}
+            virtual void at_node() {
+                if (++nodes == n) cancel.cancel();
+            }
+            int n;
+            int nodes;
+            Cancel_token cancel;
+        };
+        Cancel_at cancel_at(50);
+        set_yield_hook(&cancel_at);
+        SolveResult partial = solve_p(nullptr, answers, guesses, m, 999, false, false, boost::posix_time::pos_infin, true, &cancel_at.cancel);
+        set_yield_hook(nullptr);
+        output << "anytime: " << (partial.get_bound() == Bound::upper) << " " << (partial.best_score >= first.best_score) << " " << Word(partial.best_guess) << endl;
+        expected << "anytime: 1 1 TRICK" << endl;
+
+        // solve_b gives way at its nodes too, so background pwin requests yield
+        Cancel_at counting(-1);
+        set_yield_hook(&counting);
+        solve_b(nullptr, answers, guesses, m, 3, 0, false, false);
+        set_yield_hook(nullptr);
+        output << "solve_b yields: " << (counting.nodes > 0) << endl;
+        expected << "solve_b yields: 1" << endl;
+
+        // the stats add up to perf_calls, this state is small enough to go straight to the endgame
+        Solve_stats stats;
+        set_solve_stats(&stats);
+        SolveResult counted = solve_p(nullptr, answers, guesses, m, 999, false, false);
+        set_solve_stats(nullptr);
+        Depth_stats total = stats.total();
+        output << "stats: " << stats.at(0).p_nodes << " " << stats.at(0).endgame_roots << " "
+               << (total.p_nodes + total.c_nodes + total.endgame_nodes - total.endgame_roots == counted.perf_calls) << endl;
+        expected << "stats: 1 1 1" << endl;
+
+        // the top level reports once per answer, and nothing below it does
+        class Record_progress : public Progress_hook {
+        public:
+            Record_progress() : in_order(true), last_done(0), total(0), best_score(0) {}
+            virtual void on_progress(const Progress& p) {
+                if (p.done != last_done + 1) in_order = false;
+                last_done = p.done;
+                total = p.total;
+                best_score = p.best.best_score;
+            }
+            bool in_order;
+            size_t last_done, total;
+            float best_score;
+        };
+        Record_progress progress;
+        set_progress_hook(&progress);
+        vector<WordIndex> valid_answers = valid_list(m, answers);
+        Save_log_db db_progress;
+        SolveResult reported = solve_c(&db_progress, valid_answers, guesses, m, Dictionary::to_word_index(Word("TRICK")), 999, false, false);
+        set_progress_hook(nullptr);
+        output << "progress: " << progress.in_order << " " << (progress.last_done == valid_answers.size()) << " "
+               << (progress.total == valid_answers.size()) << " " << (progress.best_score == reported.best_score) << endl;
+        expected << "progress: 1 1 1 1" << endl;
+
+        set_write_back_policy(prev_policy);
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Solver::test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
+
+    void slow_test() {
+        const vector<WordIndex>& answers = Dictionary::get_all_answers();
+        const vector<WordIndex>& guesses = Dictionary::get_all_answers_and_guesses();
+
+        std::stringstream output;
+        std::stringstream expected;
+
+        // a time threshold admits cut-off searches' results as well, and they have to keep their
+        // bounds: everything saved as exact is the real score
+        Write_back_policy prev_policy = get_write_back_policy();
+        Save_log_db db_timed;
+        set_write_back_policy(Write_back_policy(0, 1));
+        CMask crane;
+        crane.apply(CMask(Result("CRANE _____")));
+        solve_p(&db_timed, answers, guesses, crane, 999, false, false);
+        set_write_back_policy(prev_policy);
+        size_t num_checked = 0;
+        size_t num_wrong = 0;
+        for (const Record& r : db_timed.saved) {
+            if (!(r.first.get_guess() == Job::no_guess) || r.second.get_bound() != Bound::exact || num_checked == 100) continue;
+            num_checked++;
+            if (solve_p(nullptr, answers, guesses, r.first.get_mask(), 999, false, false).best_score != r.second.best_score) num_wrong++;
+        }
+        output << "timed write back: " << (num_checked == 100) << " " << num_wrong << endl;
+        expected << "timed write back: 1 0" << endl;
+
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Solver::slow_test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
 }
@@ -5,6 +5,10 @@
 #include "dictionary.hpp"
 #include "solveresult.hpp"
 #include "db.hpp"
+#include "word_set.hpp"
+#include "deadline.hpp"
+#include "solve_stats.hpp"
+#include "trace.hpp"
 
 namespace Solver {
     // Solve for the players point of view, returns the best guess.
@@ -25,7 +29,13 @@ namespace Solver {
      // outputs extra debug info, but only for the top level of the tree
      bool track_time,
      // if false we put garbage into rv.perf_microseconds
-     boost::posix_time::ptime timeout = boost::posix_time::pos_infin
+     boost::posix_time::ptime timeout = boost::posix_time::pos_infin,
+     // once [timeout] passes, return the best guess found so far (an upper bound) rather than
+     // throwing Timeout, as long as we found one. The top level then tries the guesses in
+     // sort_by_heuristic order so it's likely to be a good one.
+     bool anytime = false,
+     const Cancel_token* cancel = nullptr
+     // cancel() stops the solve like the timeout does, from any thread
      );
 
 
@@ -52,7 +62,11 @@ namespace Solver {
      int* out_worst_answer_index = nullptr,
      // if non-null then outputs an index into [valid_answsers], or -1
      // if it doesn't know.
-     boost::posix_time::ptime timeout = boost::posix_time::pos_infin
+     boost::posix_time::ptime timeout = boost::posix_time::pos_infin,
+     // once [timeout] passes, return the worst answer found so far (a lower bound) rather than
+     // throwing Timeout, as long as we got through at least one
+     bool anytime = false,
+     const Cancel_token* cancel = nullptr
      );
 
     // Solve for the player's point of view, but try to maximize P(win in X turns | guess) against a
@@ -76,10 +90,70 @@ namespace Solver {
      // if false we put garbage into rv.perf_microseconds
      bool track_time,
      // outputs extra debug info, but only for the top level of the tree.
-     boost::posix_time::ptime timeout = boost::posix_time::pos_infin
+     boost::posix_time::ptime timeout = boost::posix_time::pos_infin,
+     // once [timeout] passes, return the best guess found so far (a lower bound) rather than
+     // throwing Timeout, as long as we found one
+     bool anytime = false,
+     const Cancel_token* cancel = nullptr
      );
     
-    // needed to feed valid_answers into solve_c
+    // Which of their results solve_p and solve_c write back to the db as they go. Only exact
+    // results, and only ones that took at least [min_calls] calls or [min_microseconds] to find:
+    // most states are leaves that are cheaper to solve again than to store. 0 turns a test off,
+    // and timing every state isn't free, so states are only timed when min_microseconds is set.
+    // The default writes nothing back.
+    struct Write_back_policy {
+        Write_back_policy();
+        Write_back_policy(double min_calls, double min_microseconds);
+        double min_calls;
+        double min_microseconds;
+        bool admits(const SolveResult& r, double microseconds) const;
+    };
+    void set_write_back_policy(const Write_back_policy& policy);
+    const Write_back_policy& get_write_back_policy();
+
+    // Lets a long search give way to other work: solve_p and solve_b call at_node() before they
+    // search each state, and at_node() can block for as long as it likes. Per thread, nullptr (the default)
+    // for none. See Server::Scheduler.
+    class Yield_hook {
+    public:
+        virtual ~Yield_hook() {}
+        virtual void at_node() = 0;
+    };
+    void set_yield_hook(Yield_hook* hook);
+
+    // How far the top level of a solve_p, solve_c or solve_b has got, see Progress_hook
+    struct Progress {
+        size_t done; // guesses tried so far (answers for solve_c)
+        size_t total;
+        SolveResult best; // the best guess so far (the worst answer for solve_c)
+        double calls;     // perf_calls so far
+        double seconds;
+        double calls_per_second;
+        // From the calls the last few guesses took rather than all of them: later guesses have
+        // tighter cutoffs and tend to be cheaper. Negative until there's a guess to go on.
+        double eta_seconds;
+    };
+
+    // Lets whoever started a long solve see how it's going: the top level calls on_progress()
+    // after each guess (answer for solve_c), in the solving thread. Per thread, nullptr (the
+    // default) for none. Only the outermost loop on the thread reports.
+    class Progress_hook {
+    public:
+        virtual ~Progress_hook() {}
+        virtual void on_progress(const Progress& p) = 0;
+    };
+    void set_progress_hook(Progress_hook* hook);
+
+    // The solvers on this thread count what they do into [stats] from now on, nullptr (the
+    // default) to stop. See solve_stats.hpp.
+    void set_solve_stats(Solve_stats* stats);
+
+    // The solvers on this thread record the top of the search tree into [tracer] from now on,
+    // nullptr (the default) to stop. See trace.hpp.
+    void set_tracer(Tracer* tracer);
+
+    // needed to feed valid_answers into solve_c. Comes back in WordIndex order.
     std::vector<Dictionary::WordIndex> valid_list(const CMask& m, const std::vector<Dictionary::WordIndex>& dict);
 
     // sometimes useful fast version of valid_list, only returns two arbitrary results (if the rv < 2 we leave the corresponding
@@ -87,9 +161,13 @@ namespace Solver {
     int valid_count(const CMask& m, const std::vector<Dictionary::WordIndex>& dict, Word::Compact& out1, Word::Compact& out2);
 
     
+    // [valid_answers] and [valid_guesses] must already be filtered by the state's CMask
     std::vector<std::pair<int, Dictionary::WordIndex>> sort_by_heuristic
     (
-     const std::vector<Dictionary::WordIndex>& prev_valid_answers,
-     const std::vector<Dictionary::WordIndex>& prev_valid_guesses,
-     const CMask& m);
+     const Word_set& valid_answers,
+     const Word_set& valid_guesses);
+
+    void test();
+    // the tests with bigger solves, only with wordle --self-test
+    void slow_test();
 }
@@ -1,4 +1,6 @@
 #include <sstream>
+#include <cstring>
+#include <cmath>
 #include <boost/lexical_cast.hpp>
 #include "solveresult.hpp"
 
@@ -6,11 +8,45 @@ using std::string;
 using std::stringstream;
 
 namespace Solver {
+    // bounds are written as ">=4" or "<=4", an exact score is just "4"
     std::ostream& operator<<(std::ostream& os, const SolveResult& s) {
-        os << s.best_score << "," << s.best_guess << "," << s.worst_answer << "," << s.perf_calls << "," << s.perf_microseconds;
+        Bound b = s.get_bound();
+        os << (b == Bound::lower ? ">=" : b == Bound::upper ? "<=" : "") << s.best_score << "," << s.best_guess << "," << s.worst_answer
+           << "," << s.perf_calls << "," << s.get_perf_microseconds();
         return os;
     }
 
+    Bound SolveResult::get_bound() const {
+        uint32_t bits;
+        memcpy(&bits, &perf_microseconds, sizeof(bits));
+        if (!(bits >> 31)) return Bound::exact;
+        return (bits & 1) ? Bound::upper : Bound::lower;
+    }
+
+    void SolveResult::set_bound(Bound b) {
+        uint32_t bits;
+        memcpy(&bits, &perf_microseconds, sizeof(bits));
+        bits &= 0x7FFFFFFE;
+        if (b == Bound::lower) bits |= 0x80000000;
+        if (b == Bound::upper) bits |= 0x80000001;
+        memcpy(&perf_microseconds, &bits, sizeof(bits));
+    }
+
+    float SolveResult::get_perf_microseconds() const {
+        return std::fabs(perf_microseconds);
+    }
+
+    void SolveResult::set_perf_microseconds(float microseconds) {
+        Bound b = get_bound();
+        perf_microseconds = microseconds;
+        set_bound(b);
+    }
+
+    bool SolveResult::good_for(float score_cutoff) const {
+        Bound b = get_bound();
+        return b == Bound::exact || (b == Bound::lower && best_score >= score_cutoff);
+    }
+
     std::string SolveResult::to_string() const{
         stringstream ss;
         ss << *this;
@@ -22,7 +58,10 @@ namespace Solver {
         stringstream ss(r);
         string g;
         std::getline(ss, g, ',');
-        t.best_score = boost::lexical_cast<float>(g);
+        Bound b = Bound::exact;
+        if (g.compare(0, 2, ">=") == 0) b = Bound::lower;
+        if (g.compare(0, 2, "<=") == 0) b = Bound::upper;
+        t.best_score = boost::lexical_cast<float>(b == Bound::exact ? g : g.substr(2));
         std::getline(ss, g, ',');
         t.best_guess = Word::Compact(Word(g));
         std::getline(ss, g, ',');
@@ -31,6 +70,7 @@ namespace Solver {
         t.perf_calls = boost::lexical_cast<float>(g);
         std::getline(ss, g, ',');
         t.perf_microseconds = boost::lexical_cast<float>(g);
+        t.set_bound(b);
         return t;
     }
 
@@ -56,13 +96,28 @@ namespace Solver {
             << s << std::endl
             << of_string(s.to_string()) << std::endl
             << sizeof(SolveResult) << std::endl;
+
+        // bounds survive a round trip, and don't change the time
+        s.perf_microseconds = 3;
+        s.set_bound(Bound::lower);
+        SolveResult lower = of_string(s.to_string());
+        s.set_bound(Bound::upper);
+        SolveResult upper = of_string(s.to_string());
+        output1
+            << lower << " " << lower.good_for(4) << lower.good_for(4.5) << lower.good_for(5) << std::endl
+            << upper << " " << upper.good_for(4) << upper.good_for(5) << std::endl;
+        upper.set_bound(Bound::exact);
+        output1 << upper << " " << upper.good_for(1) << std::endl;
 	
         expected
             << "4.5,GUESS,WORST,234234,1.11222e+08" << std::endl
             << "4.5,GUESS,WORST,234234,1.11222e+08" << std::endl
             << "4.5,GUESS,WORST,1.234e+07,1" << std::endl
             << "4.5,GUESS,WORST,1.234e+07,1" << std::endl
-            << "20" << std::endl;
+            << "20" << std::endl
+            << ">=4.5,GUESS,WORST,1.234e+07,3 110" << std::endl
+            << "<=4.5,GUESS,WORST,1.234e+07,3 00" << std::endl
+            << "4.5,GUESS,WORST,1.234e+07,3 1" << std::endl;
 
         std::string output1_str = output1.str();
         std::string expected_str = expected.str();
@@ -1,7 +1,12 @@
 #pragma once
+#include <cstdint>
 #include "word.hpp"
 
 namespace Solver {
+    // What best_score is: the score, or only a bound on it because the search was cut off.
+    // lower: the real score is at least best_score, upper: at most.
+    enum class Bound : uint8_t { exact = 0, lower = 1, upper = 2 };
+
     /* The result of Solver::solve'ing a Db::job. */
 
     class SolveResult {
@@ -15,8 +20,21 @@ namespace Solver {
 		
         // performance stats
         float perf_calls;
+        // A duration is never negative, so its sign bit says whether best_score is a bound, and
+        // then the lowest mantissa bit which side (see get_bound). Records have no room for
+        // another field. Set the bound after perf_microseconds, and read the time with
+        // get_perf_microseconds().
         float perf_microseconds;
 
+        Bound get_bound() const;
+        void set_bound(Bound b);
+        float get_perf_microseconds() const;
+        // sets the time and keeps the bound
+        void set_perf_microseconds(float microseconds);
+        // Whether a search with [score_cutoff] can take this as its result: it's exact, or a
+        // lower bound that's already at or above the cutoff.
+        bool good_for(float score_cutoff) const;
+
         std::string to_string() const;
         static SolveResult of_string(const std::string& r);
 
@@ -26,4 +44,8 @@ namespace Solver {
     };
 
     std::ostream& operator<<(std::ostream& os, const SolveResult& s);
+
+    // what a default-constructed SolveResult holds in best_guess / worst_answer
+    extern const Word no_best_guess;
+    extern const Word no_worst_answer;
 }
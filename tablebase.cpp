@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <thread>
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "tablebase.hpp"
+#include "endgame.hpp"
+#include "feedback.hpp"
+#include "solver.hpp"
+#include "db.hpp"
+
+using std::string;
+using std::vector;
+using std::pair;
+using std::cerr;
+using std::endl;
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+typedef Dictionary::WordIndex WordIndex;
+
+namespace Solver {
+    static const char tablebase_magic[8] = { 'E', 'W', 'T', 'B', '1', 0, 0, 0 };
+
+    static uint64_t mix(uint64_t x) {
+        // splitmix64's finalizer
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return x ^ (x >> 31);
+    }
+
+    // From the letters rather than the WordIndex, so a file stays good if the dictionary is reordered
+    static uint64_t word_code(WordIndex w, uint64_t salt) {
+        Word::Compact c = w.compact();
+        uint64_t letters = 0;
+        for (int p = 0; p < 5; p++) letters |= uint64_t(c[p] - 'A') << (5 * p);
+        return mix(letters ^ salt);
+    }
+
+    uint64_t Tablebase::answer_code(WordIndex w) { return word_code(w, 0x616E737765727300ull); }
+    uint64_t Tablebase::guess_code(WordIndex w) { return word_code(w, 0x6775657373657300ull); }
+
+    uint64_t Tablebase::answers_key(const vector<WordIndex>& answers) {
+        uint64_t key = 0;
+        for (WordIndex w : answers) key ^= answer_code(w);
+        return key;
+    }
+
+    uint64_t Tablebase::guesses_key(const vector<WordIndex>& guesses) {
+        uint64_t key = 0;
+        for (WordIndex w : guesses) key ^= guess_code(w);
+        return key;
+    }
+
+    Tablebase::Tablebase(const string& filename) :
+        mapped(nullptr), mapped_size(0), slots(nullptr), num_slots(0), num_entries(0), max_answers(0)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Error opening tablebase: " + filename);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+            close(fd);
+            throw std::runtime_error("Error stat'ing tablebase or it's too short: " + filename);
+        }
+        mapped_size = st.st_size;
+        mapped = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            mapped = nullptr;
+            throw std::runtime_error("Error mmap'ing tablebase: " + filename);
+        }
+
+        const Header* header = reinterpret_cast<const Header*>(mapped);
+        num_slots = header->num_slots;
+        num_entries = header->num_entries;
+        max_answers = header->max_answers;
+        string error;
+        if (memcmp(header->magic, tablebase_magic, sizeof(tablebase_magic)) != 0) {
+            error = "not a tablebase";
+        } else if (num_slots < 2 || (num_slots & (num_slots - 1)) != 0 || num_entries >= num_slots) {
+            error = "bad number of slots";
+        } else if (mapped_size != sizeof(Header) + num_slots * sizeof(Entry)) {
+            error = "wrong size";
+        }
+        if (!error.empty()) {
+            munmap(mapped, mapped_size);
+            mapped = nullptr;
+            throw std::runtime_error("Bad tablebase, " + error + ": " + filename);
+        }
+        slots = reinterpret_cast<const Entry*>(header + 1);
+
+        if (!Db::silence) cerr << "Opened tablebase: " << filename << " with " << num_entries << " states of up to " << max_answers << " answers" << endl;
+    }
+
+    Tablebase::Tablebase(size_t capacity, size_t max_answers_) :
+        mapped(nullptr), mapped_size(0), slots(nullptr), num_slots(2), num_entries(0), max_answers(max_answers_)
+    {
+        // at most half full, so a miss doesn't probe far
+        while (num_slots < 2 * capacity) num_slots *= 2;
+        owned.assign(num_slots, Entry{0, 0, 0, 0, 0});
+        slots = owned.data();
+    }
+
+    Tablebase::~Tablebase() {
+        if (mapped) munmap(mapped, mapped_size);
+    }
+
+    size_t Tablebase::slot_of(uint64_t answers_key, uint64_t guesses_key) const {
+        return mix(answers_key ^ (guesses_key * 0x9E3779B97F4A7C15ull)) & (num_slots - 1);
+    }
+
+    const Tablebase::Entry* Tablebase::find(uint64_t answers_key, uint64_t guesses_key) const {
+        for (size_t s = slot_of(answers_key, guesses_key); ; s = (s + 1) & (num_slots - 1)) {
+            const Entry& e = slots[s];
+            if (e.answers_key == answers_key && e.guesses_key == guesses_key) return &e;
+            if (e.answers_key == 0 && e.guesses_key == 0) return nullptr;
+        }
+    }
+
+    void Tablebase::insert(const Entry& e) {
+        if (mapped) throw std::runtime_error("Can't insert into a tablebase file");
+        for (size_t s = slot_of(e.answers_key, e.guesses_key); ; s = (s + 1) & (num_slots - 1)) {
+            Entry& slot = owned[s];
+            if (slot.answers_key == e.answers_key && slot.guesses_key == e.guesses_key) {
+                slot = e;
+                return;
+            }
+            if (slot.answers_key == 0 && slot.guesses_key == 0) {
+                if (2 * (num_entries + 1) > num_slots) throw std::runtime_error("Tablebase is full");
+                slot = e;
+                num_entries++;
+                return;
+            }
+        }
+    }
+
+    void Tablebase::write(const string& filename) const {
+        Header header;
+        memcpy(header.magic, tablebase_magic, sizeof(tablebase_magic));
+        header.num_slots = num_slots;
+        header.num_entries = num_entries;
+        header.max_answers = max_answers;
+
+        string tmp_filename = filename + ".tmp";
+        {
+            std::ofstream ofs(tmp_filename, std::ios::binary | std::ios::trunc);
+            ofs.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(slots), num_slots * sizeof(Entry));
+        }
+        if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+            throw std::runtime_error("Error renaming " + tmp_filename + " to " + filename);
+        }
+    }
+
+    ////////////
+    // building
+
+    struct Tablebase_state {
+        CMask m;
+        size_t num_answers;
+    };
+    typedef pair<uint64_t, uint64_t> Tablebase_key;
+
+    // Adds [m] and everything reachable from it within [depth] guesses to [states]. [expanded]
+    // remembers how deep we've already looked from each state, as the same sets come up a lot.
+    static void enumerate(const CMask& m,
+                          const vector<WordIndex>& answers,
+                          const vector<WordIndex>& guesses,
+                          size_t depth,
+                          size_t max_answers,
+                          std::map<Tablebase_key, Tablebase_state>& states,
+                          std::map<Tablebase_key, size_t>& expanded) {
+        if (answers.size() <= 2 || m.has_at_most_one_letter_undetermined()) return;
+        Tablebase_key key(Tablebase::answers_key(answers), Tablebase::guesses_key(guesses));
+        if (answers.size() <= max_answers) states.insert({key, {m, answers.size()}});
+
+        auto it = expanded.find(key);
+        if (depth == 0 || (it != expanded.end() && it->second >= depth)) return;
+        expanded[key] = depth;
+
+        Feedback::Answer_letters letters(answers);
+        vector<Feedback::Pattern> patterns;
+        vector<vector<WordIndex>> buckets(Feedback::num_patterns);
+        for (WordIndex guess : guesses) {
+            Feedback::patterns(letters, guess, patterns);
+            for (vector<WordIndex>& b : buckets) b.clear();
+            for (size_t i = 0; i < answers.size(); i++) buckets[patterns[i]].push_back(answers[i]);
+            for (size_t p = 0; p < Feedback::all_green; p++) {
+                if (buckets[p].size() <= 2) continue;
+                CMask child_m(m);
+                child_m.apply(CMask(*buckets[p][0], *guess));
+                enumerate(child_m, buckets[p], valid_list(child_m, guesses), depth - 1, max_answers, states, expanded);
+            }
+        }
+    }
+
+    // [rank] of [w] in [words]
+    static uint16_t rank_of(const vector<WordIndex>& words, Word::Compact w) {
+        for (size_t i = 0; i < words.size(); i++) {
+            if (words[i].compact() == w) return i;
+        }
+        throw std::runtime_error("Tablebase: solver returned a word that isn't in the state");
+    }
+
+    void build_tablebase(const string& filename,
+                         const vector<CMask>& roots,
+                         size_t max_answers,
+                         size_t depth,
+                         unsigned int num_threads) {
+        if (max_answers > Endgame::max_answers) {
+            throw std::runtime_error("Tablebase states can have at most Endgame::max_answers answers");
+        }
+        ptime start = microsec_clock::local_time();
+        const vector<WordIndex>& all_answers = Dictionary::get_all_answers();
+        const vector<WordIndex>& all_guesses = Dictionary::get_all_answers_and_guesses();
+
+        std::map<Tablebase_key, Tablebase_state> states;
+        {
+            std::map<Tablebase_key, size_t> expanded;
+            for (const CMask& m : roots) {
+                enumerate(m, valid_list(m, all_answers), valid_list(m, all_guesses), depth, max_answers, states, expanded);
+            }
+        }
+        if (!Db::silence) {
+            cerr << "Tablebase: " << states.size() << " states with 3 to " << max_answers << " answers, enumerating took "
+                 << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
+        }
+
+        // Smallest first, so solving a state can look up every smaller state below it. The
+        // endgame looks things up in the table we're building, which only changes between sizes.
+        Tablebase table(states.size(), max_answers);
+        const Tablebase* prev_tablebase = Endgame::get_tablebase();
+        Endgame::set_tablebase(&table);
+        num_threads = std::max(num_threads, 1u);
+        for (size_t n = 3; n <= max_answers; n++) {
+            vector<pair<Tablebase_key, CMask>> todo;
+            for (const auto& s : states) {
+                if (s.second.num_answers == n) todo.push_back({s.first, s.second.m});
+            }
+            vector<Tablebase::Entry> entries(todo.size(), Tablebase::Entry{0, 0, 0, 0, 0});
+            std::atomic<size_t> next(0);
+            vector<std::thread> threads;
+            for (unsigned int t = 0; t < num_threads; t++) {
+                threads.emplace_back([&] () {
+                    for (size_t i = next++; i < todo.size(); i = next++) {
+                        const CMask& m = todo[i].second;
+                        vector<WordIndex> answers = valid_list(m, all_answers);
+                        vector<WordIndex> guesses = valid_list(m, all_guesses);
+                        // the endgame doesn't take states with this many guesses, so it would never ask
+                        if (guesses.size() > Endgame::max_guesses) continue;
+                        SolveResult rv;
+                        Endgame::solve_p(answers, guesses, m, rv.best_score, nullptr, rv);
+                        entries[i] = {todo[i].first.first, todo[i].first.second, rv.best_score,
+                                      rank_of(guesses, rv.best_guess), rank_of(answers, rv.worst_answer)};
+                    }
+                });
+            }
+            for (std::thread& t : threads) t.join();
+            for (const Tablebase::Entry& e : entries) {
+                if (e.answers_key != 0 || e.guesses_key != 0) table.insert(e);
+            }
+        }
+        Endgame::set_tablebase(prev_tablebase);
+
+        table.write(filename);
+        if (!Db::silence) {
+            cerr << "Wrote tablebase: " << filename << " with " << table.size() << " states, took "
+                 << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
+        }
+    }
+
+    void Tablebase::test() {
+        bool was_silent = Db::silence;
+        Db::silence = true;
+        string tmpfile = "/tmp/tmp.tablebase." + std::to_string(getpid()) + ".bin";
+        remove(tmpfile.c_str());
+
+        static_assert(sizeof(Entry) == 24, "tablebase entries should be 24 bytes");
+
+        const vector<WordIndex>& all_answers = Dictionary::get_all_answers();
+        const vector<WordIndex>& all_guesses = Dictionary::get_all_answers_and_guesses();
+        std::stringstream output;
+        std::stringstream expected;
+
+        // insert, write, map, find
+        {
+            Tablebase table(1000, 5);
+            for (uint64_t i = 1; i <= 1000; i++) table.insert({mix(i), mix(i + 5000), float(i % 7), uint16_t(i), uint16_t(i % 64)});
+            table.insert({mix(1), mix(5001), 2, 3, 4});
+            table.write(tmpfile);
+            Tablebase file(tmpfile);
+            size_t num_ok = 0;
+            for (uint64_t i = 2; i <= 1000; i++) {
+                const Entry* e = file.find(mix(i), mix(i + 5000));
+                if (e && e->best_score == float(i % 7) && e->best_guess == i && e->worst_answer == i % 64) num_ok++;
+            }
+            const Entry* replaced = file.find(mix(1), mix(5001));
+            output << file.size() << " " << file.get_max_answers() << " " << num_ok << " "
+                   << (replaced && replaced->best_guess == 3) << " " << (file.find(mix(1), mix(5002)) != nullptr) << endl;
+            expected << "1000 5 999 1 0" << endl;
+        }
+
+        // Build one from a 13-answer state, then the endgame has to give the same answers with it
+        // as without it: for the root, and for what's in the table
+        CMask root = CMask::of_hex("2004250484040404040404040484040404840404040404040404");
+        build_tablebase(tmpfile, {root}, 8, 1, 2);
+        {
+            Tablebase file(tmpfile);
+            vector<WordIndex> answers = valid_list(root, all_answers);
+            vector<WordIndex> guesses = valid_list(root, all_guesses);
+            SolveResult without;
+            Endgame::solve_p(answers, guesses, root, without.best_score, nullptr, without);
+            Endgame::set_tablebase(&file);
+            SolveResult with;
+            Endgame::solve_p(answers, guesses, root, with.best_score, nullptr, with);
+            Endgame::set_tablebase(nullptr);
+            output << with.best_score << " " << Word(with.best_guess) << endl;
+            expected << without.best_score << " " << Word(without.best_guess) << endl;
+
+            // and the endgame really does take the table's word for it, ranks and all
+            Tablebase fake(1, Endgame::max_answers);
+            fake.insert({answers_key(answers), guesses_key(guesses), 2.5, 1, 2});
+            Endgame::set_tablebase(&fake);
+            SolveResult faked;
+            Endgame::solve_p(answers, guesses, root, faked.best_score, nullptr, faked);
+            Endgame::set_tablebase(nullptr);
+            output << faked.best_score << " " << Word(faked.best_guess) << " " << Word(faked.worst_answer) << endl;
+            expected << 2.5 << " " << *guesses[1] << " " << *answers[2] << endl;
+            // ranks are in WordIndex order whatever order the endgame was handed the words in
+            vector<WordIndex> reversed_answers(answers.rbegin(), answers.rend());
+            vector<WordIndex> reversed_guesses(guesses.rbegin(), guesses.rend());
+            Endgame::set_tablebase(&fake);
+            SolveResult reversed;
+            Endgame::solve_p(reversed_answers, reversed_guesses, root, reversed.best_score, nullptr, reversed);
+            Endgame::set_tablebase(nullptr);
+            output << reversed.best_score << " " << Word(reversed.best_guess) << " " << Word(reversed.worst_answer) << endl;
+            expected << 2.5 << " " << *guesses[1] << " " << *answers[2] << endl;
+
+            // every 2-guess child of the root that should be in there, is, with the right answer
+            size_t num_children = 0;
+            size_t num_ok = 0;
+            for (size_t gi = 0; gi < guesses.size(); gi += 7) {
+                for (WordIndex a : answers) {
+                    CMask m(root);
+                    m.apply(CMask(*a, *guesses[gi]));
+                    vector<WordIndex> child_answers = valid_list(m, answers);
+                    vector<WordIndex> child_guesses = valid_list(m, guesses);
+                    if (child_answers.size() <= 2 || child_answers.size() > 8 || m.has_at_most_one_letter_undetermined()) continue;
+                    num_children++;
+                    const Entry* e = file.find(answers_key(child_answers), guesses_key(child_guesses));
+                    SolveResult rv;
+                    Endgame::solve_p(child_answers, child_guesses, m, rv.best_score, nullptr, rv);
+                    if (e && e->best_score == rv.best_score && child_guesses[e->best_guess].compact() == rv.best_guess) num_ok++;
+                }
+            }
+            output << (num_children > 0) << " " << num_ok << endl;
+            expected << "1 " << num_children << endl;
+        }
+
+        remove(tmpfile.c_str());
+        Db::silence = was_silent;
+        std::string output_str = output.str();
+        std::string expected_str = expected.str();
+        if (output_str != expected_str) {
+            throw std::runtime_error("Tablebase::test() failed, got\n" + output_str + ", but expected\n" + expected_str);
+        }
+    }
+}
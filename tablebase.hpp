@@ -0,0 +1,94 @@
+/* Endgame tablebase: exact adversarial scores for small states, keyed by the state's answers and
+   legal guesses rather than by its CMask.
+
+   The same few answers (CATCH/MATCH/HATCH/BATCH/WATCH and friends) come up under thousands of
+   different masks, and the score only depends on which answers are left and which guesses are
+   still legal, so one entry covers every mask that leaves those two sets. A set's key is the xor
+   of a fixed 64-bit code per word (answers and guesses get different codes), so a key can be
+   built up from whatever order the caller has the words in. Two 64-bit keys per entry make a
+   false hit about as likely as a fingerprint db collision.
+
+   The best guess and worst answer are stored as ranks: the position of the word among the
+   state's guesses (or answers) in WordIndex order. That keeps entries at 24 bytes. The endgame's
+   bitsets are in whatever order its root was given the words, so it sorts a hit's few set bits
+   to turn a rank back into a bit.
+
+   `dbtool tablebase` writes the file (see build_tablebase), Endgame looks states up in it before
+   searching them (see Endgame::set_tablebase).
+
+   File layout, all little-endian and mmap'ed:
+     Header
+     Entry slots[num_slots] - open addressing, linear probing, keys of 0 are empty slots
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "dictionary.hpp"
+#include "cmask.hpp"
+
+namespace Solver {
+    class Tablebase {
+    public:
+        struct Header {
+            char magic[8];
+            uint64_t num_slots; // a power of 2
+            uint64_t num_entries;
+            uint64_t max_answers; // every state with 3 to max_answers answers we saw is in here
+        };
+        struct Entry {
+            uint64_t answers_key;
+            uint64_t guesses_key;
+            float best_score;
+            uint16_t best_guess;   // rank among the state's guesses
+            uint16_t worst_answer; // rank among the state's answers
+        };
+
+        // Maps a file written by write()
+        Tablebase(const std::string& filename);
+        // An empty in-memory table with room for [capacity] entries, for building
+        Tablebase(size_t capacity, size_t max_answers);
+        ~Tablebase();
+        Tablebase(const Tablebase&) = delete;
+        Tablebase& operator=(const Tablebase&) = delete;
+
+        static uint64_t answer_code(Dictionary::WordIndex w);
+        static uint64_t guess_code(Dictionary::WordIndex w);
+        // xor of the codes, for building keys from a whole list
+        static uint64_t answers_key(const std::vector<Dictionary::WordIndex>& answers);
+        static uint64_t guesses_key(const std::vector<Dictionary::WordIndex>& guesses);
+
+        // nullptr if the state isn't in the table
+        const Entry* find(uint64_t answers_key, uint64_t guesses_key) const;
+        // in-memory tables only, replaces an entry with the same keys
+        void insert(const Entry& e);
+        void write(const std::string& filename) const;
+
+        size_t size() const { return num_entries; }
+        size_t get_max_answers() const { return max_answers; }
+
+        static void test();
+    private:
+        size_t slot_of(uint64_t answers_key, uint64_t guesses_key) const;
+
+        std::vector<Entry> owned;
+        void* mapped;
+        size_t mapped_size;
+        const Entry* slots;
+        uint64_t num_slots;
+        uint64_t num_entries;
+        uint64_t max_answers;
+    };
+
+    // Enumerates the states reachable from each of [roots] within [depth] guesses (hard mode, every
+    // legal guess and every feedback), keeps the distinct ones with 3 to [max_answers] answers, and
+    // solves them smallest first so each size can look the smaller ones up. Writes the result to
+    // [filename].
+    void build_tablebase
+    (const std::string& filename,
+     const std::vector<CMask>& roots,
+     size_t max_answers,
+     size_t depth,
+     unsigned int num_threads);
+}
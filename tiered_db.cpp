@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <sstream>
+#include <chrono>
+#include <filesystem>
+#include <unistd.h>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "tiered_db.hpp"
+
+using std::string;
+using std::vector;
+using std::pair;
+using std::shared_ptr;
+using std::make_shared;
+using std::cerr;
+using std::endl;
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+using Solver::SolveResult;
+namespace fs = std::filesystem;
+
+namespace Db {
+    static const string base_name = "base.bin";
+    static const string memtable_log_name = "memtable.log";
+
+    Tiered_db::Tiered_db(const string& dir_, size_t max_memtable_records_, size_t max_runs_) :
+        dir(dir_),
+        max_memtable_records(std::max<size_t>(max_memtable_records_, 1)),
+        max_runs(max_runs_),
+        next_run_seq(0),
+        compaction_wanted(false),
+        stopping(false)
+    {
+        fs::create_directories(dir);
+
+        vector<pair<uint64_t, string>> run_files;
+        for (const fs::directory_entry& e : fs::directory_iterator(dir)) {
+            string name = e.path().filename().string();
+            if (name.size() > 4 && name.substr(name.size() - 4) == ".tmp") {
+                // left over from a crash in the middle of a flush or compaction
+                fs::remove(e.path());
+            } else if (name.size() > 8 && name.substr(0, 4) == "run." && name.substr(name.size() - 4) == ".bin") {
+                uint64_t seq = std::stoull(name.substr(4, name.size() - 8));
+                run_files.push_back({seq, e.path().string()});
+            }
+        }
+        std::sort(run_files.begin(), run_files.end());
+        for (const auto& seq_and_file : run_files) {
+            runs.push_back(make_shared<const Mapped_file>(seq_and_file.second));
+            next_run_seq = seq_and_file.first + 1;
+        }
+
+        if (fs::exists(dir + "/" + base_name)) {
+            base = make_shared<const Mapped_file>(dir + "/" + base_name);
+        }
+
+        // replay whatever didn't make it into a run last time
+        {
+            std::ifstream ifs(dir + "/" + memtable_log_name, std::ios::binary);
+            Record next_record;
+            while (ifs.read(reinterpret_cast<char*>(&next_record), sizeof(next_record))) {
+                memtable[next_record.first] = next_record.second;
+            }
+        }
+        memtable_log.open(dir + "/" + memtable_log_name, std::ios::binary | std::ios::app);
+        memtable_log.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+
+        if (!silence) {
+            cerr << "Opened tiered db: " << dir << " with " << (base ? base->size() : 0) << " base records, "
+                 << runs.size() << " runs and " << memtable.size() << " memtable records" << endl;
+        }
+
+        if (memtable.size() >= max_memtable_records) {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            flush_locked();
+        }
+        if (max_runs > 0) {
+            compaction_wanted = runs.size() >= max_runs;
+            compactor = std::thread(&Tiered_db::compactor_main, this);
+        }
+    }
+
+    Tiered_db::~Tiered_db() {
+        {
+            std::lock_guard<std::mutex> lock(compactor_wakeup_mutex);
+            stopping = true;
+        }
+        compactor_wakeup.notify_all();
+        if (compactor.joinable()) compactor.join();
+
+        try {
+            flush();
+        } catch (const std::exception& e) {
+            cerr << "Tiered db: failed to flush " << dir << " on shutdown, memtable.log still has it: " << e.what() << endl;
+        }
+    }
+
+    string Tiered_db::run_filename(uint64_t seq) const {
+        return dir + "/run." + std::to_string(seq) + ".bin";
+    }
+
+    void Tiered_db::save(const Job& j, const SolveResult& r) {
+        // newest wins, so a bound mustn't hide an exact result we already have
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        SolveResult prev;
+        if (r.get_bound() != Solver::Bound::exact && query_locked(j, prev) && prev.get_bound() == Solver::Bound::exact) return;
+        memtable[j] = r;
+        Record next_record = { j, r };
+        memtable_log.write(reinterpret_cast<char*>(&next_record), sizeof(next_record));
+        memtable_log.flush();
+        if (memtable.size() >= max_memtable_records) flush_locked();
+    }
+
+    bool Tiered_db::query(const Job& j, SolveResult& result) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return query_locked(j, result);
+    }
+
+    bool Tiered_db::query_locked(const Job& j, SolveResult& result) const {
+        auto it = memtable.find(j);
+        if (it != memtable.end()) {
+            result = it->second;
+            return true;
+        }
+        for (auto run = runs.rbegin(); run != runs.rend(); ++run) {
+            if ((*run)->query(j, result)) return true;
+        }
+        return base && base->query(j, result);
+    }
+
+    size_t Tiered_db::query_all(const CMask& m, vector<Record>& out) const {
+        // same Job in several tiers means the newest one wins, and we look newest first
+        std::map<Job, SolveResult> found;
+        vector<Record> from_file;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            for (auto it = memtable.lower_bound(Job::first_for_mask(m)); it != memtable.end() && it->first.get_mask() == m; ++it) {
+                found.insert(*it);
+            }
+            for (auto run = runs.rbegin(); run != runs.rend(); ++run) {
+                (*run)->query_all(m, from_file);
+            }
+            if (base) base->query_all(m, from_file);
+        }
+        found.insert(from_file.begin(), from_file.end());
+        out.insert(out.end(), found.begin(), found.end());
+        return found.size();
+    }
+
+    void Tiered_db::flush() {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        flush_locked();
+    }
+
+    size_t Tiered_db::num_runs() const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        return runs.size();
+    }
+
+    void Tiered_db::flush_locked() {
+        if (memtable.empty()) return;
+
+        // the map is already sorted, so this is just a copy into a flat array
+        vector<Record> sorted(memtable.begin(), memtable.end());
+        string filename = run_filename(next_run_seq);
+        write_sorted_file(filename, {{sorted.data(), sorted.data() + sorted.size()}});
+        runs.push_back(make_shared<const Mapped_file>(filename));
+        next_run_seq++;
+
+        memtable.clear();
+        memtable_log.close();
+        memtable_log.open(dir + "/" + memtable_log_name, std::ios::binary | std::ios::trunc);
+        if (!silence) cerr << "Tiered db: flushed " << sorted.size() << " records to " << filename << endl;
+
+        if (max_runs > 0 && runs.size() >= max_runs) {
+            std::lock_guard<std::mutex> wakeup_lock(compactor_wakeup_mutex);
+            compaction_wanted = true;
+            compactor_wakeup.notify_all();
+        }
+    }
+
+    void Tiered_db::compact() {
+        std::lock_guard<std::mutex> compaction_lock(compaction_mutex);
+
+        vector<shared_ptr<const Mapped_file>> runs_to_merge;
+        shared_ptr<const Mapped_file> old_base;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex);
+            runs_to_merge = runs;
+            old_base = base;
+        }
+        if (runs_to_merge.empty()) return;
+
+        ptime start = microsec_clock::local_time();
+        vector<pair<const Record*, const Record*>> sources;
+        for (auto run = runs_to_merge.rbegin(); run != runs_to_merge.rend(); ++run) {
+            sources.push_back({(*run)->begin(), (*run)->end()});
+        }
+        if (old_base) sources.push_back({old_base->begin(), old_base->end()});
+
+        // Queries keep going against the old files while we write. Renaming over base.bin doesn't
+        // invalidate the old mapping.
+        write_sorted_file(dir + "/" + base_name, sources);
+        shared_ptr<const Mapped_file> new_base = make_shared<const Mapped_file>(dir + "/" + base_name);
+        {
+            std::unique_lock<std::shared_mutex> lock(mutex);
+            base = new_base;
+            // anything flushed while we were merging was appended after the runs we merged
+            runs.erase(runs.begin(), runs.begin() + runs_to_merge.size());
+        }
+        for (const auto& run : runs_to_merge) {
+            fs::remove(run->get_filename());
+            fs::remove(run->get_filename() + ".idx");
+        }
+        if (!silence) {
+            cerr << "Tiered db: compacted " << runs_to_merge.size() << " runs into " << new_base->size()
+                 << " base records, took " << (microsec_clock::local_time() - start).total_microseconds() / 1e6 << "s" << endl;
+        }
+    }
+
+    void Tiered_db::compactor_main() {
+        int backoff_seconds = 1;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(compactor_wakeup_mutex);
+                compactor_wakeup.wait(lock, [this] { return stopping || compaction_wanted; });
+                if (stopping) return;
+                compaction_wanted = false;
+            }
+            // a compact() call may have already merged the runs that woke us up
+            if (num_runs() < max_runs) continue;
+            try {
+                compact();
+                backoff_seconds = 1;
+            } catch (const std::exception& e) {
+                // the runs are all still there, so nothing's lost but query time
+                cerr << "Tiered db: compaction of " << dir << " failed, trying again in " << backoff_seconds << "s: " << e.what() << endl;
+                std::unique_lock<std::mutex> lock(compactor_wakeup_mutex);
+                if (compactor_wakeup.wait_for(lock, std::chrono::seconds(backoff_seconds), [this] { return stopping; })) return;
+                backoff_seconds = std::min(backoff_seconds * 2, max_compaction_backoff_seconds);
+                compaction_wanted = true;
+            }
+        }
+    }
+
+    void Tiered_db::test() {
+        silence = true;
+        string tmpdir = "/tmp/tmp.tiered_db." + std::to_string(getpid());
+        fs::remove_all(tmpdir);
+        fs::create_directories(tmpdir);
+
+        std::stringstream output;
+        std::stringstream expected;
+        SolveResult s1, s2, s3, s4, s5, r;
+        s1.best_score = 1; s1.best_guess = Word("AAAAA");
+        s2.best_score = 2; s2.best_guess = Word("BBBBB");
+        s3.best_score = 3; s3.best_guess = Word("CCCCC");
+        s4.best_score = 4; s4.best_guess = Word("DDDDD");
+        s5.best_score = 5; s5.best_guess = Word("EEEEE");
+
+        Job k1(CMask(Word("CRATE"), Word("ABCDE")), Job::no_guess, Objective::adversarial);
+        Job k2(CMask(Word("ROATE"), Word("SOARE")), Word("XYZNW"), Objective::pwin2);
+        Job k3(CMask(Word("MOTEL"), Word("HOTEL")), Word("ABCDE"), Objective::adversarial);
+        Job k4(CMask(Word("MOTEL"), Word("HOTEL")), Job::no_guess, Objective::adversarial);
+        Job k5(CMask(), Job::no_guess, Objective::adversarial);
+
+        // pretend we crashed with k5 in the memtable, Read_write_db writes the same format
+        {
+            Read_write_db rw(false);
+            rw.set_output_file(tmpdir + "/" + memtable_log_name);
+            rw.save(k5, s5);
+        }
+
+        {
+            Tiered_db db(tmpdir, 2, 0);
+            db.save(k1, s1);
+            output << db.num_runs() << " " << db.query(k1, r) << r.best_score << " " << db.query(k2) << endl;
+            db.save(k2, s2);
+            db.save(k3, s3);
+            db.save(k1, s4); // newer result wins
+            db.save(k4, s4);
+            output << db.num_runs()
+                   << " " << db.query(k1, r) << r.best_score
+                   << " " << db.query(k2, r) << r.best_score
+                   << " " << db.query(k3, r) << r.best_score
+                   << " " << db.query(k4, r) << r.best_score
+                   << " " << db.query(k5, r) << r.best_score << endl;
+            db.compact();
+            output << db.num_runs()
+                   << " " << db.query(k1, r) << r.best_score
+                   << " " << db.query(k2, r) << r.best_score
+                   << " " << db.query(k5, r) << r.best_score << endl;
+
+            // k3 and k4 are both in the base now, and k3 again in the memtable
+            SolveResult s6;
+            s6.best_score = 6;
+            db.save(k3, s6);
+            vector<Record> all;
+            output << db.query_all(k3.get_mask(), all);
+            for (const Record& rec : all) output << " " << rec.first.get_guess() << rec.second.best_score;
+            output << endl;
+        }
+
+        expected << "1 11 0" << endl;
+        expected << "3 14 12 13 14 15" << endl;
+        expected << "0 14 12 15" << endl;
+        expected << "2 ABCDE6 YYYYY4" << endl;
+
+        {
+            // base.bin is a regular Read_only_db file
+            Read_only_db ro(tmpdir + "/" + base_name);
+            output << ro.query(k1, r) << r.best_score
+                   << " " << ro.query(k2, r) << r.best_score
+                   << " " << ro.query(k3, r) << r.best_score
+                   << " " << ro.query(k5, r) << r.best_score << endl;
+            Tiered_db db(tmpdir, 2, 0);
+            output << db.num_runs() << " " << db.query(k4, r) << r.best_score << " " << db.query(k3, r) << r.best_score << endl;
+        }
+        expected << "14 12 13 15" << endl;
+        expected << "1 14 16" << endl;
+
+        fs::remove_all(tmpdir);
+        silence = false;
+        std::string output_str = output.str();
+        std::string expected_str = expected.str();
+        if (output_str != expected_str) {
+            throw std::runtime_error("Tiered_db::test() failed, got\n" + output_str + ", but expected\n" + expected_str);
+        }
+    }
+}
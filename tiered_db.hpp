@@ -0,0 +1,79 @@
+/* A Db_intf that can keep taking new results without holding everything in RAM, the same
+   idea as an LSM tree.
+
+   Everything lives in one directory:
+     memtable.log  - append-only log of the records in the memtable, replayed on startup
+     run.<N>.bin   - immutable sorted runs, each one is a flushed memtable. Higher N is newer.
+     base.bin      - the big sorted file, same format as a Read_only_db file.
+
+   save goes to the bounded in-memory memtable, when it fills up it's flushed to a new run.
+   query checks the memtable, then the runs newest first, then the base. Once there are enough
+   runs a background thread merges them all into a new base. If that fails (e.g. the disk is full)
+   it says so and tries again later, backing off up to max_compaction_backoff_seconds.
+*/
+
+#pragma once
+#include <map>
+#include <vector>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include "db.hpp"
+
+namespace Db {
+    class Tiered_db : public Db_intf {
+    public:
+        // max_memtable_records: flush the memtable to a new run once it has this many records.
+        // max_runs: compact all runs into the base once there are this many, 0 = never compact
+        // automatically.
+        Tiered_db(const std::string& dir, size_t max_memtable_records, size_t max_runs);
+        virtual ~Tiered_db();
+
+        using Db_intf::save;
+        using Db_intf::query;
+        virtual void save(const Job& j, const Solver::SolveResult& result);
+        virtual bool query(const Job& j, Solver::SolveResult& result) const;
+        virtual size_t query_all(const CMask& m, std::vector<Record>& out) const;
+
+        // write the memtable out as a new run
+        void flush();
+        // merge all runs into the base, blocks until done
+        void compact();
+
+        size_t num_runs() const;
+
+        static constexpr int max_compaction_backoff_seconds = 300;
+
+        static void test();
+    private:
+        std::string run_filename(uint64_t seq) const;
+        void flush_locked();
+        // query, with [mutex] already held shared or unique
+        bool query_locked(const Job& j, Solver::SolveResult& result) const;
+        void compactor_main();
+
+        const std::string dir;
+        const size_t max_memtable_records;
+        const size_t max_runs;
+
+        mutable std::shared_mutex mutex;
+        std::map<Job, Solver::SolveResult> memtable;
+        std::ofstream memtable_log;
+        std::vector<std::shared_ptr<const Mapped_file>> runs; // oldest first
+        std::shared_ptr<const Mapped_file> base;
+        uint64_t next_run_seq;
+
+        // only one compaction at a time, whether from [compact] or the background thread
+        std::mutex compaction_mutex;
+        std::mutex compactor_wakeup_mutex;
+        std::condition_variable compactor_wakeup;
+        // both guarded by compactor_wakeup_mutex, which is always taken after [mutex] if both are needed
+        bool compaction_wanted;
+        bool stopping;
+        std::thread compactor;
+    };
+}
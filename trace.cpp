@@ -0,0 +1,83 @@
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include "trace.hpp"
+
+using std::string;
+using std::endl;
+
+namespace Solver {
+    Tracer::Tracer(size_t max_depth_) : max_depth(max_depth_), start(std::chrono::steady_clock::now()) {}
+
+    int64_t Tracer::now_us() const {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void Tracer::record(const char* category, const string& name, int64_t start_us, int64_t end_us, const string& args_json) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto thread = std::find(threads.begin(), threads.end(), std::this_thread::get_id());
+        if (thread == threads.end()) thread = threads.insert(thread, std::this_thread::get_id());
+        int tid = thread - threads.begin() + 1;
+        spans.push_back({category, name, start_us, end_us - start_us, tid, args_json});
+    }
+
+    size_t Tracer::num_spans() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return spans.size();
+    }
+
+    string Tracer::quote(const string& s) {
+        string rv = "\"";
+        for (char c : s) {
+            if (c == '"' || c == '\\') {
+                rv += '\\';
+                rv += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                rv += ' ';
+            } else {
+                rv += c;
+            }
+        }
+        return rv + "\"";
+    }
+
+    void Tracer::write_json(std::ostream& os) {
+        std::lock_guard<std::mutex> lock(mutex);
+        os << "{\"traceEvents\": [";
+        bool first = true;
+        for (size_t tid = 1; tid <= threads.size(); tid++) {
+            os << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+               << ", \"args\": {\"name\": \"solver " << tid << "\"}}";
+            first = false;
+        }
+        for (const Span& s : spans) {
+            os << (first ? "" : ",") << "\n{\"name\": " << quote(s.name) << ", \"cat\": \"" << s.category << "\", \"ph\": \"X\""
+               << ", \"ts\": " << s.start_us << ", \"dur\": " << s.duration_us << ", \"pid\": 1, \"tid\": " << s.tid
+               << ", \"args\": {" << s.args_json << "}}";
+            first = false;
+        }
+        os << "\n], \"displayTimeUnit\": \"ms\"}" << endl;
+    }
+
+    void Tracer::test() {
+        std::stringstream output;
+        std::stringstream expected;
+
+        Tracer tracer(2);
+        tracer.record("solve_p", "2 answers", 5, 12, "\"score\": 2");
+        std::thread([&] { tracer.record("solve_c", "SO\"ARE", 6, 7, ""); }).join();
+        output << tracer.num_spans() << endl;
+        expected << "2" << endl;
+        tracer.write_json(output);
+        expected << "{\"traceEvents\": [\n"
+                 << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"solver 1\"}},\n"
+                 << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"solver 2\"}},\n"
+                 << "{\"name\": \"2 answers\", \"cat\": \"solve_p\", \"ph\": \"X\", \"ts\": 5, \"dur\": 7, \"pid\": 1, \"tid\": 1, \"args\": {\"score\": 2}},\n"
+                 << "{\"name\": \"SO\\\"ARE\", \"cat\": \"solve_c\", \"ph\": \"X\", \"ts\": 6, \"dur\": 1, \"pid\": 1, \"tid\": 2, \"args\": {}}\n"
+                 << "], \"displayTimeUnit\": \"ms\"}" << endl;
+
+        if (output.str() != expected.str()) {
+            throw std::runtime_error("Tracer::test() failed, got\n" + output.str() + "but expected\n" + expected.str());
+        }
+    }
+}
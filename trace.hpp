@@ -0,0 +1,65 @@
+/* A timeline of the top of the search tree, written as Chrome trace JSON so a long root analysis
+   can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing afterwards.
+
+   Every solve_p state and solve_c guess in the top [max_depth] solve_p levels becomes one span,
+   nested the way the search is: a state's span holds one span per guess it tried, and each of
+   those one span per answer bucket's state. The spans say what was searched (answers, guess),
+   what came of it (score, bound, best guess or worst answer), the cutoff it was searched with and
+   whether the db settled it, so the wide spans are the subtrees that dominated and a guess whose
+   score came out way above the cutoff is pruning that didn't happen.
+
+   Like Solve_stats, a thread only traces once it's been given a Tracer (Solver::set_tracer), but
+   threads can share one: spans are only recorded for the top levels, so a lock per span is
+   cheap. Every thread gets its own track.
+*/
+
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+
+namespace Solver {
+    class Tracer {
+    public:
+        // traces solve_p depths 0 .. max_depth - 1
+        Tracer(size_t max_depth);
+
+        size_t get_max_depth() const { return max_depth; }
+        // microseconds since the Tracer was made, what spans are timed in
+        int64_t now_us() const;
+
+        // A span on the calling thread's track. [args_json] is the inside of a JSON object
+        // ("\"score\": 3, ..."), or empty.
+        void record(const char* category, const std::string& name, int64_t start_us, int64_t end_us, const std::string& args_json);
+        size_t num_spans();
+
+        // {"traceEvents": [...]}, the spans in the order they finished
+        void write_json(std::ostream& os);
+
+        // [s] as a JSON string, for building args_json. The server's replies use it too.
+        static std::string quote(const std::string& s);
+
+        static void test();
+    private:
+        struct Span {
+            const char* category;
+            std::string name;
+            int64_t start_us;
+            int64_t duration_us;
+            int tid;
+            std::string args_json;
+        };
+
+        size_t max_depth;
+        std::chrono::steady_clock::time_point start;
+
+        // guarded by mutex
+        std::mutex mutex;
+        std::vector<Span> spans;
+        std::vector<std::thread::id> threads; // a thread's tid is its index + 1, easier to read
+    };
+}
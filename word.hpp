@@ -23,12 +23,14 @@ public:
     friend class Result;
     friend class Mask;
     friend class CMask;
+    friend class Dictionary;
 
     class Compact {
     public:
         Compact(const Word& w) : c(w.compact.c) {}
         bool operator<(Compact o) const { return c < o.c; }
         bool operator==(Compact o) const { return c == o.c; }
+        char operator[](int pos) const { return 'A' + ((c >> (5 * (4 - pos))) & 0x1F); }
     private:
         Compact() : c(0) {}
         Compact(int32_t c_) : c(c_) {}
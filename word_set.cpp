@@ -0,0 +1,276 @@
+#include <sstream>
+#include <algorithm>
+#include "word_set.hpp"
+
+using std::vector;
+typedef Dictionary::WordIndex WordIndex;
+
+// Sets with at most this many words are filtered with a CMask::check per word, see filter_blocks.
+// Measured, 64 was the best for SOARE/CRANE.
+static const size_t sparse_limit = 64;
+
+// The inverted index, one bitset per constraint over every word in the dictionary, all in one
+// flat array. Built the first time anyone filters.
+struct Word_set_index {
+    size_t num_blocks;
+    vector<uint64_t> data;
+
+    static const size_t num_at = 26 * 5;     // L at position p
+    static const size_t num_counts = 26 * 4; // at least / exactly k L's, k = 0..3
+
+    const uint64_t* at(int letter, int pos) const { return &data[(letter * 5 + pos) * num_blocks]; }
+    const uint64_t* at_least(int letter, int k) const { return &data[(num_at + letter * 4 + k) * num_blocks]; }
+    const uint64_t* exactly(int letter, int k) const { return &data[(num_at + num_counts + letter * 4 + k) * num_blocks]; }
+
+    Word_set_index() {
+        const vector<WordIndex>& words = Dictionary::get_all_answers_and_guesses();
+        size_t num_bits = Word_set::bit_of(words.back()) + 1;
+        num_blocks = (num_bits + 63) / 64;
+        data.assign((num_at + 2 * num_counts) * num_blocks, 0);
+        auto set = [this] (size_t bitset, size_t bit) { data[bitset * num_blocks + bit / 64] |= uint64_t(1) << (bit % 64); };
+
+        for (WordIndex w : words) {
+            size_t bit = Word_set::bit_of(w);
+            int counts[26] = {0};
+            for (int p = 0; p < 5; p++) {
+                int letter = (*w)[p] - 'A';
+                set(letter * 5 + p, bit);
+                counts[letter]++;
+            }
+            for (int letter = 0; letter < 26; letter++) {
+                for (int k = 0; k <= counts[letter] && k < 4; k++) set(num_at + letter * 4 + k, bit);
+                if (counts[letter] < 4) set(num_at + num_counts + letter * 4 + counts[letter], bit);
+            }
+        }
+    }
+
+    static const Word_set_index& get() {
+        static const Word_set_index index;
+        return index;
+    }
+};
+
+WordIndex Word_set::word_index_of(size_t bit) {
+    return WordIndex(bit);
+}
+
+size_t Word_set::bit_of(WordIndex w) {
+    return w.index;
+}
+
+const Word_set& Word_set::all_answers() {
+    static const Word_set s = of_list(Dictionary::get_all_answers());
+    return s;
+}
+
+const Word_set& Word_set::all_answers_and_guesses() {
+    static const Word_set s = of_list(Dictionary::get_all_answers_and_guesses());
+    return s;
+}
+
+Word_set Word_set::of_list(const vector<WordIndex>& words) {
+    vector<size_t> bits;
+    bits.reserve(words.size());
+    for (WordIndex w : words) bits.push_back(bit_of(w));
+    std::sort(bits.begin(), bits.end());
+    Word_set s;
+    for (size_t bit : bits) {
+        if (s.blocks.empty() || s.blocks.back().index != bit / 64) s.blocks.push_back({0, static_cast<uint32_t>(bit / 64)});
+        s.blocks.back().bits |= uint64_t(1) << (bit % 64);
+    }
+    return s;
+}
+
+vector<WordIndex> Word_set::to_list() const {
+    vector<WordIndex> rv;
+    to_list(rv);
+    return rv;
+}
+
+void Word_set::to_list(vector<WordIndex>& out) const {
+    out.clear();
+    for_each([&out] (WordIndex w) { out.push_back(w); });
+}
+
+bool Word_set::block_before(const Block& b, uint32_t index) {
+    return b.index < index;
+}
+
+void Word_set::insert(WordIndex w) {
+    size_t bit = bit_of(w);
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), static_cast<uint32_t>(bit / 64), block_before);
+    if (it == blocks.end() || it->index != bit / 64) it = blocks.insert(it, {0, static_cast<uint32_t>(bit / 64)});
+    it->bits |= uint64_t(1) << (bit % 64);
+}
+
+bool Word_set::contains(WordIndex w) const {
+    size_t bit = bit_of(w);
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), static_cast<uint32_t>(bit / 64), block_before);
+    return it != blocks.end() && it->index == bit / 64 && ((it->bits >> (bit % 64)) & 1);
+}
+
+size_t Word_set::count() const {
+    size_t c = 0;
+    for (const Block& b : blocks) c += __builtin_popcountll(b.bits);
+    return c;
+}
+
+size_t Word_set::count_and_first_two(Word::Compact& out1, Word::Compact& out2) const {
+    size_t c = 0;
+    for (const_iterator it = begin(); it != end() && c < 2; ++it, ++c) {
+        (c == 0 ? out1 : out2) = (*it).compact();
+    }
+    return c < 2 ? c : count();
+}
+
+bool Word_set::operator==(const Word_set& other) const {
+    if (blocks.size() != other.blocks.size()) return false;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (blocks[i].index != other.blocks[i].index || blocks[i].bits != other.blocks[i].bits) return false;
+    }
+    return true;
+}
+
+Word_set& Word_set::filter(const CMask& m) {
+    // filter_blocks only ever writes behind where it reads
+    filter_blocks(blocks, m, blocks);
+    return *this;
+}
+
+Word_set Word_set::filtered(const CMask& m) const {
+    Word_set s;
+    filter_into(m, s);
+    return s;
+}
+
+void Word_set::filter_into(const CMask& m, Word_set& out) const {
+    filter_blocks(blocks, m, out.blocks);
+}
+
+void Word_set::filter_blocks(const vector<Block>& from, const CMask& m, vector<Block>& out) {
+    // Deep in the tree there are only a few words spread over a lot of blocks, and it's cheaper
+    // to CMask::check each of them than to touch a few index bitsets per block.
+    size_t num_words = 0;
+    for (const Block& b : from) num_words += __builtin_popcountll(b.bits);
+    if (num_words <= sparse_limit) {
+        size_t num_out = 0;
+        size_t num_from = from.size();
+        if (&out != &from) out.resize(num_from);
+        for (size_t i = 0; i < num_from; i++) {
+            uint32_t b = from[i].index;
+            uint64_t bits = from[i].bits;
+            for (uint64_t left = bits; left; left &= left - 1) {
+                int bit = __builtin_ctzll(left);
+                if (!m.check_word_cmask(word_index_of(b * 64 + bit).cmask())) bits &= ~(uint64_t(1) << bit);
+            }
+            if (bits) out[num_out++] = {bits, b};
+        }
+        out.resize(num_out);
+        return;
+    }
+
+    const Word_set_index& index = Word_set_index::get();
+
+    // Turn the mask into a list of bitsets to AND with, to AND NOT with, and groups to AND with
+    // the OR of. The count constraints are one AND each, the positional ones gathered by position.
+    const uint64_t* and_with[26];
+    const uint64_t* and_not_with[26 * 5];
+    const uint64_t* any_of[5][13];
+    int num_and = 0;
+    int num_and_not = 0;
+    int num_any_of[5] = {0, 0, 0, 0, 0};
+
+    uint32_t disallowed_by_pos[5];
+    uint32_t count_min_bits[2];
+    uint32_t count_exact;
+    m.letter_bits(disallowed_by_pos, count_min_bits, count_exact);
+    // letters the word can't have at all, no need to look at their positions
+    uint32_t excluded = count_exact & ~count_min_bits[0] & ~count_min_bits[1];
+    for (uint32_t letters = count_exact | count_min_bits[0] | count_min_bits[1]; letters; letters &= letters - 1) {
+        int letter = __builtin_ctz(letters);
+        int count_min = ((count_min_bits[0] >> letter) & 1) | (((count_min_bits[1] >> letter) & 1) << 1);
+        if ((count_exact >> letter) & 1) {
+            and_with[num_and++] = index.exactly(letter, count_min);
+        } else {
+            and_with[num_and++] = index.at_least(letter, count_min);
+        }
+    }
+
+    // Every word has exactly one letter at p, so "none of these letters at p" is the same as "one
+    // of the other letters at p". A green rules out 25 letters, so that's 1 bitset instead of 25.
+    const uint32_t all_letters = (1 << 26) - 1;
+    for (int p = 0; p < 5; p++) {
+        uint32_t remove = disallowed_by_pos[p] & ~excluded;
+        if (!remove) continue;
+        uint32_t keep = all_letters & ~disallowed_by_pos[p] & ~excluded;
+        if (__builtin_popcount(keep) < __builtin_popcount(remove)) {
+            for (uint32_t letters = keep; letters; letters &= letters - 1) any_of[p][num_any_of[p]++] = index.at(__builtin_ctz(letters), p);
+        } else {
+            for (uint32_t letters = remove; letters; letters &= letters - 1) and_not_with[num_and_not++] = index.at(__builtin_ctz(letters), p);
+        }
+    }
+
+    // one pass, and most blocks are gone after the first couple of bitsets
+    size_t num_out = 0;
+    size_t num_from = from.size();
+    if (&out != &from) out.resize(num_from);
+    for (size_t i = 0; i < num_from; i++) {
+        uint32_t b = from[i].index;
+        uint64_t bits = from[i].bits;
+        for (int k = 0; k < num_and && bits; k++) bits &= and_with[k][b];
+        for (int k = 0; k < num_and_not && bits; k++) bits &= ~and_not_with[k][b];
+        for (int p = 0; p < 5 && bits; p++) {
+            if (!num_any_of[p]) continue;
+            uint64_t allowed = 0;
+            for (int k = 0; k < num_any_of[p]; k++) allowed |= any_of[p][k][b];
+            bits &= allowed;
+        }
+        if (bits) out[num_out++] = {bits, b};
+    }
+    out.resize(num_out);
+}
+
+void Word_set::test() {
+    const vector<WordIndex>& answers = Dictionary::get_all_answers();
+    const vector<WordIndex>& guesses = Dictionary::get_all_answers_and_guesses();
+
+    std::stringstream output;
+    std::stringstream expected;
+
+    output << all_answers().count() << " " << all_answers_and_guesses().count() << " "
+           << (all_answers().to_list() == answers) << " " << (all_answers_and_guesses().to_list() == guesses) << std::endl;
+    expected << answers.size() << " " << guesses.size() << " 1 1" << std::endl;
+
+    // filter has to agree with CMask::check for all sorts of states, 1-3 guesses deep
+    size_t num_masks = 0;
+    size_t num_wrong = 0;
+    for (size_t i = 0; i < 300; i++) {
+        CMask m;
+        WordIndex answer = answers[(i * 37) % answers.size()];
+        for (size_t turn = 0; turn <= i % 3; turn++) {
+            m.apply(CMask(*answer, *guesses[(i * 7919 + turn * 104729) % guesses.size()]));
+        }
+        Word_set s = all_answers_and_guesses().filtered(m);
+        Word_set a = all_answers().filtered(m);
+        for (WordIndex w : guesses) {
+            if (s.contains(w) != m.check(*w)) num_wrong++;
+            if (Dictionary::is_answer(w) && a.contains(w) != m.check(*w)) num_wrong++;
+        }
+        if (!a.contains(answer) || a.count() > s.count()) num_wrong++;
+        num_masks++;
+    }
+    output << num_masks << " " << num_wrong << std::endl;
+    expected << "300 0" << std::endl;
+
+    Word_set s = of_list({ Dictionary::to_word_index(Word("HOTEL")), Dictionary::to_word_index(Word("MOTEL")), Dictionary::to_word_index(Word("CRANE")) });
+    Word::Compact out1 = Word("ZZZZZ");
+    Word::Compact out2 = Word("ZZZZZ");
+    output << s.count_and_first_two(out1, out2) << " " << Word(out1) << " " << Word(out2) << " " << s.filtered(CMask(Word("HOTEL"), Word("MOTEL"))).count() << std::endl;
+    expected << "3 CRANE HOTEL 1" << std::endl;
+
+    std::string output_str = output.str();
+    std::string expected_str = expected.str();
+    if (output_str != expected_str) {
+        throw std::runtime_error("Word_set::test() failed, got\n" + output_str + ", but expected\n" + expected_str);
+    }
+}
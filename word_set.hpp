@@ -0,0 +1,95 @@
+/* A set of dictionary words as a bitset, bit i is WordIndex i.
+
+   A CMask is just a conjunction of per-letter constraints (letter not at position p, at least k
+   of a letter, exactly k of a letter), so we precompute one bitset over the whole dictionary for
+   each of "L at p", "at least k L's" and "exactly k L's". Filtering a set by a mask is then a few
+   dozen AND/ANDNOTs per 64 words instead of a CMask::check per word.
+
+   Only the non-zero 64-bit blocks are stored (with their block number), so the sets deep in the
+   tree that only have a handful of words left cost about as much as a handful of checks. All the
+   answers come first in the dictionary, so they fit in the first ~37 blocks, all the guesses in
+   ~200.
+*/
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "dictionary.hpp"
+#include "cmask.hpp"
+
+class Word_set {
+public:
+    typedef Dictionary::WordIndex WordIndex;
+
+    Word_set() {}
+
+    static const Word_set& all_answers();
+    static const Word_set& all_answers_and_guesses();
+    static Word_set of_list(const std::vector<WordIndex>& words);
+    // in WordIndex order
+    std::vector<WordIndex> to_list() const;
+    // the same into [out], reusing its memory
+    void to_list(std::vector<WordIndex>& out) const;
+
+    // keeps only the words [m] allows, same as CMask::check on each of them
+    Word_set& filter(const CMask& m);
+    Word_set filtered(const CMask& m) const;
+    // out = filtered(m), reusing [out]'s memory
+    void filter_into(const CMask& m, Word_set& out) const;
+
+    void insert(WordIndex w);
+    bool contains(WordIndex w) const;
+    size_t count() const;
+    bool empty() const { return blocks.empty(); }
+    // the same as Solver::valid_count: returns count(), and sets [out1], [out2] to the first two
+    // words if there are that many
+    size_t count_and_first_two(Word::Compact& out1, Word::Compact& out2) const;
+
+    bool operator==(const Word_set& other) const;
+
+private:
+    struct Block {
+        uint64_t bits; // never 0
+        uint32_t index;
+    };
+    std::vector<Block> blocks; // sorted by index
+
+public:
+    // goes through the words in WordIndex order
+    class const_iterator {
+    public:
+        WordIndex operator*() const { return word_index_of(block->index * 64 + __builtin_ctzll(bits)); }
+        const_iterator& operator++() {
+            bits &= bits - 1;
+            if (!bits && ++block != end) bits = block->bits;
+            return *this;
+        }
+        bool operator!=(const const_iterator& other) const { return block != other.block || bits != other.bits; }
+    private:
+        const_iterator(const Block* block_, const Block* end_) : block(block_), end(end_), bits(block_ != end_ ? block_->bits : 0) {}
+        const Block* block;
+        const Block* end;
+        uint64_t bits;
+        friend class Word_set;
+    };
+    const_iterator begin() const { return const_iterator(blocks.data(), blocks.data() + blocks.size()); }
+    const_iterator end() const { return const_iterator(blocks.data() + blocks.size(), blocks.data() + blocks.size()); }
+
+    // calls f(WordIndex) for each word in WordIndex order
+    template<class F> void for_each(F f) const {
+        for (const Block& b : blocks) {
+            for (uint64_t bits = b.bits; bits; bits &= bits - 1) f(word_index_of(b.index * 64 + __builtin_ctzll(bits)));
+        }
+    }
+
+    static void test();
+private:
+    static WordIndex word_index_of(size_t bit);
+    static size_t bit_of(WordIndex w);
+
+    static bool block_before(const Block& b, uint32_t index);
+    // out = the blocks of [from] that pass [m], [out] can be [from]
+    static void filter_blocks(const std::vector<Block>& from, const CMask& m, std::vector<Block>& out);
+
+    friend struct Word_set_index;
+};
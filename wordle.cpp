@@ -5,13 +5,23 @@
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/program_options.hpp>
 #include <memory>
+#include <thread>
+#include <chrono>
 #include "word.hpp"
 #include "result.hpp"
 #include "cmask.hpp"
 #include "dictionary.hpp"
+#include "word_set.hpp"
+#include "feedback.hpp"
+#include "endgame.hpp"
 #include "solver.hpp"
 #include "job.hpp"
 #include "db.hpp"
+#include "tiered_db.hpp"
+#include "fingerprint_db.hpp"
+#include "tablebase.hpp"
+#include "server.hpp"
+#include "metrics.hpp"
 
 typedef Dictionary::WordIndex WordIndex;
 
@@ -24,18 +34,63 @@ using std::endl;
 
 namespace po = boost::program_options;
 
+// --progress: a line on stderr at most once a second, so stdout stays just the answer
+class Stderr_progress : public Solver::Progress_hook {
+public:
+    Stderr_progress() : last(std::chrono::steady_clock::now()) {}
+    void on_progress(const Solver::Progress& p) override {
+        auto t = std::chrono::steady_clock::now();
+        if (p.done < p.total && t - last < std::chrono::seconds(1)) return;
+        last = t;
+        std::cerr << p.done << "/" << p.total << " done, best " << p.best.best_guess << " with " << p.best.best_score
+                  << ", " << static_cast<int64_t>(p.calls_per_second) << " calls/s";
+        if (p.eta_seconds >= 0 && p.done < p.total) std::cerr << ", about " << static_cast<int64_t>(p.eta_seconds) << "s to go";
+        std::cerr << endl;
+    }
+private:
+    std::chrono::steady_clock::time_point last;
+};
+
 int main(int argc, char* argv[]) {
     float cutoff = 999;
     int num_turns = 0;
     vector<string> opt_dbr;
     string opt_dbw;
+    string opt_dbt;
+    string opt_dbf;
+    string opt_tablebase;
+    double write_back_calls;
+    double write_back_ms;
+    string opt_serve;
+    unsigned int metrics_port;
+    unsigned int num_threads;
+    double timeout_ms;
+    string opt_trace;
+    size_t trace_depth;
 
     po::options_description desc("Run a wordle worker that will connect to a server for work");
     desc.add_options()
         ("dbr,r",       po::value<vector<string>>(&opt_dbr),           "read-only db")
         ("dbw,w",       po::value<string>(&opt_dbw),                   "read-write db")
+        ("dbt,t",       po::value<string>(&opt_dbt),                   "tiered db directory, takes new results without holding them all in RAM")
+        ("dbf,f",       po::value<string>(&opt_dbf),                   "fingerprint db, read-only and smaller (see dbtool fingerprint)")
+        ("tablebase,e", po::value<string>(&opt_tablebase),             "endgame tablebase to look small states up in (see dbtool tablebase)")
+        ("write-back-calls", po::value<double>(&write_back_calls)->default_value(10000), "write results that took at least this many calls back to the db, 0 = never")
+        ("write-back-ms", po::value<double>(&write_back_ms)->default_value(0), "write results that took at least this long back to the db, 0 = never")
+        ("serve,s",     po::value<string>(&opt_serve),                 "stay up answering JSON requests on this Unix socket (see server.hpp)")
+        ("metrics-port", po::value<unsigned int>(&metrics_port)->default_value(0), "with --serve, serve Prometheus metrics on this port of 127.0.0.1 (see metrics.hpp), 0 = don't")
+        ("threads,j",   po::value<unsigned int>(&num_threads)->default_value(std::thread::hardware_concurrency()), "threads solving requests with --serve, for each of the interactive and background classes")
         ("cutoff,c",    po::value<float>(&cutoff)->default_value(999), "treat all scores at least this the same")
+        ("timeout-ms,T", po::value<double>(&timeout_ms)->default_value(0), "give up after this long, 0 = never")
+        ("anytime",                                                    "with --timeout-ms, print the best found so far instead of giving up")
+        ("progress",                                                   "report how far the top level has got on stderr as it goes")
+        ("stats",                                                      "print what the solve did at each depth of the search")
+        ("stats-json",                                                 "the same as --stats, as one line of JSON")
+        ("trace",       po::value<string>(&opt_trace),                 "write the top of the search tree to this file as Chrome trace JSON (see trace.hpp)")
+        ("trace-depth", po::value<size_t>(&trace_depth)->default_value(2), "how many solve_p levels --trace records")
+        ("perf-counters",                                              "with --stats or --stats-json, count cycles, instructions and cache and branch misses too")
         ("objective,o", po::value<int>(&num_turns)->default_value(0),  "set objective to win in # turns")
+        ("self-test",                                                  "run the slow self-tests too, then exit")
         ("help,h",                                                     "produce help message");
     po::variables_map vm;
     po::parsed_options parsed = 
@@ -46,13 +101,42 @@ int main(int argc, char* argv[]) {
         std::cerr << desc << endl;
         return 1;
     }
+    if (metrics_port > 65535) {
+        std::cerr << "--metrics-port " << metrics_port << " isn't a port" << endl;
+        return 1;
+    }
 
     Word::test();
     Result::test();
     CMask::test();
+    Word_set::test();
+    Feedback::test();
+    Solver::Deadline::test();
+    Solver::Endgame::test();
     Solver::SolveResult::test();
+    Solver::Solve_stats::test();
+    Solver::Perf_counters::test();
+    Solver::Tracer::test();
+    Metrics::Registry::test();
     Job::test();
-    Db::test();
+    // the ones that write files, or use threads, sockets or real solves, are too slow for every
+    // query, and wordles running side by side would share their files
+    if (vm.count("self-test")) {
+        Solver::Tablebase::test();
+        Db::test();
+        Db::Fingerprint_db::test();
+        Solver::test();
+        Metrics::Http_endpoint::test();
+        Db::Tiered_db::test();
+        Solver::slow_test();
+        Server::Scheduler::test();
+        Server::Singleflight::test();
+        Server::Socket_server::test();
+        std::cout << "Self-tests passed" << endl;
+        return 0;
+    }
+    // the tests counted into the process-wide metrics too
+    Metrics::registry().reset();
 
     const vector<WordIndex>& answers = Dictionary::get_all_answers();
     const vector<WordIndex>& guesses = Dictionary::get_all_answers_and_guesses();;
@@ -90,30 +174,106 @@ int main(int argc, char* argv[]) {
     cout << m.to_hex() << endl;
     
     std::shared_ptr<Db::Db_intf> db_ptr;
-    if (opt_dbw.empty()) {
+    if (!opt_dbf.empty()) {
+        db_ptr = std::make_shared<Db::Fingerprint_db>(opt_dbf);
+    } else if (!opt_dbt.empty()) {
+        db_ptr = std::make_shared<Db::Tiered_db>(opt_dbt, 1000000, 8);
+    } else if (opt_dbw.empty()) {
         db_ptr = std::make_shared<Db::Read_only_db>(opt_dbr);
     } else {
         db_ptr = std::make_shared<Db::Read_write_db>(opt_dbr, opt_dbw, true);
     }
     Db::Db_intf& db(*db_ptr);
+    std::unique_ptr<Solver::Tablebase> tablebase;
+    if (!opt_tablebase.empty()) {
+        tablebase.reset(new Solver::Tablebase(opt_tablebase));
+        Solver::Endgame::set_tablebase(tablebase.get());
+    }
+
+    Solver::set_write_back_policy(Solver::Write_back_policy(write_back_calls, write_back_ms * 1000));
+
+    if (!opt_serve.empty()) {
+        // only Read_write_db needs the lock, the others are thread safe already
+        Db::Locked_db locked_db(db);
+        Db::Db_intf& shared_db = opt_dbw.empty() ? db : locked_db;
+        Server::Socket_server server(shared_db, opt_serve, num_threads);
+        std::unique_ptr<Metrics::Http_endpoint> metrics;
+        std::thread metrics_thread;
+        if (metrics_port > 0) {
+            metrics.reset(new Metrics::Http_endpoint(Metrics::registry(), metrics_port));
+            metrics_thread = std::thread([&] { metrics->run(); });
+        }
+        server.run();
+        if (metrics) {
+            metrics->stop();
+            metrics_thread.join();
+        }
+        return 0;
+    }
+
+    boost::posix_time::ptime timeout = boost::posix_time::pos_infin;
+    if (timeout_ms > 0) {
+        timeout = boost::posix_time::microsec_clock::local_time() + boost::posix_time::microseconds(static_cast<int64_t>(timeout_ms * 1000));
+    }
+    bool anytime = vm.count("anytime") > 0;
+    Stderr_progress progress;
+    if (vm.count("progress")) Solver::set_progress_hook(&progress);
+    Solver::Solve_stats stats;
+    if (vm.count("stats") || vm.count("stats-json")) Solver::set_solve_stats(&stats);
+    std::unique_ptr<Solver::Tracer> tracer;
+    if (!opt_trace.empty()) {
+        tracer.reset(new Solver::Tracer(trace_depth));
+        Solver::set_tracer(tracer.get());
+    }
+    std::unique_ptr<Solver::Perf_counters> perf;
+    uint64_t perf_start[Solver::Perf_counters::num_events];
+    if (vm.count("perf-counters")) {
+        perf.reset(new Solver::Perf_counters);
+        if (!perf->any_open()) std::cerr << "perf_event_open: no counters available (see kernel.perf_event_paranoid)" << endl;
+        stats.set_perf_counters(perf.get());
+        perf->read(perf_start);
+    }
 
     Solver::SolveResult g;
-    if (num_turns > 0) {
-        g = Solver::solve_b(&db, answers, guesses, m, num_turns, 0, true, true);
-    } else {
-        if (guess == WordIndex()) {
-            g = Solver::solve_p(&db, answers, guesses, m, cutoff, true, true);
+    try {
+        if (num_turns > 0) {
+            g = Solver::solve_b(&db, answers, guesses, m, num_turns, 0, true, true, timeout, anytime);
         } else {
-            cout << *guess << endl;
-            vector<WordIndex> valid_answers = Solver::valid_list(m, answers);
-            g = Solver::solve_c(&db, valid_answers, guesses, m, guess, cutoff, true, true); 
+            if (guess == WordIndex()) {
+                g = Solver::solve_p(&db, answers, guesses, m, cutoff, true, true, timeout, anytime);
+            } else {
+                cout << *guess << endl;
+                vector<WordIndex> valid_answers = Solver::valid_list(m, answers);
+                g = Solver::solve_c(&db, valid_answers, guesses, m, guess, cutoff, true, true, nullptr, timeout, anytime); 
+            }
         }
+    } catch (const Solver::Timeout&) {
+        // with --anytime too, when nothing was found in time
+        std::cerr << "Timed out after " << timeout_ms << "ms" << (anytime ? " without finding anything" : "") << endl;
+        return 1;
     }
 
-    cout << "best_score   = " << g.best_score << endl;
+    cout << "best_score   = " << (g.get_bound() == Solver::Bound::lower ? ">=" : g.get_bound() == Solver::Bound::upper ? "<=" : "") << g.best_score << endl;
     cout << "best_guess   = " << g.best_guess << endl;
     cout << "wost_answer  = " << g.worst_answer << endl;        
     cout << "perf_calls   = " << g.perf_calls << endl;
-    cout << "perf_seconds = " << (g.perf_microseconds/1e6) << endl;
+    cout << "perf_seconds = " << (g.get_perf_microseconds()/1e6) << endl;
+    if (perf) {
+        // the phases are only part of it, the rest is the recursion itself
+        uint64_t perf_end[Solver::Perf_counters::num_events];
+        perf->read(perf_end);
+        cout << "perf_events  =";
+        for (int e = 0; e < Solver::Perf_counters::num_events; e++) {
+            if (perf->is_open(e)) cout << " " << Solver::Perf_counters::event_name(e) << "=" << perf_end[e] - perf_start[e];
+        }
+        cout << endl;
+    }
+    if (tracer) {
+        std::ofstream trace_file(opt_trace);
+        tracer->write_json(trace_file);
+        if (!trace_file) std::cerr << "Couldn't write " << opt_trace << endl;
+    }
+    if (vm.count("stats")) stats.print(cout);
+    if (vm.count("stats-json")) cout << stats.to_json() << endl;
     return 0;
 }